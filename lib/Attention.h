@@ -0,0 +1,124 @@
+#include <cmath>
+#include <limits>
+#include "Matmul.h"
+
+#pragma once
+
+// query / key rows processed together by one attention task
+const std::size_t ATTENTION_BLOCK_Q = 32;
+const std::size_t ATTENTION_BLOCK_K = 64;
+
+// settings of scaled dot-product attention
+template<typename T>
+struct AttentionOptions {
+	// query i only attends keys j <= i (top-left aligned)
+	bool causal = false;
+	// score scale, 0 selects 1 / sqrt(D)
+	T scale = 0;
+	// additive [S_q, S_k] mask broadcast over batch and heads, nullptr disables it
+	Tensor<2, T>* mask = nullptr;
+};
+
+// Fused scaled dot-product attention out = softmax(Q @ K^T * scale + mask) @ V over [B, H, S, D] tensors.
+// Each task owns a block of queries and walks the keys block by block with running max / sum statistics,
+// so the [S_q, S_k] score matrix is never materialized.
+// A copy-on-write out whose buffer is shared with other tensors throws std::logic_error, detach() it first.
+template<typename T>
+void attention(Tensor<4, T> q, Tensor<4, T> k, Tensor<4, T> v, Tensor<4, T> out, const AttentionOptions<T>& opts = AttentionOptions<T>{}){
+	out.claimOutput(q, k, v);
+	const std::size_t B = q.dimensions[0], H = q.dimensions[1], SQ = q.dimensions[2], D = q.dimensions[3];
+	const std::size_t SK = k.dimensions[2], DV = v.dimensions[3];
+	if(k.dimensions[0] != B || k.dimensions[1] != H || k.dimensions[3] != D) throw std::invalid_argument("Key dimensions do not match queries");
+	if(v.dimensions[0] != B || v.dimensions[1] != H || v.dimensions[2] != SK) throw std::invalid_argument("Value dimensions do not match keys");
+	if(out.dimensions[0] != B || out.dimensions[1] != H || out.dimensions[2] != SQ || out.dimensions[3] != DV) throw std::invalid_argument("Output array dimension mismatch");
+	if(opts.mask && (opts.mask->dimensions[0] != SQ || opts.mask->dimensions[1] != SK)) throw std::invalid_argument("Mask dimensions do not match");
+	const T scale = (opts.scale != T(0) ? opts.scale : T(1) / std::sqrt(T(D)));
+	const T* mask = opts.mask ? opts.mask->data() : nullptr;
+	const std::size_t ms0 = opts.mask ? opts.mask->dimensionIncrementors[0] : 0;
+	const std::size_t ms1 = opts.mask ? opts.mask->dimensionIncrementors[1] : 0;
+	const T minusInf = -std::numeric_limits<T>::infinity();
+
+	const T* qData = q.data();
+	const T* kData = k.data();
+	const T* vData = v.data();
+	T* outData = out.data();
+	const std::size_t queryBlocks = (SQ + ATTENTION_BLOCK_Q - 1) / ATTENTION_BLOCK_Q;
+	const std::size_t workspace = ATTENTION_BLOCK_Q * (ATTENTION_BLOCK_K + DV + 2);
+
+	parallel_for(0, B * H * queryBlocks, 1, [&](std::size_t t0, std::size_t t1){
+		WorkspaceLease<T> scratch(workspace);
+		T* scores = scratch.data();
+		T* acc = scores + ATTENTION_BLOCK_Q * ATTENTION_BLOCK_K;
+		T* rowMax = acc + ATTENTION_BLOCK_Q * DV;
+		T* rowSum = rowMax + ATTENTION_BLOCK_Q;
+		const Epilogue<T> scoreEp{scale, 0};
+		const Epilogue<T> accumulate{1, 1};
+		for(std::size_t task = t0; task < t1; task++){
+			const std::size_t b = task / (H * queryBlocks);
+			const std::size_t h = (task / queryBlocks) % H;
+			const std::size_t i0 = (task % queryBlocks) * ATTENTION_BLOCK_Q;
+			const std::size_t qn = (SQ - i0 < ATTENTION_BLOCK_Q ? SQ - i0 : ATTENTION_BLOCK_Q);
+			const T* qb = qData + b * q.dimensionIncrementors[0] + h * q.dimensionIncrementors[1] + i0 * q.dimensionIncrementors[2];
+			const T* kb = kData + b * k.dimensionIncrementors[0] + h * k.dimensionIncrementors[1];
+			const T* vb = vData + b * v.dimensionIncrementors[0] + h * v.dimensionIncrementors[1];
+			for(std::size_t r = 0; r < qn; r++){
+				rowMax[r] = minusInf;
+				rowSum[r] = 0;
+				for(std::size_t d = 0; d < DV; d++){
+					acc[r * DV + d] = 0;
+				}
+			}
+			// keys past the last query of the block are fully masked under causal attention
+			const std::size_t keyEnd = (opts.causal && i0 + qn < SK ? i0 + qn : SK);
+			for(std::size_t j0 = 0; j0 < keyEnd; j0 += ATTENTION_BLOCK_K){
+				const std::size_t kn = (keyEnd - j0 < ATTENTION_BLOCK_K ? keyEnd - j0 : ATTENTION_BLOCK_K);
+				// scores = Q_block @ K_block^T * scale
+				_gemmKernel(qn, kn, D, qb, q.dimensionIncrementors[2], q.dimensionIncrementors[3],
+					kb + j0 * k.dimensionIncrementors[2], k.dimensionIncrementors[3], k.dimensionIncrementors[2],
+					scores, ATTENTION_BLOCK_K, std::size_t(1), (const T*)nullptr, 0, scoreEp);
+				for(std::size_t r = 0; r < qn; r++){
+					T* s = scores + r * ATTENTION_BLOCK_K;
+					T blockMax = minusInf;
+					for(std::size_t c = 0; c < kn; c++){
+						if(opts.causal && j0 + c > i0 + r){
+							s[c] = minusInf;
+						}else if(mask){
+							s[c] += mask[(i0 + r) * ms0 + (j0 + c) * ms1];
+						}
+						if(s[c] > blockMax) blockMax = s[c];
+					}
+					const T newMax = (blockMax > rowMax[r] ? blockMax : rowMax[r]);
+					if(newMax == minusInf){
+						// everything masked so far
+						for(std::size_t c = 0; c < kn; c++){
+							s[c] = 0;
+						}
+						continue;
+					}
+					const T correction = std::exp(rowMax[r] - newMax);
+					T sum = 0;
+					for(std::size_t c = 0; c < kn; c++){
+						s[c] = std::exp(s[c] - newMax);
+						sum += s[c];
+					}
+					rowSum[r] = rowSum[r] * correction + sum;
+					rowMax[r] = newMax;
+					for(std::size_t d = 0; d < DV; d++){
+						acc[r * DV + d] *= correction;
+					}
+				}
+				// acc += P @ V_block
+				_gemmKernel(qn, DV, kn, (const T*)scores, ATTENTION_BLOCK_K, std::size_t(1),
+					vb + j0 * v.dimensionIncrementors[2], v.dimensionIncrementors[2], v.dimensionIncrementors[3],
+					acc, DV, std::size_t(1), (const T*)nullptr, 0, accumulate);
+			}
+			T* ob = outData + b * out.dimensionIncrementors[0] + h * out.dimensionIncrementors[1] + i0 * out.dimensionIncrementors[2];
+			for(std::size_t r = 0; r < qn; r++){
+				const T inv = (rowSum[r] > T(0) ? T(1) / rowSum[r] : T(0));
+				for(std::size_t d = 0; d < DV; d++){
+					ob[r * out.dimensionIncrementors[2] + d * out.dimensionIncrementors[3]] = acc[r * DV + d] * inv;
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,461 @@
+#include <vector>
+#include <cmath>
+#include "Tensor.h"
+#include "Matmul.h"
+#include "Elementwise.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+template<typename T>
+class Tape;
+
+// Rank independent bookkeeping of a recorded tensor
+template<typename T>
+struct VarNodeBase {
+	Reference<T>* valueBuffer = nullptr;
+	Reference<T>* gradBuffer = nullptr;
+	bool requiresGrad = false;
+	bool hasGrad = false;
+	bool persistent = false;
+};
+
+// Value and gradient of one recorded tensor. Intermediate nodes borrow their buffers from the tape
+// and hand them back as soon as the backward pass is done with them.
+template<int DIMENSION_COUNT, typename T>
+struct VarNode : VarNodeBase<T> {
+	Tensor<DIMENSION_COUNT, T> value;
+	Tensor<DIMENSION_COUNT, T> grad;
+};
+
+// Handle to a tensor recorded on a Tape, cheap to copy
+template<int DIMENSION_COUNT, typename T>
+class Variable {
+PRIVATE:
+	Tape<T>* tape = nullptr;
+	VarNode<DIMENSION_COUNT, T>* node = nullptr;
+public:
+	Variable() {}
+	Variable(Tape<T>* t, VarNode<DIMENSION_COUNT, T>* n): tape(t), node(n) {}
+
+	Tensor<DIMENSION_COUNT, T>& value(){
+		return node->value;
+	}
+
+	// gradient after Tape::backward, only valid for nodes that received one
+	Tensor<DIMENSION_COUNT, T>& grad(){
+		if(!node->hasGrad) throw std::logic_error("Variable has no gradient");
+		return node->grad;
+	}
+
+	Variable& operator+=(Variable t);
+	Variable& operator-=(Variable t);
+
+	// broadcasting add of a lower-rank variable (e.g. a bias) along the trailing axes
+	template<int O_DIM>
+	Variable& operator+=(Variable<O_DIM, T> t);
+};
+
+// Reverse-mode autodiff tape. Ops are recorded as plain function pointers with node pointers,
+// node objects and buffers are recycled across reset() calls, so a warm tape running the same
+// sequence of ops does not allocate.
+template<typename T>
+class Tape {
+public:
+	struct Entry {
+		void (*backward)(Tape&, Entry&);
+		VarNodeBase<T>* out;
+		VarNodeBase<T>* in0;
+		VarNodeBase<T>* in1;
+		T scalar;
+	};
+
+PRIVATE:
+	struct NodeSlot {
+		VarNodeBase<T>* node;
+		void (*destroy)(VarNodeBase<T>*);
+		const void* type;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<NodeSlot> transient;
+	std::size_t transientUsed = 0;
+	std::vector<NodeSlot> persistent;
+	std::vector<Reference<T>*> buffers;
+	std::vector<Reference<T>*> freeBuffers;
+
+	template<int DIMENSION_COUNT>
+	static const void* typeTag(){
+		static const char tag = 0;
+		return &tag;
+	}
+
+	template<int DIMENSION_COUNT>
+	static void destroyNode(VarNodeBase<T>* n){
+		delete static_cast<VarNode<DIMENSION_COUNT, T>*>(n);
+	}
+
+	template<int DIMENSION_COUNT>
+	VarNode<DIMENSION_COUNT, T>* newTransient(){
+		if(transientUsed < transient.size() && transient[transientUsed].type == typeTag<DIMENSION_COUNT>()){
+			return static_cast<VarNode<DIMENSION_COUNT, T>*>(transient[transientUsed++].node);
+		}
+		NodeSlot slot{new VarNode<DIMENSION_COUNT, T>(), destroyNode<DIMENSION_COUNT>, typeTag<DIMENSION_COUNT>()};
+		if(transientUsed < transient.size()){
+			transient[transientUsed].destroy(transient[transientUsed].node);
+			transient[transientUsed] = slot;
+		}else{
+			transient.push_back(slot);
+		}
+		transientUsed++;
+		return static_cast<VarNode<DIMENSION_COUNT, T>*>(slot.node);
+	}
+
+	Reference<T>* acquireBuffer(std::size_t size){
+		for(std::size_t i = 0; i < freeBuffers.size(); i++){
+			if(freeBuffers[i]->length() == size){
+				Reference<T>* b = freeBuffers[i];
+				freeBuffers[i] = freeBuffers.back();
+				freeBuffers.pop_back();
+				return b;
+			}
+		}
+		Reference<T>* b = new Reference<T>(size);
+		buffers.push_back(b);
+		freeBuffers.reserve(buffers.size());
+		return b;
+	}
+
+	void releaseBuffer(Reference<T>*& b){
+		if(!b) return;
+		freeBuffers.push_back(b);
+		b = nullptr;
+	}
+
+	template<int DIMENSION_COUNT>
+	static std::size_t elementCount(const std::size_t (&dims)[DIMENSION_COUNT]){
+		std::size_t n = 1;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			n *= dims[i];
+		}
+		return n;
+	}
+
+public:
+	Tape() {}
+	Tape(Tape&) = delete;
+
+	~Tape(){
+		for(NodeSlot& s: transient) s.destroy(s.node);
+		for(NodeSlot& s: persistent) s.destroy(s.node);
+		for(Reference<T>* b: buffers) delete b;
+	}
+
+	// trainable leaf, keeps its gradient buffer across reset() so gradients can be read and applied
+	template<int DIMENSION_COUNT>
+	Variable<DIMENSION_COUNT, T> parameter(Tensor<DIMENSION_COUNT, T> value){
+		VarNode<DIMENSION_COUNT, T>* n = new VarNode<DIMENSION_COUNT, T>();
+		persistent.push_back(NodeSlot{n, destroyNode<DIMENSION_COUNT>, typeTag<DIMENSION_COUNT>()});
+		n->value = value;
+		n->grad = Tensor<DIMENSION_COUNT, T>(value.dimensions);
+		n->requiresGrad = true;
+		n->persistent = true;
+		return Variable<DIMENSION_COUNT, T>(this, n);
+	}
+
+	// non-trainable leaf, shares memory with value
+	template<int DIMENSION_COUNT>
+	Variable<DIMENSION_COUNT, T> input(Tensor<DIMENSION_COUNT, T> value){
+		VarNode<DIMENSION_COUNT, T>* n = newTransient<DIMENSION_COUNT>();
+		n->value = value;
+		n->requiresGrad = false;
+		n->hasGrad = false;
+		return Variable<DIMENSION_COUNT, T>(this, n);
+	}
+
+	// intermediate result with a pooled value buffer of the given shape
+	template<int DIMENSION_COUNT>
+	VarNode<DIMENSION_COUNT, T>* intermediate(const std::size_t (&dims)[DIMENSION_COUNT], bool requiresGrad){
+		VarNode<DIMENSION_COUNT, T>* n = newTransient<DIMENSION_COUNT>();
+		n->valueBuffer = acquireBuffer(elementCount(dims));
+		n->value = Tensor<DIMENSION_COUNT, T>(dims, *n->valueBuffer);
+		n->requiresGrad = requiresGrad;
+		n->hasGrad = false;
+		return n;
+	}
+
+	// records the backward function of an op, ops without trainable inputs are not recorded
+	void record(void (*backward)(Tape&, Entry&), VarNodeBase<T>* out, VarNodeBase<T>* in0, VarNodeBase<T>* in1 = nullptr, T scalar = T(0)){
+		if(out->requiresGrad) entries.push_back(Entry{backward, out, in0, in1, scalar});
+	}
+
+	// gradient of n ready for in-place accumulation, zeroed on first use
+	template<int DIMENSION_COUNT>
+	Tensor<DIMENSION_COUNT, T>& gradOf(VarNode<DIMENSION_COUNT, T>* n){
+		if(!n->hasGrad){
+			if(!n->persistent){
+				n->gradBuffer = acquireBuffer(elementCount(n->value.dimensions));
+				n->grad = Tensor<DIMENSION_COUNT, T>(n->value.dimensions, *n->gradBuffer);
+			}
+			_forEachElement([](T& g){ g = 0; }, n->grad);
+			n->hasGrad = true;
+		}
+		return n->grad;
+	}
+
+	// runs the recorded ops in reverse starting from root with a gradient of ones,
+	// buffers of intermediates are recycled as soon as their producing op has been differentiated
+	template<int DIMENSION_COUNT>
+	void backward(Variable<DIMENSION_COUNT, T> root){
+		_forEachElement([](T& g){ g = 1; }, gradOf(root.node));
+		for(std::size_t i = entries.size(); i-- > 0;){
+			entries[i].backward(*this, entries[i]);
+			release(entries[i].out);
+		}
+		entries.clear();
+	}
+
+	void release(VarNodeBase<T>* n){
+		if(n->persistent) return;
+		releaseBuffer(n->valueBuffer);
+		releaseBuffer(n->gradBuffer);
+	}
+
+	// clears the parameter gradients, they are zeroed lazily on the next accumulation
+	void zeroGrad(){
+		for(NodeSlot& s: persistent){
+			s.node->hasGrad = false;
+		}
+	}
+
+	// drops all intermediates and recorded ops, keeping their memory for the next iteration
+	void reset(){
+		entries.clear();
+		freeBuffers.clear();
+		for(Reference<T>* b: buffers) freeBuffers.push_back(b);
+		for(std::size_t i = 0; i < transientUsed; i++){
+			transient[i].node->valueBuffer = nullptr;
+			transient[i].node->gradBuffer = nullptr;
+		}
+		transientUsed = 0;
+	}
+};
+
+// calls func(x, y) for every element x of a with the element y of b broadcast along the leading axes of a
+template<int DIMENSION_COUNT, int O_DIM, typename T, typename F>
+void _broadcastElements(Tensor<DIMENSION_COUNT, T> a, Tensor<O_DIM, T> b, F func){
+	if constexpr(DIMENSION_COUNT == O_DIM){
+		_forEachElement(func, a, b);
+	}else{
+		for(std::size_t i = 0; i < a.dimensions[0]; i++){
+			_broadcastElements(a.slice(i), b, func);
+		}
+	}
+}
+
+// ----------------------------------------backward functions----------------------------------------
+
+template<int DIMENSION_COUNT, typename T>
+void _addBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<DIMENSION_COUNT, T>* out = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.out);
+	if(!out->hasGrad) return;
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	VarNode<DIMENSION_COUNT, T>* b = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in1);
+	const T sign = e.scalar;
+	if(a->requiresGrad) _forEachElement([](T& d, T& g){ d += g; }, tape.gradOf(a), out->grad);
+	if(b->requiresGrad) _forEachElement([sign](T& d, T& g){ d += sign * g; }, tape.gradOf(b), out->grad);
+}
+
+template<int DIMENSION_COUNT, int O_DIM, typename T>
+void _broadcastAddBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<DIMENSION_COUNT, T>* out = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.out);
+	if(!out->hasGrad) return;
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	VarNode<O_DIM, T>* b = static_cast<VarNode<O_DIM, T>*>(e.in1);
+	if(a->requiresGrad) _forEachElement([](T& d, T& g){ d += g; }, tape.gradOf(a), out->grad);
+	if(b->requiresGrad) _broadcastElements(out->grad, tape.gradOf(b), [](T& g, T& d){ d += g; });
+}
+
+template<int DIMENSION_COUNT, typename T>
+void _mulBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<DIMENSION_COUNT, T>* out = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.out);
+	if(!out->hasGrad) return;
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	VarNode<DIMENSION_COUNT, T>* b = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in1);
+	if(a->requiresGrad) _forEachElement([](T& d, T& g, T& x){ d += g * x; }, tape.gradOf(a), out->grad, b->value);
+	if(b->requiresGrad) _forEachElement([](T& d, T& g, T& x){ d += g * x; }, tape.gradOf(b), out->grad, a->value);
+}
+
+template<typename T>
+void _matmulBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<2, T>* out = static_cast<VarNode<2, T>*>(e.out);
+	if(!out->hasGrad) return;
+	VarNode<2, T>* a = static_cast<VarNode<2, T>*>(e.in0);
+	VarNode<2, T>* b = static_cast<VarNode<2, T>*>(e.in1);
+	// transposes are swapaxes views, gradients accumulate in place through the beta epilogue
+	const Epilogue<T> accumulate{1, 1};
+	if(a->requiresGrad) matmul(out->grad, b->value.swapaxes(0, 1), tape.gradOf(a), accumulate);
+	if(b->requiresGrad) matmul(a->value.swapaxes(0, 1), out->grad, tape.gradOf(b), accumulate);
+}
+
+template<int DIMENSION_COUNT, typename T>
+void _activationBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<DIMENSION_COUNT, T>* out = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.out);
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	if(!out->hasGrad || !a->requiresGrad) return;
+	// derivatives expressed through the output y
+	switch(static_cast<Activation>(static_cast<int>(e.scalar))){
+		case Activation::RELU:
+			_forEachElement([](T& d, T& g, T& y){ d += (y > T(0) ? g : T(0)); }, tape.gradOf(a), out->grad, out->value);
+			break;
+		case Activation::TANH:
+			_forEachElement([](T& d, T& g, T& y){ d += g * (T(1) - y * y); }, tape.gradOf(a), out->grad, out->value);
+			break;
+		case Activation::SIGMOID:
+			_forEachElement([](T& d, T& g, T& y){ d += g * y * (T(1) - y); }, tape.gradOf(a), out->grad, out->value);
+			break;
+		default:
+			throw std::invalid_argument("Activation has no recorded derivative");
+	}
+}
+
+template<int DIMENSION_COUNT, typename T>
+void _scaleBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<DIMENSION_COUNT, T>* out = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.out);
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	if(!out->hasGrad || !a->requiresGrad) return;
+	const T s = e.scalar;
+	_forEachElement([s](T& d, T& g){ d += s * g; }, tape.gradOf(a), out->grad);
+}
+
+template<int DIMENSION_COUNT, typename T>
+void _sumBackward(Tape<T>& tape, typename Tape<T>::Entry& e){
+	VarNode<1, T>* out = static_cast<VarNode<1, T>*>(e.out);
+	VarNode<DIMENSION_COUNT, T>* a = static_cast<VarNode<DIMENSION_COUNT, T>*>(e.in0);
+	if(!out->hasGrad || !a->requiresGrad) return;
+	const T g = out->grad[{0}];
+	_forEachElement([g](T& d){ d += g; }, tape.gradOf(a));
+}
+
+// ----------------------------------------recorded ops----------------------------------------
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> _addOrSub(Variable<DIMENSION_COUNT, T> a, Variable<DIMENSION_COUNT, T> b, T sign){
+	Tape<T>& tape = *a.tape;
+	VarNode<DIMENSION_COUNT, T>* out = tape.intermediate(a.node->value.dimensions, a.node->requiresGrad || b.node->requiresGrad);
+	_forEachElement([sign](T& o, T& x, T& y){ o = x + sign * y; }, out->value, a.node->value, b.node->value);
+	tape.record(_addBackward<DIMENSION_COUNT, T>, out, a.node, b.node, sign);
+	return Variable<DIMENSION_COUNT, T>(&tape, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> add(Variable<DIMENSION_COUNT, T> a, Variable<DIMENSION_COUNT, T> b){
+	return _addOrSub(a, b, T(1));
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> sub(Variable<DIMENSION_COUNT, T> a, Variable<DIMENSION_COUNT, T> b){
+	return _addOrSub(a, b, T(-1));
+}
+
+// elementwise product
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> mul(Variable<DIMENSION_COUNT, T> a, Variable<DIMENSION_COUNT, T> b){
+	Tape<T>& tape = *a.tape;
+	VarNode<DIMENSION_COUNT, T>* out = tape.intermediate(a.node->value.dimensions, a.node->requiresGrad || b.node->requiresGrad);
+	_forEachElement([](T& o, T& x, T& y){ o = x * y; }, out->value, a.node->value, b.node->value);
+	tape.record(_mulBackward<DIMENSION_COUNT, T>, out, a.node, b.node);
+	return Variable<DIMENSION_COUNT, T>(&tape, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> scale(Variable<DIMENSION_COUNT, T> a, T s){
+	Tape<T>& tape = *a.tape;
+	VarNode<DIMENSION_COUNT, T>* out = tape.intermediate(a.node->value.dimensions, a.node->requiresGrad);
+	_forEachElement([s](T& o, T& x){ o = s * x; }, out->value, a.node->value);
+	tape.record(_scaleBackward<DIMENSION_COUNT, T>, out, a.node, nullptr, s);
+	return Variable<DIMENSION_COUNT, T>(&tape, out);
+}
+
+template<typename T>
+Variable<2, T> matmul(Variable<2, T> a, Variable<2, T> b){
+	Tape<T>& tape = *a.tape;
+	const std::size_t dims[2] = {a.node->value.dimensions[0], b.node->value.dimensions[1]};
+	VarNode<2, T>* out = tape.intermediate(dims, a.node->requiresGrad || b.node->requiresGrad);
+	matmul(a.node->value, b.node->value, out->value);
+	tape.record(_matmulBackward<T>, out, a.node, b.node);
+	return Variable<2, T>(&tape, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> _activation(Variable<DIMENSION_COUNT, T> a, Activation activation){
+	Tape<T>& tape = *a.tape;
+	VarNode<DIMENSION_COUNT, T>* out = tape.intermediate(a.node->value.dimensions, a.node->requiresGrad);
+	_forEachElement([activation](T& o, T& x){ o = _activate(x, activation); }, out->value, a.node->value);
+	tape.record(_activationBackward<DIMENSION_COUNT, T>, out, a.node, nullptr, T(static_cast<int>(activation)));
+	return Variable<DIMENSION_COUNT, T>(&tape, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> relu(Variable<DIMENSION_COUNT, T> a){
+	return _activation(a, Activation::RELU);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> tanh(Variable<DIMENSION_COUNT, T> a){
+	return _activation(a, Activation::TANH);
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T> sigmoid(Variable<DIMENSION_COUNT, T> a){
+	return _activation(a, Activation::SIGMOID);
+}
+
+// sum of all elements as a single element variable
+template<int DIMENSION_COUNT, typename T>
+Variable<1, T> sum(Variable<DIMENSION_COUNT, T> a){
+	Tape<T>& tape = *a.tape;
+	const std::size_t dims[1] = {1};
+	VarNode<1, T>* out = tape.intermediate(dims, a.node->requiresGrad);
+	T total = 0;
+	_forEachElement([&total](T& x){ total += x; }, a.node->value);
+	out->value[{0}] = total;
+	tape.record(_sumBackward<DIMENSION_COUNT, T>, out, a.node);
+	return Variable<1, T>(&tape, out);
+}
+
+// -------------------------------------in-place operators--------------------------------------
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T>& Variable<DIMENSION_COUNT, T>::operator+=(Variable t){
+	*this = add(*this, t);
+	return *this;
+}
+
+template<int DIMENSION_COUNT, typename T>
+Variable<DIMENSION_COUNT, T>& Variable<DIMENSION_COUNT, T>::operator-=(Variable t){
+	*this = sub(*this, t);
+	return *this;
+}
+
+template<int DIMENSION_COUNT, typename T>
+template<int O_DIM>
+Variable<DIMENSION_COUNT, T>& Variable<DIMENSION_COUNT, T>::operator+=(Variable<O_DIM, T> t){
+	static_assert(DIMENSION_COUNT>O_DIM, "Dimension counts unfit for broadcasting");
+	for(std::size_t i = 0; i < O_DIM; i++){
+		if(node->value.dimensions[DIMENSION_COUNT - O_DIM + i] != t.node->value.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	VarNode<DIMENSION_COUNT, T>* out = tape->intermediate(node->value.dimensions, node->requiresGrad || t.node->requiresGrad);
+	_forEachElement([](T& o, T& x){ o = x; }, out->value, node->value);
+	_broadcastElements(out->value, t.node->value, [](T& o, T& y){ o += y; });
+	tape->record(_broadcastAddBackward<DIMENSION_COUNT, O_DIM, T>, out, node, t.node);
+	node = out;
+	return *this;
+}
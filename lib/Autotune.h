@@ -0,0 +1,171 @@
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include "Parallel.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// blocking and threading of the 2-D matmul kernel
+struct GemmConfig {
+    // rows / columns of the output block one task computes
+    std::size_t blockM = 64;
+    std::size_t blockN = 256;
+    // depth of the K panel kept in cache between epilogue passes
+    std::size_t blockK = 256;
+    // copy the A / B panels into contiguous buffers before running the register kernel
+    bool packA = false;
+    bool packB = false;
+    std::size_t threads = 1;
+};
+
+// Benchmarks the candidate GemmConfigs the first time a (M, N, K, dtype, layout, pool size) signature is seen and
+// keeps the fastest one. Choices are persisted to a cache file (TENSOR_TUNING_CACHE, default "tensor_tuning.cache") that is
+// loaded on first use, so later runs dispatch without benchmarking. Off by default.
+class GemmTuner {
+PRIVATE:
+    std::map<std::string, GemmConfig> cache;
+    std::mutex mutex;
+    std::string path;
+
+    void load()
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string key;
+            GemmConfig c;
+            int packA, packB;
+            if (std::getline(fields, key, '|') && fields >> c.blockM >> c.blockN >> c.blockK >> packA >> packB >> c.threads) {
+                c.packA = packA;
+                c.packB = packB;
+                cache[key] = c;
+            }
+        }
+    }
+
+    void save(const std::string& key, const GemmConfig& c)
+    {
+        std::ofstream out(path, std::ios::app);
+        out << key << '|' << c.blockM << ' ' << c.blockN << ' ' << c.blockK << ' ' << c.packA << ' ' << c.packB << ' ' << c.threads << '\n';
+    }
+
+public:
+    static bool enabled;
+
+    // timed runs per candidate after one untimed warm-up run, the fastest counts
+    static const int BENCHMARK_RUNS = 3;
+
+    GemmTuner(const std::string& cachePath)
+        : path(cachePath)
+    {
+        load();
+    }
+
+    static GemmTuner& instance()
+    {
+        static GemmTuner tuner { std::getenv("TENSOR_TUNING_CACHE") ? std::getenv("TENSOR_TUNING_CACHE") : "tensor_tuning.cache" };
+        return tuner;
+    }
+
+    // switches to another cache file, dropping the choices loaded from the current one
+    void setCachePath(const std::string& cachePath)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        path = cachePath;
+        cache.clear();
+        load();
+    }
+
+    // the pool size is part of the key, choices made for another thread count are not reused
+    static std::string signature(std::size_t M, std::size_t N, std::size_t K, const std::string& dtype, const std::string& layout)
+    {
+        return std::to_string(M) + "x" + std::to_string(N) + "x" + std::to_string(K) + " " + dtype + " " + layout + " t"
+            + std::to_string(ThreadPool::instance().size());
+    }
+
+    // candidate configurations for a problem size, thread counts are limited by the pool
+    static std::vector<GemmConfig> candidates(std::size_t M, std::size_t N, std::size_t K)
+    {
+        std::vector<std::size_t> threadCounts {1};
+        if (ThreadPool::instance().size() > 1) threadCounts.push_back(ThreadPool::instance().size());
+        std::vector<GemmConfig> list;
+        for (std::size_t blockM : {32, 128}) {
+            // blockings larger than the problem collapse to the smaller ones
+            if (blockM > 32 && M <= 32) continue;
+            for (std::size_t blockN : {64, 256}) {
+                if (blockN > 64 && N <= 64) continue;
+                for (std::size_t blockK : {128, 512}) {
+                    if (blockK > 128 && K <= 128) continue;
+                    for (bool pack : {false, true}) {
+                        for (std::size_t threads : threadCounts) {
+                            GemmConfig c;
+                            c.blockM = blockM;
+                            c.blockN = blockN;
+                            c.blockK = blockK;
+                            c.packA = pack;
+                            c.packB = pack;
+                            c.threads = threads;
+                            list.push_back(c);
+                        }
+                    }
+                }
+            }
+        }
+        return list;
+    }
+
+    // tuned configuration of key if it has one
+    bool find(const std::string& key, GemmConfig& config)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = cache.find(key);
+        if (found == cache.end()) return false;
+        config = found->second;
+        return true;
+    }
+
+    // returns the tuned configuration for key, benchmarking every candidate with run on first sight
+    GemmConfig lookup(const std::string& key, const std::vector<GemmConfig>& options, const std::function<void(const GemmConfig&)>& run)
+    {
+        GemmConfig best = options.front();
+        if (find(key, best)) return best;
+        double bestTime = -1;
+        for (const GemmConfig& c : options) {
+            run(c);
+            for (int i = 0; i < BENCHMARK_RUNS; i++) {
+                const auto start = std::chrono::steady_clock::now();
+                run(c);
+                const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (bestTime < 0 || time < bestTime) {
+                    bestTime = time;
+                    best = c;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cache.insert({key, best}).second) save(key, best);
+        return best;
+    }
+
+    bool contains(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cache.count(key) != 0;
+    }
+};
+bool GemmTuner::enabled = false;
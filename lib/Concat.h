@@ -0,0 +1,158 @@
+#include <array>
+#include <algorithm>
+#include <utility>
+#include "Tensor.h"
+#include "Parallel.h"
+
+#pragma once
+
+// minimum number of elements a thread copies when joining tensors
+const std::size_t CONCAT_PARALLEL_GRAIN = 1 << 16;
+
+// Copies a block of dims elements between two strided layouts. Trailing axes that are dense in both layouts are
+// merged into one run copied as a block, the runs are split over the pool.
+template<int DIMENSION_COUNT, typename T>
+void _copyStrided(const std::size_t* dims, T* dst, const std::size_t* dstInc, const T* src, const std::size_t* srcInc){
+	std::size_t run = 1;
+	std::size_t outer = DIMENSION_COUNT;
+	while(outer > 0 && (dims[outer - 1] == 1 || (dstInc[outer - 1] == run && srcInc[outer - 1] == run))){
+		run *= dims[outer - 1];
+		outer--;
+	}
+	std::size_t total = run;
+	for(std::size_t i = 0; i < outer; i++){
+		total *= dims[i];
+	}
+	if(total == 0) return;
+	// without a dense tail the last axis is walked element by element
+	const bool dense = outer < DIMENSION_COUNT;
+	const std::size_t axes = dense ? outer : DIMENSION_COUNT - 1;
+	const std::size_t length = dense ? run : dims[DIMENSION_COUNT - 1];
+	const std::size_t lines = total / length;
+	parallel_for(0, lines, CONCAT_PARALLEL_GRAIN / length + 1, [&](std::size_t l0, std::size_t l1){
+		for(std::size_t line = l0; line < l1; line++){
+			std::size_t rest = line, dstOffset = 0, srcOffset = 0;
+			for(std::size_t i = axes; i-- > 0;){
+				const std::size_t index = rest % dims[i];
+				rest /= dims[i];
+				dstOffset += index * dstInc[i];
+				srcOffset += index * srcInc[i];
+			}
+			if(dense){
+				std::copy_n(src + srcOffset, length, dst + dstOffset);
+			}else{
+				const std::size_t ds = dstInc[DIMENSION_COUNT - 1];
+				const std::size_t ss = srcInc[DIMENSION_COUNT - 1];
+				for(std::size_t k = 0; k < length; k++){
+					dst[dstOffset + k * ds] = src[srcOffset + k * ss];
+				}
+			}
+		}
+	});
+}
+
+// copies part into out starting at position start along axis and advances start
+template<int DIMENSION_COUNT, typename T>
+void _concatPart(Tensor<DIMENSION_COUNT, T>& out, std::size_t axis, std::size_t& start, Tensor<DIMENSION_COUNT, T>& part){
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(i != axis && part.dimensions[i] != out.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	if(start + part.dimensions[axis] > out.dimensions[axis]) throw std::invalid_argument("Tensor dimensions don't match");
+	_copyStrided<DIMENSION_COUNT>(part.dimensions, out.data() + start * out.dimensionIncrementors[axis], out.dimensionIncrementors, part.data(), part.dimensionIncrementors);
+	start += part.dimensions[axis];
+}
+
+// Joins parts along axis into the preallocated out, whose axis must equal the sum of the parts.
+// Producers that can write their results in place should instead fill the views returned by split() on the
+// final tensor, which skips the copy entirely.
+template<int DIMENSION_COUNT, typename T, typename... Ts>
+void concat_into(Tensor<DIMENSION_COUNT, T>& out, std::size_t axis, Ts&... parts){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(out.isCopyOnWrite()) out.detach();
+	std::size_t start = 0;
+	(_concatPart(out, axis, start, parts), ...);
+	if(start != out.dimensions[axis]) throw std::invalid_argument("Tensor dimensions don't match");
+}
+
+// returns a new tensor holding the parts joined along axis
+template<int DIMENSION_COUNT, typename T, typename... Ts>
+Tensor<DIMENSION_COUNT, T> concat(std::size_t axis, Tensor<DIMENSION_COUNT, T>& first, Ts&... rest){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	std::size_t dims[DIMENSION_COUNT];
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		dims[i] = first.dimensions[i];
+	}
+	dims[axis] = (first.dimensions[axis] + ... + rest.dimensions[axis]);
+	Tensor<DIMENSION_COUNT, T> out{dims};
+	concat_into(out, axis, first, rest...);
+	return out;
+}
+
+// copies part into position index of the new axis of out
+template<int DIMENSION_COUNT, typename T>
+void _stackPart(Tensor<DIMENSION_COUNT + 1, T>& out, std::size_t axis, std::size_t& index, Tensor<DIMENSION_COUNT, T>& part){
+	std::size_t inc[DIMENSION_COUNT];
+	for(std::size_t i = 0, ni = 0; i < DIMENSION_COUNT + 1; i++){
+		if(i == axis) continue;
+		if(part.dimensions[ni] != out.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		inc[ni++] = out.dimensionIncrementors[i];
+	}
+	if(index >= out.dimensions[axis]) throw std::invalid_argument("Tensor dimensions don't match");
+	_copyStrided<DIMENSION_COUNT>(part.dimensions, out.data() + index * out.dimensionIncrementors[axis], inc, part.data(), part.dimensionIncrementors);
+	index++;
+}
+
+// Stacks equally shaped parts along a new axis of the preallocated out, out.dimension(axis) must equal the part count
+template<int DIMENSION_COUNT, typename T, typename... Ts>
+void stack_into(Tensor<DIMENSION_COUNT, T>& out, std::size_t axis, Ts&... parts){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(out.dimensions[axis] != sizeof...(Ts)) throw std::invalid_argument("Tensor dimensions don't match");
+	if(out.isCopyOnWrite()) out.detach();
+	std::size_t index = 0;
+	(_stackPart(out, axis, index, parts), ...);
+}
+
+// returns a new tensor with the parts stacked along a new axis inserted at axis
+template<int DIMENSION_COUNT, typename T, typename... Ts>
+Tensor<DIMENSION_COUNT + 1, T> stack(std::size_t axis, Tensor<DIMENSION_COUNT, T>& first, Ts&... rest){
+	if(axis > DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	std::size_t dims[DIMENSION_COUNT + 1];
+	for(std::size_t i = 0, ni = 0; i < DIMENSION_COUNT + 1; i++){
+		dims[i] = (i == axis ? 1 + sizeof...(Ts) : first.dimensions[ni++]);
+	}
+	Tensor<DIMENSION_COUNT + 1, T> out{dims};
+	stack_into(out, axis, first, rest...);
+	return out;
+}
+
+template<std::size_t K, int DIMENSION_COUNT, typename T, std::size_t... I>
+std::array<Tensor<DIMENSION_COUNT, T>, K> _splitViews(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, const std::size_t (&starts)[K], const std::size_t (&sizes)[K], std::index_sequence<I...>){
+	return {{x.narrow(axis, starts[I], sizes[I])...}};
+}
+
+// Splits x along axis into K views of the given sizes, which must add up to the axis length.
+// The views share memory with x, nothing is copied.
+template<std::size_t K, int DIMENSION_COUNT, typename T>
+std::array<Tensor<DIMENSION_COUNT, T>, K> split(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, const std::size_t (&sizes)[K]){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	std::size_t starts[K];
+	std::size_t start = 0;
+	for(std::size_t k = 0; k < K; k++){
+		starts[k] = start;
+		start += sizes[k];
+	}
+	if(start != x.dimensions[axis]) throw std::invalid_argument("Split sizes don't add up to the dimension");
+	return _splitViews(x, axis, starts, sizes, std::make_index_sequence<K>{});
+}
+
+// Splits x along axis into K views of near equal size (the first ones are at most one shorter), sharing memory with x
+template<std::size_t K, int DIMENSION_COUNT, typename T>
+std::array<Tensor<DIMENSION_COUNT, T>, K> chunk(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	const std::size_t n = x.dimensions[axis];
+	std::size_t sizes[K];
+	for(std::size_t k = 0; k < K; k++){
+		sizes[k] = n * (k + 1) / K - n * k / K;
+	}
+	return split(x, axis, sizes);
+}
@@ -0,0 +1,200 @@
+#include <type_traits>
+#include "Matmul.h"
+
+#pragma once
+
+// memory layout of convolution activations, the 1-D functions read it as NCW / NWC
+enum class ConvLayout { NCHW, NHWC };
+
+// settings of a 2-D convolution, weights are always [C_out, C_in / groups, KH, KW]
+struct Conv2dParams {
+	std::size_t strideH = 1;
+	std::size_t strideW = 1;
+	std::size_t paddingH = 0;
+	std::size_t paddingW = 0;
+	std::size_t dilationH = 1;
+	std::size_t dilationW = 1;
+	std::size_t groups = 1;
+	ConvLayout layout = ConvLayout::NCHW;
+};
+
+// settings of a 1-D convolution, weights are always [C_out, C_in / groups, K]
+struct Conv1dParams {
+	std::size_t stride = 1;
+	std::size_t padding = 0;
+	std::size_t dilation = 1;
+	std::size_t groups = 1;
+	ConvLayout layout = ConvLayout::NCHW;
+};
+
+// number of elements a packed patch panel of the implicit GEMM aims for
+const std::size_t CONV_PANEL_SIZE = 1 << 16;
+
+// output length of a convolution along one spatial axis
+inline std::size_t _convOutputSize(std::size_t in, std::size_t kernel, std::size_t stride, std::size_t padding, std::size_t dilation){
+	const std::size_t span = dilation * (kernel - 1) + 1;
+	if(kernel == 0 || stride == 0 || dilation == 0 || in + 2 * padding < span) throw std::invalid_argument("Convolution window does not fit the input");
+	return (in + 2 * padding - span) / stride + 1;
+}
+
+// strides of a 4-D activation tensor in (n, c, h, w) order, independent of the layout
+template<typename T>
+inline void _convStrides(Tensor<4, T>& t, ConvLayout layout, std::size_t (&dims)[4], std::size_t (&strides)[4]){
+	const std::size_t order[2][4] = {{0, 1, 2, 3}, {0, 3, 1, 2}};
+	const std::size_t* axes = order[layout == ConvLayout::NHWC];
+	for(std::size_t i = 0; i < 4; i++){
+		dims[i] = t.dimensions[axes[i]];
+		strides[i] = t.dimensionIncrementors[axes[i]];
+	}
+}
+
+// depthwise convolution (one input channel per group), computed directly without a GEMM
+template<typename T, typename T2, typename T3>
+void _depthwiseConv2d(const T* x, const std::size_t (&xs)[4], const T2* w, const std::size_t (&ws)[4], T3* y, const std::size_t (&ys)[4],
+		const std::size_t (&xd)[4], const std::size_t (&yd)[4], std::size_t KH, std::size_t KW, const Conv2dParams& p,
+		const T3* bias, std::size_t biasStride, const Epilogue<T3>& ep){
+	const std::size_t O = yd[1], OH = yd[2], OW = yd[3], H = xd[2], W = xd[3];
+	const std::size_t multiplier = O / xd[1];
+	parallel_for(0, xd[0] * O, 1, [&](std::size_t b, std::size_t e){
+		for(std::size_t task = b; task < e; task++){
+			const std::size_t n = task / O, o = task % O;
+			const T* xc = x + n * xs[0] + (o / multiplier) * xs[1];
+			const T2* wo = w + o * ws[0];
+			T3* yc = y + n * ys[0] + o * ys[1];
+			for(std::size_t oh = 0; oh < OH; oh++){
+				for(std::size_t ow = 0; ow < OW; ow++){
+					T3 acc = 0;
+					for(std::size_t kh = 0; kh < KH; kh++){
+						const std::size_t ih = oh * p.strideH + kh * p.dilationH;
+						if(ih < p.paddingH || ih - p.paddingH >= H) continue;
+						for(std::size_t kw = 0; kw < KW; kw++){
+							const std::size_t iw = ow * p.strideW + kw * p.dilationW;
+							if(iw < p.paddingW || iw - p.paddingW >= W) continue;
+							acc += xc[(ih - p.paddingH) * xs[2] + (iw - p.paddingW) * xs[3]] * wo[kh * ws[2] + kw * ws[3]];
+						}
+					}
+					_storeEpilogue(yc[oh * ys[2] + ow * ys[3]], acc, bias, o * biasStride, ep);
+				}
+			}
+		}
+	});
+}
+
+// 2-D convolution, output = epilogue(conv(input, weight)), bias of the epilogue is per output channel.
+// Runs as an implicit GEMM [pixels, C_in*KH*KW] @ [C_in*KH*KW, C_out]: patches are packed one pixel tile at a time
+// into a per-thread panel that feeds the GEMM kernel directly, a full im2col matrix is never built.
+// A copy-on-write output whose buffer is shared with other tensors throws std::logic_error, detach() it first.
+template<typename T, typename T2, typename T3>
+void conv2d(Tensor<4, T> input, Tensor<4, T2> weight, Tensor<4, T3> output, const Conv2dParams& p = Conv2dParams{}, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	output.claimOutput(input, weight);
+	std::size_t xd[4], xs[4], yd[4], ys[4];
+	_convStrides(input, p.layout, xd, xs);
+	_convStrides(output, p.layout, yd, ys);
+	const std::size_t ws[4] = {weight.dimensionIncrementors[0], weight.dimensionIncrementors[1], weight.dimensionIncrementors[2], weight.dimensionIncrementors[3]};
+	const std::size_t N = xd[0], C = xd[1], H = xd[2], W = xd[3];
+	const std::size_t O = weight.dimensions[0], KH = weight.dimensions[2], KW = weight.dimensions[3];
+	const std::size_t G = p.groups;
+	if(G == 0 || C % G != 0 || O % G != 0) throw std::invalid_argument("Channel counts are not divisible by groups");
+	if(weight.dimensions[1] != C / G) throw std::invalid_argument("Weight channels do not match input channels");
+	const std::size_t OH = _convOutputSize(H, KH, p.strideH, p.paddingH, p.dilationH);
+	const std::size_t OW = _convOutputSize(W, KW, p.strideW, p.paddingW, p.dilationW);
+	if(yd[0] != N || yd[1] != O || yd[2] != OH || yd[3] != OW) throw std::invalid_argument("Output array dimension mismatch");
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, O, biasStride);
+	if(N == 0 || O == 0 || OH == 0 || OW == 0) return;
+
+	const T* x = input.data();
+	const T2* w = weight.data();
+	T3* y = output.data();
+	if(G == C && C > 1){
+		_depthwiseConv2d(x, xs, w, ws, y, ys, xd, yd, KH, KW, p, bias, biasStride, ep);
+		return;
+	}
+
+	const std::size_t CG = C / G, OG = O / G;
+	const std::size_t KG = CG * KH * KW;
+	const std::size_t P = OH * OW;
+	// tiles may run across output rows only if the output pixels are evenly spaced
+	const bool flat = (ys[2] == OW * ys[3]);
+	std::size_t tile = CONV_PANEL_SIZE / (KG + 1);
+	if(tile < MATMUL_MR) tile = MATMUL_MR;
+	if(!flat && tile > OW) tile = OW;
+	const std::size_t tilesPerRow = (flat ? 0 : (OW + tile - 1) / tile);
+	const std::size_t tiles = (flat ? (P + tile - 1) / tile : OH * tilesPerRow);
+
+	// weights transposed to [KG, O] once, the size of the weights and not of the activations
+	// the patch panel of the calling thread shares a pool with the weights when T == T2, so both are reserved up front
+	WorkspacePool<T2>& weightPool = WorkspacePool<T2>::local();
+	weightPool.reserve(KG * O + (std::is_same<T, T2>::value ? tile * KG : 0));
+	T2* wt = weightPool.acquire(KG * O);
+	for(std::size_t o = 0; o < O; o++){
+		for(std::size_t c = 0; c < CG; c++){
+			for(std::size_t kh = 0; kh < KH; kh++){
+				for(std::size_t kw = 0; kw < KW; kw++){
+					wt[((c * KH + kh) * KW + kw) * O + o] = w[o * ws[0] + c * ws[1] + kh * ws[2] + kw * ws[3]];
+				}
+			}
+		}
+	}
+	WorkspacePool<T>::local().reserve(tile * KG);
+
+	try{
+		parallel_for(0, N * G * tiles, 1, [&](std::size_t b, std::size_t e){
+			WorkspacePool<T>& pool = WorkspacePool<T>::local();
+			T* panel = pool.acquire(tile * KG);
+			for(std::size_t task = b; task < e; task++){
+				const std::size_t n = task / (G * tiles);
+				const std::size_t g = (task / tiles) % G;
+				const std::size_t t = task % tiles;
+				std::size_t p0, count;
+				if(flat){
+					p0 = t * tile;
+					count = (P - p0 < tile ? P - p0 : tile);
+				}else{
+					const std::size_t ow0 = (t % tilesPerRow) * tile;
+					p0 = (t / tilesPerRow) * OW + ow0;
+					count = (OW - ow0 < tile ? OW - ow0 : tile);
+				}
+				// pack the patches of this pixel tile, zeros stand in for the padding
+				const T* xg = x + n * xs[0] + g * CG * xs[1];
+				for(std::size_t r = 0; r < count; r++){
+					const std::size_t oh = (p0 + r) / OW, ow = (p0 + r) % OW;
+					T* row = panel + r * KG;
+					for(std::size_t c = 0; c < CG; c++){
+						for(std::size_t kh = 0; kh < KH; kh++){
+							const std::size_t ih = oh * p.strideH + kh * p.dilationH;
+							const bool rowInside = ih >= p.paddingH && ih - p.paddingH < H;
+							for(std::size_t kw = 0; kw < KW; kw++){
+								const std::size_t iw = ow * p.strideW + kw * p.dilationW;
+								const bool inside = rowInside && iw >= p.paddingW && iw - p.paddingW < W;
+								row[(c * KH + kh) * KW + kw] = inside ? xg[c * xs[1] + (ih - p.paddingH) * xs[2] + (iw - p.paddingW) * xs[3]] : T(0);
+							}
+						}
+					}
+				}
+				T3* yt = y + n * ys[0] + g * OG * ys[1] + (p0 / OW) * ys[2] + (p0 % OW) * ys[3];
+				_gemmKernel(count, OG, KG, (const T*)panel, KG, std::size_t(1), (const T2*)(wt + g * OG), O, std::size_t(1),
+					yt, ys[3], ys[1], bias ? bias + g * OG * biasStride : bias, biasStride, ep);
+			}
+			pool.release(tile * KG);
+		});
+	}catch(...){
+		weightPool.release(KG * O);
+		throw;
+	}
+	weightPool.release(KG * O);
+}
+
+// 1-D convolution over [N, C, W] (NCHW) or [N, W, C] (NHWC) tensors, runs through conv2d with a unit height
+template<typename T, typename T2, typename T3>
+void conv1d(Tensor<3, T> input, Tensor<3, T2> weight, Tensor<3, T3> output, const Conv1dParams& p = Conv1dParams{}, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	output.claimOutput(input, weight);
+	Conv2dParams p2{};
+	p2.strideW = p.stride;
+	p2.paddingW = p.padding;
+	p2.dilationW = p.dilation;
+	p2.groups = p.groups;
+	p2.layout = p.layout;
+	const std::size_t heightAxis = (p.layout == ConvLayout::NCHW ? 2 : 1);
+	conv2d(input.expand(heightAxis), weight.expand(2), output.expand(heightAxis), p2, ep);
+}
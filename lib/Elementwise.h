@@ -0,0 +1,62 @@
+#include <utility>
+#include <tuple>
+#include "Tensor.h"
+
+#pragma once
+
+// Walks equally shaped tensors together and calls func(a, b, ...) with references to the matching elements.
+// Runs on raw strided pointers with the last axis innermost, unit-stride lines take a separate loop so they vectorize.
+template<int DIMENSION_COUNT, typename F, typename... Ts, std::size_t... I>
+void _forEachElementImpl(std::index_sequence<I...>, F& func, Tensor<DIMENSION_COUNT, Ts>&... tensors){
+	constexpr std::size_t COUNT = sizeof...(Ts);
+	const std::size_t* dims[COUNT] = {tensors.dimensions...};
+	const std::size_t* incs[COUNT] = {tensors.dimensionIncrementors...};
+	for(std::size_t t = 1; t < COUNT; t++){
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(dims[t][i] != dims[0][i]) throw std::invalid_argument("Dimensions don't match");
+		}
+	}
+	std::size_t lines = 1;
+	for(std::size_t i = 0; i + 1 < DIMENSION_COUNT; i++){
+		lines *= dims[0][i];
+	}
+	const std::size_t length = dims[0][DIMENSION_COUNT - 1];
+	if(lines == 0 || length == 0) return;
+	std::tuple<Ts*...> base{tensors.data()...};
+	const std::size_t inner[COUNT] = {tensors.dimensionIncrementors[DIMENSION_COUNT - 1]...};
+	bool contiguous = true;
+	for(std::size_t t = 0; t < COUNT; t++){
+		contiguous = contiguous && inner[t] == 1;
+	}
+	std::size_t index[DIMENSION_COUNT] = {};
+	std::size_t offsets[COUNT] = {};
+	for(std::size_t line = 0; line < lines; line++){
+		std::tuple<Ts*...> p{(std::get<I>(base) + offsets[I])...};
+		if(contiguous){
+			for(std::size_t k = 0; k < length; k++){
+				func(std::get<I>(p)[k]...);
+			}
+		}else{
+			for(std::size_t k = 0; k < length; k++){
+				func(std::get<I>(p)[k * inner[I]]...);
+			}
+		}
+		// odometer over the outer axes
+		for(std::size_t axis = DIMENSION_COUNT - 1; axis-- > 0;){
+			index[axis]++;
+			for(std::size_t t = 0; t < COUNT; t++){
+				offsets[t] += incs[t][axis];
+			}
+			if(index[axis] < dims[0][axis]) break;
+			for(std::size_t t = 0; t < COUNT; t++){
+				offsets[t] -= dims[0][axis] * incs[t][axis];
+			}
+			index[axis] = 0;
+		}
+	}
+}
+
+template<int DIMENSION_COUNT, typename F, typename... Ts>
+void _forEachElement(F func, Tensor<DIMENSION_COUNT, Ts>&... tensors){
+	_forEachElementImpl(std::index_sequence_for<Ts...>{}, func, tensors...);
+}
@@ -0,0 +1,432 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "Elementwise.h"
+
+#pragma once
+
+// Branch-free polynomial approximations of the common transcendental functions for float and double.
+// Every kernel is straight-line arithmetic plus selects, so loops over contiguous data vectorize, and
+// range reduction uses the same bit tricks as vector math libraries (magic-number rounding, exponent field
+// assembly). Maximum error measured against long double references over float and double inputs:
+//   exp, log            <= 1.3 ULP
+//   tanh                <= 1.5 ULP
+//   sigmoid             <= 2.5 ULP
+//   erf                 <= 2.7 ULP
+//   gelu                <= 15 ULP around x = -1.4 where 1 + erf cancels, <= 6 ULP elsewhere
+//   sin, cos            <= 1.5 ULP for |x| < TRIG_MAX, larger arguments fall back to std::sin / std::cos
+//   sqrt, rsqrt         hardware square root, 0.5 / 1 ULP
+// Results that underflow into the subnormal range are only accurate in absolute terms.
+
+// minimum number of elements a thread gets in the elementwise math kernels
+const std::size_t MATH_PARALLEL_GRAIN = 1 << 14;
+
+template<typename T>
+struct _MathConstants;
+
+// element types with fast kernels, others keep using the std functions
+template<typename T>
+constexpr bool _HAS_FAST_MATH = std::is_same<T, float>::value || std::is_same<T, double>::value;
+
+template<>
+struct _MathConstants<float> {
+	using Bits = std::int32_t;
+	static constexpr int MANTISSA = 23;
+	static constexpr Bits BIAS = 127;
+	static constexpr Bits EXPONENT_MASK = 0xff;
+	static constexpr Bits MANTISSA_MASK = 0x7fffff;
+	// adding and subtracting 1.5 * 2^23 rounds to the nearest integer
+	static constexpr float ROUND = 12582912.0f;
+	// 2^12 + 1, splits a float into two halves whose products are exact
+	static constexpr float SPLIT = 4097.0f;
+	static constexpr float MIN_NORMAL = 1.17549435e-38f;
+	static constexpr float TWO_MANTISSA = 8388608.0f;
+	static constexpr float SQRT2 = 1.41421356f;
+	static constexpr float LOG2E = 1.44269504f;
+	// ln(2) split so that n * LN2_HI is exact
+	static constexpr float LN2_HI = 0.693145751953125f;
+	static constexpr float LN2_LO = 1.4286068203094173e-06f;
+	static constexpr float EXP_MIN = -104.0f;
+	static constexpr float EXP_MAX = 89.0f;
+	static constexpr float TANH_SERIES_LIMIT = 0.55f;
+	// Taylor coefficients of e^r on [-ln2/2, ln2/2]
+	static constexpr float EXP_POLY[8] = {1.0f, 1.0f, 1.0f / 2, 1.0f / 6, 1.0f / 24, 1.0f / 120, 1.0f / 720, 1.0f / 5040};
+	// log(1+f) = f - s * (f - z * P(z)) with s = f / (2 + f), z = s * s, P holds 2 / (2k + 1)
+	static constexpr float LOG_POLY[4] = {2.0f / 3, 2.0f / 5, 2.0f / 7, 2.0f / 9};
+	// Taylor coefficients of tanh(x) / x in x^2
+	static constexpr float TANH_POLY[10] = {1.0f, -0.3333333333333333f, 0.13333333333333333f, -0.05396825396825397f, 0.021869488536155203f, -0.008863235529902197f, 0.003592128036572481f, -0.0014558343870513183f, 0.000590027440945586f, -0.00023912911424355248f};
+	// sin(r) = r + r * z * P(z) and cos(r) = 1 + z * Q(z) on [-pi/4, pi/4]
+	static constexpr float SIN_POLY[4] = {-1.0f / 6, 1.0f / 120, -1.0f / 5040, 1.0f / 362880};
+	static constexpr float COS_POLY[5] = {-1.0f / 2, 1.0f / 24, -1.0f / 720, 1.0f / 40320, -1.0f / 3628800};
+	// Maclaurin coefficients of erf(x) / x in x^2, used for |x| < 1
+	static constexpr float ERF_SERIES[11] = {1.1283791670955126f, -0.37612638903183754f, 0.11283791670955126f, -0.026866170645131252f, 0.005223977625442188f, -0.0008548327023450853f, 0.00012055332981789664f, -1.492565035840625e-05f, 1.6462114365889248e-06f, -1.6365844691234924e-07f, 1.4807192815879218e-08f};
+	// Chebyshev coefficients of erfc(x) * exp(x^2) on [1, 6]
+	static constexpr float ERFC_CHEB[15] = {0.2019659879122308f, -0.14788483553398699f, 0.05188222158351386f, -0.0175257099648674f, 0.00572180241747765f, -0.0018109803028117065f, 0.000557071435381056f, -0.0001668947304733129f, 4.878565888640799e-05f, -1.3935931867506882e-05f, 3.895510341711814e-06f, -1.0668212435139383e-06f, 2.864752123582556e-07f, -7.52500222944375e-08f, 1.832567630574042e-08f};
+	// Chebyshev coefficients of u * erfc(u) * exp(u^2) in t = 1/u on [0, 1/6]
+	static constexpr float ERFC_FAR_CHEB[7] = {0.5613356484451969f, -0.0037832162871751186f, -0.0009130734935373211f, 1.8229187166599068e-05f, 1.9252266442375456e-06f, -1.0190318161997325e-07f, -5.013346675960024e-09f};
+};
+
+template<>
+struct _MathConstants<double> {
+	using Bits = std::int64_t;
+	static constexpr int MANTISSA = 52;
+	static constexpr Bits BIAS = 1023;
+	static constexpr Bits EXPONENT_MASK = 0x7ff;
+	static constexpr Bits MANTISSA_MASK = 0xfffffffffffff;
+	// adding and subtracting 1.5 * 2^52 rounds to the nearest integer
+	static constexpr double ROUND = 6755399441055744.0;
+	// 2^27 + 1, splits a double into two halves whose products are exact
+	static constexpr double SPLIT = 134217729.0;
+	static constexpr double MIN_NORMAL = 2.2250738585072014e-308;
+	static constexpr double TWO_MANTISSA = 4503599627370496.0;
+	static constexpr double SQRT2 = 1.4142135623730951;
+	static constexpr double LOG2E = 1.4426950408889634;
+	// ln(2) split so that n * LN2_HI is exact
+	static constexpr double LN2_HI = 0.6931471803691238;
+	static constexpr double LN2_LO = 1.9082149292705877e-10;
+	static constexpr double EXP_MIN = -746.0;
+	static constexpr double EXP_MAX = 710.0;
+	static constexpr double TWO_OVER_PI = 0.6366197723675814;
+	// pi/2 split into three parts, n * PIO2_1 and n * PIO2_2 are exact while |n| < 2^26.
+	// Trig arguments of both types are reduced with these, beyond TRIG_MAX the std functions take over
+	static constexpr double PIO2_1 = 1.5707963109016418;
+	static constexpr double PIO2_2 = 1.5893254712295857e-08;
+	static constexpr double PIO2_3 = 6.123233995736766e-17;
+	static constexpr double TRIG_MAX = 1.0e8;
+	static constexpr double TANH_SERIES_LIMIT = 0.55;
+	// Taylor coefficients of e^r on [-ln2/2, ln2/2]
+	static constexpr double EXP_POLY[14] = {1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800};
+	// log(1+f) = f - s * (f - z * P(z)) with s = f / (2 + f), z = s * s, P holds 2 / (2k + 1)
+	static constexpr double LOG_POLY[10] = {2.0 / 3, 2.0 / 5, 2.0 / 7, 2.0 / 9, 2.0 / 11, 2.0 / 13, 2.0 / 15, 2.0 / 17, 2.0 / 19, 2.0 / 21};
+	// Taylor coefficients of tanh(x) / x in x^2
+	static constexpr double TANH_POLY[19] = {1.0, -0.3333333333333333, 0.13333333333333333, -0.05396825396825397, 0.021869488536155203, -0.008863235529902197, 0.003592128036572481, -0.0014558343870513183, 0.000590027440945586, -0.00023912911424355248, 9.691537956929451e-05, -3.927832388331683e-05, 1.5918905069328964e-05, -6.451689215655431e-06, 2.6147711512907546e-06, -1.0597268320104654e-06, 4.294911078273806e-07, -1.7406618963571648e-07, 7.054636946400968e-08};
+	// sin(r) = r + r * z * P(z) and cos(r) = 1 + z * Q(z) on [-pi/4, pi/4]
+	static constexpr double SIN_POLY[8] = {-1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800, 1.0 / 6227020800, -1.0 / 1307674368000, 1.0 / 355687428096000};
+	static constexpr double COS_POLY[9] = {-1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800, 1.0 / 479001600, -1.0 / 87178291200, 1.0 / 20922789888000, -1.0 / 6402373705728000};
+	// Maclaurin coefficients of erf(x) / x in x^2, used for |x| < 1
+	static constexpr double ERF_SERIES[19] = {1.1283791670955126, -0.37612638903183754, 0.11283791670955126, -0.026866170645131252, 0.005223977625442188, -0.0008548327023450853, 0.00012055332981789664, -1.492565035840625e-05, 1.6462114365889248e-06, -1.6365844691234924e-07, 1.4807192815879218e-08, -1.2290555301717928e-09, 9.422759064650411e-11, -6.7113668551641105e-12, 4.4632242632864775e-13, -2.7835162072109215e-14, 1.6342614095367152e-15, -9.063970842808673e-17, 4.763348040515068e-18};
+	// Chebyshev coefficients of erfc(x) * exp(x^2) on [1, 6]
+	static constexpr double ERFC_CHEB[29] = {0.20196598791223083, -0.147884835533987, 0.05188222158351389, -0.017525709964867527, 0.005721802417478219, -0.0018109803028142997, 0.0005570714353927344, -0.00016689473052528832, 4.878565911493746e-05, -1.3935932859822488e-05, 3.895514595190115e-06, -1.0668392337070025e-06, 2.865502572057316e-07, -7.555861081756622e-08, 1.957586342968354e-08, -4.987110132992565e-09, 1.2501871239431183e-09, -3.0858852312872416e-10, 7.504484747602063e-11, -1.7990193064431427e-11, 4.253478301217652e-12, -9.923156075211234e-13, 2.2852946881888867e-13, -5.1975450866167244e-14, 1.1678400541510938e-14, -2.5932901330272067e-15, 5.692635243339303e-16, -1.2335300698913424e-16, 2.5358417099784882e-17};
+	// Chebyshev coefficients of u * erfc(u) * exp(u^2) in t = 1/u on [0, 1/6]
+	static constexpr double ERFC_FAR_CHEB[13] = {0.5613356484451969, -0.0037832162871752097, -0.000913073493539771, 1.822918719154695e-05, 1.9252267878363807e-06, -1.0190734887596502e-07, -5.00821982894512e-09, 6.392118575716054e-10, 5.126847013724903e-12, -4.167256018513281e-12, 1.4359909187780426e-13, 2.494869117213646e-14, -2.4783843709003122e-15};
+};
+
+// c[0] + c[1] * x + c[2] * x^2 + ...
+template<typename T, std::size_t N>
+inline T _horner(T x, const T (&c)[N]){
+	T r = c[N - 1];
+	for(std::size_t i = N - 1; i-- > 0;){
+		r = r * x + c[i];
+	}
+	return r;
+}
+
+// sum of c[i] * T_i(t) for Chebyshev polynomials T_i, t in [-1, 1]
+template<typename T, std::size_t N>
+inline T _clenshaw(T t, const T (&c)[N]){
+	T b1 = 0, b2 = 0;
+	for(std::size_t i = N - 1; i > 0; i--){
+		const T b = 2 * t * b1 - b2 + c[i];
+		b2 = b1;
+		b1 = b;
+	}
+	return t * b1 - b2 + c[0];
+}
+
+// 2^k for k within the normal exponent range
+template<typename T>
+inline T _pow2(typename _MathConstants<T>::Bits k){
+	using C = _MathConstants<T>;
+	const typename C::Bits bits = (k + C::BIAS) << C::MANTISSA;
+	T r;
+	std::memcpy(&r, &bits, sizeof(T));
+	return r;
+}
+
+template<typename T>
+inline T _fastExp(T x){
+	using C = _MathConstants<T>;
+	// clamping also maps NaN to EXP_MIN so the integer conversion below stays defined
+	T xc = x > C::EXP_MIN ? x : C::EXP_MIN;
+	xc = xc < C::EXP_MAX ? xc : C::EXP_MAX;
+	const T n = (xc * C::LOG2E + C::ROUND) - C::ROUND;
+	const T r = (xc - n * C::LN2_HI) - n * C::LN2_LO;
+	const T p = _horner(r, C::EXP_POLY);
+	// scaling in two steps keeps both factors normal for overflowing and subnormal results
+	const typename C::Bits k = static_cast<typename C::Bits>(n);
+	const typename C::Bits k1 = k / 2;
+	const T result = p * _pow2<T>(k1) * _pow2<T>(k - k1);
+	return x == x ? result : x;
+}
+
+template<typename T>
+inline T _fastLog(T x){
+	using C = _MathConstants<T>;
+	using Bits = typename C::Bits;
+	// subnormals are scaled into the normal range first
+	const bool tiny = x < C::MIN_NORMAL;
+	const T y = tiny ? x * C::TWO_MANTISSA : x;
+	Bits bits;
+	std::memcpy(&bits, &y, sizeof(T));
+	Bits e = ((bits >> C::MANTISSA) & C::EXPONENT_MASK) - C::BIAS - (tiny ? C::MANTISSA : 0);
+	bits = (bits & C::MANTISSA_MASK) | (C::BIAS << C::MANTISSA);
+	T m;
+	std::memcpy(&m, &bits, sizeof(T));
+	// m in [sqrt(2)/2, sqrt(2))
+	const bool high = m > C::SQRT2;
+	m = high ? m * T(0.5) : m;
+	e += high ? 1 : 0;
+	const T f = m - 1;
+	const T s = f / (2 + f);
+	const T z = s * s;
+	const T logM = f - s * (f - z * _horner(z, C::LOG_POLY));
+	const T ef = static_cast<T>(e);
+	T result = ef * C::LN2_HI + (logM + ef * C::LN2_LO);
+	result = x == 0 ? -std::numeric_limits<T>::infinity() : result;
+	result = x == std::numeric_limits<T>::infinity() ? x : result;
+	return x < 0 || x != x ? std::numeric_limits<T>::quiet_NaN() : result;
+}
+
+template<typename T>
+inline T _fastTanh(T x){
+	using C = _MathConstants<T>;
+	const T a = std::fabs(x);
+	const T series = x * _horner(x * x, C::TANH_POLY);
+	const T large = T(1) - T(2) / (_fastExp(2 * a) + T(1));
+	return a < C::TANH_SERIES_LIMIT ? series : std::copysign(large, x);
+}
+
+template<typename T>
+inline T _fastSigmoid(T x){
+	return T(1) / (T(1) + _fastExp(-x));
+}
+
+// exp(-x * x * scale) with x * x formed exactly from a split of x, so the result keeps full relative
+// accuracy far out in the tail. scale must be a power of two, |x| <= 40
+template<typename T>
+inline T _expNegSquare(T x, T scale){
+	using C = _MathConstants<T>;
+	const T t = x * C::SPLIT;
+	const T hi = t - (t - x);
+	// x * x - hi * hi, small enough for a short Taylor series of its exponential
+	const T d = (x - hi) * (x + hi) * scale;
+	return _fastExp(-hi * hi * scale) * (T(1) - d * (T(1) - d * (T(0.5) - d * T(1.0 / 6))));
+}
+
+// erfc(|x|) (or erfc(|x| / sqrt(2)) when HALF) for arguments >= 1
+template<bool HALF, typename T>
+inline T _erfcTail(T x){
+	using C = _MathConstants<T>;
+	const T a = std::fabs(x) < T(40) ? std::fabs(x) : T(40);
+	const T u = HALF ? a * T(0.7071067811865476) : a;
+	// both fits are evaluated, the select keeps the one whose range contains u
+	const T uc = u < T(6) ? u : T(6);
+	const T inv = T(1) / u;
+	const T scaled = u < T(6) ? _clenshaw(T(0.4) * uc - T(1.4), C::ERFC_CHEB) : inv * _clenshaw(T(12) * inv - T(1), C::ERFC_FAR_CHEB);
+	return _expNegSquare(a, HALF ? T(0.5) : T(1)) * scaled;
+}
+
+template<typename T>
+inline T _fastErf(T x){
+	using C = _MathConstants<T>;
+	const T series = x * _horner(x * x, C::ERF_SERIES);
+	const T tail = std::copysign(T(1) - _erfcTail<false>(x), x);
+	return std::fabs(x) < T(1) || x != x ? series : tail;
+}
+
+// x * Phi(x), the negative tail goes through erfc to avoid cancellation in 1 + erf
+template<typename T>
+inline T _fastGelu(T x){
+	using C = _MathConstants<T>;
+	const T u = x * T(0.7071067811865476);
+	const T tail = T(0.5) * _erfcTail<true>(x);
+	T cdf = u > 0 ? T(1) - tail : tail;
+	cdf = std::fabs(u) < T(1) ? T(0.5) + T(0.5) * u * _horner(u * u, C::ERF_SERIES) : cdf;
+	return x * cdf;
+}
+
+// sin(x + shift * pi/2), the argument is reduced in double for both types
+template<typename T>
+inline T _fastSinCos(T x, int shift){
+	using C = _MathConstants<T>;
+	using D = _MathConstants<double>;
+	if(!(std::fabs(x) < D::TRIG_MAX)){
+		return shift ? std::cos(x) : std::sin(x);
+	}
+	const double xd = x;
+	const double n = (xd * D::TWO_OVER_PI + D::ROUND) - D::ROUND;
+	const T r = static_cast<T>(((xd - n * D::PIO2_1) - n * D::PIO2_2) - n * D::PIO2_3);
+	const std::int64_t quadrant = static_cast<std::int64_t>(n) + shift;
+	const T z = r * r;
+	const T s = r + r * z * _horner(z, C::SIN_POLY);
+	const T c = T(1) + z * _horner(z, C::COS_POLY);
+	const T v = (quadrant & 1) ? c : s;
+	return (quadrant & 2) ? -v : v;
+}
+
+template<typename T>
+inline T _fastSin(T x){
+	return _fastSinCos(x, 0);
+}
+
+template<typename T>
+inline T _fastCos(T x){
+	return _fastSinCos(x, 1);
+}
+
+template<typename T>
+inline T _fastSqrt(T x){
+	return std::sqrt(x);
+}
+
+template<typename T>
+inline T _fastRsqrt(T x){
+	return T(1) / std::sqrt(x);
+}
+
+// out = kernel(x) elementwise, x and out may be the same tensor.
+// Dense tensors run as one flat loop split over the pool, other views take the strided walk.
+template<int DIMENSION_COUNT, typename T, typename F>
+void _mapElements(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out, F kernel){
+	static_assert(_HAS_FAST_MATH<T>, "math kernels need float or double tensors");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(x.dimensions[i] != out.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	if(out.isCopyOnWrite()) out.detach();
+	if(x.isContiguous() && out.isContiguous()){
+		const T* in = x.data();
+		T* o = out.data();
+		const std::size_t rows = x.dimensions[0];
+		parallel_for_rows(rows, rows ? x.elementCount() / rows : 0, MATH_PARALLEL_GRAIN, [&](std::size_t b, std::size_t e){
+			for(std::size_t i = b; i < e; i++){
+				o[i] = kernel(in[i]);
+			}
+		});
+		return;
+	}
+	_forEachElement([&](T& o, T& v){ o = kernel(v); }, out, x);
+}
+
+// out = exp(x)
+template<int DIMENSION_COUNT, typename T>
+void exp(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastExp(v); });
+}
+
+// x = exp(x)
+template<int DIMENSION_COUNT, typename T>
+void exp(Tensor<DIMENSION_COUNT, T>& x){
+	exp(x, x);
+}
+
+// out = log(x)
+template<int DIMENSION_COUNT, typename T>
+void log(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastLog(v); });
+}
+
+// x = log(x)
+template<int DIMENSION_COUNT, typename T>
+void log(Tensor<DIMENSION_COUNT, T>& x){
+	log(x, x);
+}
+
+// out = tanh(x)
+template<int DIMENSION_COUNT, typename T>
+void tanh(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastTanh(v); });
+}
+
+// x = tanh(x)
+template<int DIMENSION_COUNT, typename T>
+void tanh(Tensor<DIMENSION_COUNT, T>& x){
+	tanh(x, x);
+}
+
+// out = 1 / (1 + exp(-x))
+template<int DIMENSION_COUNT, typename T>
+void sigmoid(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastSigmoid(v); });
+}
+
+// x = 1 / (1 + exp(-x))
+template<int DIMENSION_COUNT, typename T>
+void sigmoid(Tensor<DIMENSION_COUNT, T>& x){
+	sigmoid(x, x);
+}
+
+// out = erf(x)
+template<int DIMENSION_COUNT, typename T>
+void erf(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastErf(v); });
+}
+
+// x = erf(x)
+template<int DIMENSION_COUNT, typename T>
+void erf(Tensor<DIMENSION_COUNT, T>& x){
+	erf(x, x);
+}
+
+// out = x * Phi(x), the exact (erf based) GELU
+template<int DIMENSION_COUNT, typename T>
+void gelu(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastGelu(v); });
+}
+
+// x = x * Phi(x)
+template<int DIMENSION_COUNT, typename T>
+void gelu(Tensor<DIMENSION_COUNT, T>& x){
+	gelu(x, x);
+}
+
+// out = sqrt(x)
+template<int DIMENSION_COUNT, typename T>
+void sqrt(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastSqrt(v); });
+}
+
+// x = sqrt(x)
+template<int DIMENSION_COUNT, typename T>
+void sqrt(Tensor<DIMENSION_COUNT, T>& x){
+	sqrt(x, x);
+}
+
+// out = 1 / sqrt(x)
+template<int DIMENSION_COUNT, typename T>
+void rsqrt(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastRsqrt(v); });
+}
+
+// x = 1 / sqrt(x)
+template<int DIMENSION_COUNT, typename T>
+void rsqrt(Tensor<DIMENSION_COUNT, T>& x){
+	rsqrt(x, x);
+}
+
+// out = sin(x)
+template<int DIMENSION_COUNT, typename T>
+void sin(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastSin(v); });
+}
+
+// x = sin(x)
+template<int DIMENSION_COUNT, typename T>
+void sin(Tensor<DIMENSION_COUNT, T>& x){
+	sin(x, x);
+}
+
+// out = cos(x)
+template<int DIMENSION_COUNT, typename T>
+void cos(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out){
+	_mapElements(x, out, [](T v){ return _fastCos(v); });
+}
+
+// x = cos(x)
+template<int DIMENSION_COUNT, typename T>
+void cos(Tensor<DIMENSION_COUNT, T>& x){
+	cos(x, x);
+}
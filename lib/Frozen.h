@@ -0,0 +1,171 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <string>
+#include "Tensor.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// Immutable, non-owning handle to the elements of a tensor. Creating, copying, slicing and reading frozen handles
+// never touches a reference count, so request threads sharing one weight tensor never write to a common cache line.
+// Like a string_view it does not keep the storage alive: the tensor it was frozen from must outlive every handle
+// and must not be written while they are in use.
+template<int DIMENSION_COUNT, typename T>
+class FrozenTensor {
+	template<int, typename> friend class FrozenTensor;
+PRIVATE:
+	const T* base;
+	std::size_t dimensions[DIMENSION_COUNT];
+	std::size_t dimensionIncrementors[DIMENSION_COUNT];
+
+	FrozenTensor(const T* base, const std::size_t (&dims)[DIMENSION_COUNT], const std::size_t (&incs)[DIMENSION_COUNT]) : base(base){
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			dimensions[i] = dims[i];
+			dimensionIncrementors[i] = incs[i];
+		}
+	}
+
+public:
+	FrozenTensor(Tensor<DIMENSION_COUNT, T>& t) : FrozenTensor(t.data(), t.dimensions, t.dimensionIncrementors){}
+
+	const T& operator[](const std::size_t (&list)[DIMENSION_COUNT]) const{
+		std::size_t index = 0;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(list[i] >= dimensions[i]) throw std::out_of_range("Index " + std::to_string(i) + " is out of range");
+			index += list[i] * dimensionIncrementors[i];
+		}
+		return base[index];
+	}
+
+	std::size_t dimension(std::size_t i) const{
+		return dimensions[i];
+	}
+
+	std::size_t elementCount() const{
+		std::size_t n = 1;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			n *= dimensions[i];
+		}
+		return n;
+	}
+
+	// pointer to the first element, strides are given by dimensionIncrementors (no bounds checking)
+	const T* data() const{
+		return base;
+	}
+
+	FrozenTensor<DIMENSION_COUNT - 1, T> slice(std::size_t x, std::size_t dim = 0) const{
+		static_assert(DIMENSION_COUNT != 1, "Unable to slice one dimensional tensors");
+		if(dim >= DIMENSION_COUNT) throw std::out_of_range("dim out of range");
+		if(x >= dimensions[dim]) throw std::out_of_range("Index is out of range");
+		std::size_t dims[DIMENSION_COUNT - 1], incs[DIMENSION_COUNT - 1];
+		for(std::size_t i = 0, ni = 0; i < DIMENSION_COUNT; i++){
+			if(i == dim) continue;
+			dims[ni] = dimensions[i];
+			incs[ni] = dimensionIncrementors[i];
+			ni++;
+		}
+		return FrozenTensor<DIMENSION_COUNT - 1, T>(base + x * dimensionIncrementors[dim], dims, incs);
+	}
+
+	FrozenTensor swapaxes(std::size_t dim1, std::size_t dim2) const{
+		if(dim1 >= DIMENSION_COUNT) throw std::out_of_range("dim1 out of range");
+		if(dim2 >= DIMENSION_COUNT) throw std::out_of_range("dim2 out of range");
+		FrozenTensor view = *this;
+		std::swap(view.dimensions[dim1], view.dimensions[dim2]);
+		std::swap(view.dimensionIncrementors[dim1], view.dimensionIncrementors[dim2]);
+		return view;
+	}
+
+	FrozenTensor narrow(std::size_t dim, std::size_t start, std::size_t length) const{
+		if(dim >= DIMENSION_COUNT) throw std::out_of_range("dim out of range");
+		if(start + length > dimensions[dim]) throw std::out_of_range("Range exceeds the dimension");
+		FrozenTensor view = *this;
+		view.base += start * dimensionIncrementors[dim];
+		view.dimensions[dim] = length;
+		return view;
+	}
+
+	// a mutable contiguous copy with storage of its own
+	Tensor<DIMENSION_COUNT, T> clone() const{
+		Tensor<DIMENSION_COUNT, T> cpy{dimensions};
+		T* dst = cpy.data();
+		const std::size_t n = elementCount();
+		std::size_t index[DIMENSION_COUNT] = {};
+		std::size_t at = 0;
+		for(std::size_t k = 0; k < n; k++){
+			dst[k] = base[at];
+			for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+				at += dimensionIncrementors[i];
+				if(++index[i] < dimensions[i]) break;
+				at -= dimensions[i] * dimensionIncrementors[i];
+				index[i] = 0;
+			}
+		}
+		return cpy;
+	}
+};
+
+template<int DIMENSION_COUNT, typename T>
+FrozenTensor<DIMENSION_COUNT, T> freeze(Tensor<DIMENSION_COUNT, T>& t){
+	return FrozenTensor<DIMENSION_COUNT, T>(t);
+}
+
+// Keeps a private copy of a small, hot weight for every thread that reads it. A copy is made by the thread that
+// first asks for it, so its pages are first touched on that thread's node and its cache lines are never shared with
+// other cores. Meant for weights that fit in the caches many times over, large ones should be shared frozen.
+template<int DIMENSION_COUNT, typename T>
+class ReplicatedTensor {
+PRIVATE:
+	Tensor<DIMENSION_COUNT, T> master;
+	const std::size_t id;
+	std::mutex replicaMutex;
+	std::map<std::thread::id, std::unique_ptr<Tensor<DIMENSION_COUNT, T>>> replicas;
+
+	static std::size_t nextId(){
+		static std::atomic<std::size_t> next{0};
+		return next.fetch_add(1, std::memory_order_relaxed);
+	}
+
+public:
+	// copies t, later changes to t are not seen by the replicas
+	ReplicatedTensor(Tensor<DIMENSION_COUNT, T>& t) : master(t.clone()), id(nextId()){}
+
+	ReplicatedTensor(const ReplicatedTensor&) = delete;
+	ReplicatedTensor& operator=(const ReplicatedTensor&) = delete;
+
+	// the calling thread's copy, the lock is only taken the first time a thread asks
+	FrozenTensor<DIMENSION_COUNT, T> local(){
+		// ids are never reused, so entries of destroyed instances are simply never looked up again
+		static thread_local std::map<std::size_t, Tensor<DIMENSION_COUNT, T>*> cache;
+		auto hit = cache.find(id);
+		if(hit != cache.end()) return FrozenTensor<DIMENSION_COUNT, T>(*hit->second);
+		Tensor<DIMENSION_COUNT, T> copy = master.clone();
+		Tensor<DIMENSION_COUNT, T>* replica;
+		{
+			std::lock_guard<std::mutex> lock(replicaMutex);
+			std::unique_ptr<Tensor<DIMENSION_COUNT, T>>& slot = replicas[std::this_thread::get_id()];
+			// a thread reusing the id of an exited one takes over its copy
+			if(!slot) slot.reset(new Tensor<DIMENSION_COUNT, T>(copy));
+			replica = slot.get();
+		}
+		cache[id] = replica;
+		return FrozenTensor<DIMENSION_COUNT, T>(*replica);
+	}
+
+	// number of threads holding a copy
+	std::size_t replicaCount(){
+		std::lock_guard<std::mutex> lock(replicaMutex);
+		return replicas.size();
+	}
+};
@@ -0,0 +1,693 @@
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "Matmul.h"
+#include "Workspace.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// elements per tile of a fused elementwise kernel, the tiles of all its operands stay in L1
+const std::size_t GRAPH_TILE = 1024;
+
+// minimum number of elements a thread gets in a fused elementwise kernel
+const std::size_t GRAPH_PARALLEL_GRAIN = 1 << 15;
+
+// arena buffers start at multiples of this many elements, so no two of them share a cache line
+const std::size_t GRAPH_ALIGN = 16;
+
+template<typename T>
+class Graph;
+
+// Rank independent bookkeeping of a value recorded in a Graph
+template<typename T>
+struct GraphNodeBase {
+	enum Kind { INPUT, CONSTANT, INTERMEDIATE, VIEW };
+	Kind kind;
+	std::size_t rank = 0;
+	const std::size_t* dims = nullptr;
+	std::size_t count = 1;
+	// node owning the storage a view looks into, the node itself otherwise
+	GraphNodeBase* root = this;
+	// ops reading the node and whether it is read after run()
+	std::size_t uses = 0;
+	bool isOutput = false;
+	bool bound = false;
+	// planned by Graph::compile(): whether the value is stored at all (values only read inside one fused kernel live
+	// in its tiles), its tile register in that kernel, its arena slot and the steps its storage has to live through
+	bool materialized = true;
+	std::size_t slot = 0;
+	std::size_t arenaOffset = 0;
+	std::size_t defined = 0;
+	std::size_t lastUse = 0;
+	// rank specific parts, set by GraphNode
+	void (*destroy)(GraphNodeBase*) = nullptr;
+	void (*place)(GraphNodeBase*, Reference<T>&) = nullptr;
+	T* (*flat)(GraphNodeBase*) = nullptr;
+	void (*gather)(GraphNodeBase*, std::size_t, std::size_t, T*) = nullptr;
+
+	bool sameShape(const GraphNodeBase& o) const{
+		return rank == o.rank && std::equal(dims, dims + rank, o.dims);
+	}
+};
+
+template<int DIMENSION_COUNT, typename T>
+struct GraphNode : GraphNodeBase<T> {
+	std::size_t shape[DIMENSION_COUNT];
+	Tensor<DIMENSION_COUNT, T> value;
+
+	GraphNode(typename GraphNodeBase<T>::Kind kind, const std::size_t (&list)[DIMENSION_COUNT]){
+		this->kind = kind;
+		this->rank = DIMENSION_COUNT;
+		this->dims = shape;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			shape[i] = list[i];
+			this->count *= list[i];
+		}
+		this->destroy = [](GraphNodeBase<T>* n){ delete static_cast<GraphNode*>(n); };
+		this->place = [](GraphNodeBase<T>* n, Reference<T>& arena){
+			GraphNode* g = static_cast<GraphNode*>(n);
+			g->value = Tensor<DIMENSION_COUNT, T>(g->shape, arena, g->arenaOffset);
+		};
+		// first element of a contiguous value, nullptr for strided views
+		this->flat = [](GraphNodeBase<T>* n) -> T*{
+			Tensor<DIMENSION_COUNT, T>& v = static_cast<GraphNode*>(n)->value;
+			return v.isContiguous() ? v.data() : nullptr;
+		};
+		// copies count elements starting at row-major position start to dst
+		this->gather = [](GraphNodeBase<T>* n, std::size_t start, std::size_t count, T* dst){
+			Tensor<DIMENSION_COUNT, T>& v = static_cast<GraphNode*>(n)->value;
+			const T* p = v.data();
+			std::size_t index[DIMENSION_COUNT];
+			std::size_t at = 0;
+			for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+				index[i] = start % v.dimensions[i];
+				start /= v.dimensions[i];
+				at += index[i] * v.dimensionIncrementors[i];
+			}
+			for(std::size_t k = 0; k < count; k++){
+				dst[k] = p[at];
+				for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+					at += v.dimensionIncrementors[i];
+					if(++index[i] < v.dimensions[i]) break;
+					at -= v.dimensions[i] * v.dimensionIncrementors[i];
+					index[i] = 0;
+				}
+			}
+		};
+	}
+};
+
+template<int DIMENSION_COUNT, typename T>
+GraphNode<DIMENSION_COUNT, T>* _graphNode(GraphNodeBase<T>* n){
+	return static_cast<GraphNode<DIMENSION_COUNT, T>*>(n);
+}
+
+// Handle to a value recorded in a Graph, cheap to copy
+template<int DIMENSION_COUNT, typename T>
+class GraphTensor {
+	friend class Graph<T>;
+	template<int, typename> friend class GraphTensor;
+PRIVATE:
+	Graph<T>* graph = nullptr;
+	GraphNode<DIMENSION_COUNT, T>* node = nullptr;
+public:
+	GraphTensor() {}
+	GraphTensor(Graph<T>* g, GraphNode<DIMENSION_COUNT, T>* n): graph(g), node(n) {}
+
+	std::size_t dimension(std::size_t i){
+		return node->shape[i];
+	}
+
+	// value after Graph::run(). Intermediates are views into the graph's arena, overwritten by the next run.
+	Tensor<DIMENSION_COUNT, T>& value(){
+		return node->value;
+	}
+
+	GraphTensor<DIMENSION_COUNT - 1, T> slice(std::size_t x, std::size_t dim = 0);
+	GraphTensor narrow(std::size_t dim, std::size_t start, std::size_t length);
+	GraphTensor swapaxes(std::size_t dim1, std::size_t dim2);
+
+	GraphTensor& operator+=(GraphTensor t);
+	GraphTensor& operator-=(GraphTensor t);
+
+	// broadcasting add of a lower-rank value (e.g. a bias) along the trailing axes
+	template<int O_DIM>
+	GraphTensor& operator+=(GraphTensor<O_DIM, T> t);
+};
+
+enum class _GraphOpKind { ADD, SUB, MUL, SCALE, BIAS, ACTIVATION, MAP, MATMUL, VIEW };
+
+// one recorded op, out = op(in0, in1)
+template<typename T>
+struct GraphOp {
+	_GraphOpKind kind;
+	GraphNodeBase<T>* out;
+	GraphNodeBase<T>* in0;
+	GraphNodeBase<T>* in1 = nullptr;
+	T scalar = T(0);
+	Activation activation = Activation::NONE;
+	T (*map)(T) = nullptr;
+	// matmuls and views: runs the op on the typed nodes
+	void (*run)(GraphOp&) = nullptr;
+	// matmuls: bias, activation and scaling folded in by Graph::compile()
+	Epilogue<T> epilogue;
+	GraphNodeBase<T>* bias = nullptr;
+	// views: slice index and axis, narrow start and length, swapped axes
+	std::size_t arg0 = 0;
+	std::size_t arg1 = 0;
+	std::size_t arg2 = 0;
+	// fused kernels: flat operand pointers of the current run
+	T* flat0 = nullptr;
+	T* flat1 = nullptr;
+	T* flatOut = nullptr;
+
+	bool elementwise() const{
+		return kind != _GraphOpKind::MATMUL && kind != _GraphOpKind::VIEW;
+	}
+};
+
+template<typename T>
+void _graphMatmul(GraphOp<T>& op){
+	op.epilogue.bias = (op.bias ? &_graphNode<1>(op.bias)->value : nullptr);
+	matmul(_graphNode<2>(op.in0)->value, _graphNode<2>(op.in1)->value, _graphNode<2>(op.out)->value, op.epilogue);
+}
+
+// Static computation graph. Ops on GraphTensor handles are recorded with their shapes inferred and checked on the
+// spot. compile() then folds bias, activation and scaling into the epilogue of the matmul they follow, fuses runs of
+// equally shaped elementwise ops into kernels that keep their intermediates in cache-sized tiles, and packs all
+// remaining intermediates into one arena, sharing memory between values whose lifetimes don't overlap.
+// run() replays the graph on the currently bound inputs without allocating.
+template<typename T>
+class Graph {
+PRIVATE:
+	struct Step {
+		std::size_t first;
+		std::size_t last;
+		bool fused;
+	};
+
+	std::vector<GraphNodeBase<T>*> nodes;
+	std::vector<GraphOp<T>> ops;
+	std::vector<Step> steps;
+	Reference<T> arena;
+	std::size_t arenaSize = 0;
+	bool compiled = false;
+
+	template<int DIMENSION_COUNT>
+	GraphNode<DIMENSION_COUNT, T>* newNode(typename GraphNodeBase<T>::Kind kind, const std::size_t (&dims)[DIMENSION_COUNT]){
+		if(compiled) throw std::logic_error("Graph is already compiled");
+		GraphNode<DIMENSION_COUNT, T>* n = new GraphNode<DIMENSION_COUNT, T>(kind, dims);
+		nodes.push_back(n);
+		return n;
+	}
+
+	void uses(GraphNodeBase<T>* n){
+		if(n) n->uses++;
+	}
+
+	// whether n holds its value before ops[index] runs: inputs and constants always do, views of them once the op
+	// taking the view has run
+	bool readyBefore(GraphNodeBase<T>* n, std::size_t index){
+		if(n->root->kind == GraphNodeBase<T>::INTERMEDIATE) return false;
+		if(n->kind != GraphNodeBase<T>::VIEW) return true;
+		for(std::size_t i = 0; i < index; i++){
+			if(ops[i].kind == _GraphOpKind::VIEW && ops[i].run && ops[i].out == n) return true;
+		}
+		return false;
+	}
+
+	// folds the single elementwise consumers of matmul results into the matmul epilogue
+	void foldEpilogues(){
+		for(std::size_t i = 0; i < ops.size(); i++){
+			if(ops[i].kind != _GraphOpKind::MATMUL) continue;
+			GraphOp<T>& mm = ops[i];
+			for(std::size_t j = i + 1; j < ops.size(); j++){
+				GraphOp<T>& next = ops[j];
+				if(mm.out->uses != 1 || mm.out->isOutput) break;
+				if(next.in0 != mm.out && next.in1 != mm.out) continue;
+				// the epilogue computes activation(alpha * acc + bias), only ops in that order can be folded
+				const bool plain = (!mm.bias && mm.epilogue.activation == Activation::NONE);
+				if(next.kind == _GraphOpKind::SCALE && plain){
+					mm.epilogue.alpha *= next.scalar;
+				}else if(next.kind == _GraphOpKind::BIAS && next.in0 == mm.out && next.in1->rank == 1 && plain && readyBefore(next.in1, i)){
+					// the bias has to exist when the matmul runs, computed biases are left as separate ops
+					mm.bias = next.in1;
+				}else if(next.kind == _GraphOpKind::ACTIVATION && mm.epilogue.activation == Activation::NONE){
+					mm.epilogue.activation = next.activation;
+				}else{
+					break;
+				}
+				// the matmul now writes the consumer's result, its own is never stored
+				mm.out->uses = 0;
+				mm.out->materialized = false;
+				mm.out = next.out;
+				next.kind = _GraphOpKind::VIEW;
+				next.run = nullptr;
+			}
+		}
+		ops.erase(std::remove_if(ops.begin(), ops.end(), [](const GraphOp<T>& op){ return op.kind == _GraphOpKind::VIEW && !op.run; }), ops.end());
+	}
+
+	// Greedy arena placement, largest first: each value takes the lowest offset that no value with an overlapping
+	// lifetime occupies.
+	void planArena(){
+		std::vector<GraphNodeBase<T>*> live;
+		for(GraphNodeBase<T>* n: nodes){
+			if(n->kind == GraphNodeBase<T>::INTERMEDIATE && n->materialized) live.push_back(n);
+		}
+		std::stable_sort(live.begin(), live.end(), [](GraphNodeBase<T>* a, GraphNodeBase<T>* b){ return a->count > b->count; });
+		auto size = [](GraphNodeBase<T>* n){ return (n->count + GRAPH_ALIGN - 1) / GRAPH_ALIGN * GRAPH_ALIGN; };
+		std::vector<GraphNodeBase<T>*> placed;
+		arenaSize = 0;
+		for(GraphNodeBase<T>* n: live){
+			std::vector<GraphNodeBase<T>*> busy;
+			for(GraphNodeBase<T>* p: placed){
+				if(p->defined <= n->lastUse && n->defined <= p->lastUse) busy.push_back(p);
+			}
+			std::sort(busy.begin(), busy.end(), [](GraphNodeBase<T>* a, GraphNodeBase<T>* b){ return a->arenaOffset < b->arenaOffset; });
+			std::size_t offset = 0;
+			for(GraphNodeBase<T>* p: busy){
+				if(offset + size(n) <= p->arenaOffset) break;
+				offset = std::max(offset, p->arenaOffset + size(p));
+			}
+			n->arenaOffset = offset;
+			arenaSize = std::max(arenaSize, offset + size(n));
+			placed.push_back(n);
+		}
+		arena = Reference<T>(arenaSize ? arenaSize : 1);
+		for(GraphNodeBase<T>* n: live){
+			n->place(n, arena);
+		}
+	}
+
+	// pointer to the tile of operand n at row-major position start, copied to scratch if it isn't addressable.
+	// Lower-rank operands (wrap != 0) repeat every wrap elements.
+	static const T* operand(GraphNodeBase<T>* n, T* flat, const T* regs, std::size_t start, std::size_t m, std::size_t wrap, T* scratch){
+		if(!n->materialized) return regs + n->slot * GRAPH_TILE;
+		if(!wrap){
+			if(flat) return flat + start;
+			n->gather(n, start, m, scratch);
+			return scratch;
+		}
+		std::size_t pos = start % wrap;
+		if(flat && pos + m <= wrap) return flat + pos;
+		for(std::size_t done = 0; done < m;){
+			const std::size_t k = std::min(m - done, wrap - pos);
+			if(flat) std::copy(flat + pos, flat + pos + k, scratch + done);
+			else n->gather(n, pos, k, scratch + done);
+			done += k;
+			pos = 0;
+		}
+		return scratch;
+	}
+
+	static void apply(const GraphOp<T>& op, const T* a, const T* b, T* o, std::size_t m){
+		switch(op.kind){
+			case _GraphOpKind::ADD:
+			case _GraphOpKind::BIAS:
+				for(std::size_t k = 0; k < m; k++) o[k] = a[k] + b[k];
+				break;
+			case _GraphOpKind::SUB:
+				for(std::size_t k = 0; k < m; k++) o[k] = a[k] - b[k];
+				break;
+			case _GraphOpKind::MUL:
+				for(std::size_t k = 0; k < m; k++) o[k] = a[k] * b[k];
+				break;
+			case _GraphOpKind::SCALE:
+				for(std::size_t k = 0; k < m; k++) o[k] = op.scalar * a[k];
+				break;
+			case _GraphOpKind::ACTIVATION:
+				for(std::size_t k = 0; k < m; k++) o[k] = _activate(a[k], op.activation);
+				break;
+			case _GraphOpKind::MAP:
+				for(std::size_t k = 0; k < m; k++) o[k] = op.map(a[k]);
+				break;
+			default:
+				throw std::logic_error("Op is not elementwise");
+		}
+	}
+
+	// runs the elementwise ops of a step tile by tile, each tile through all ops before the next one is started
+	void runFused(const Step& s){
+		for(std::size_t i = s.first; i < s.last; i++){
+			GraphOp<T>& op = ops[i];
+			op.flat0 = (op.in0->materialized ? op.in0->flat(op.in0) : nullptr);
+			op.flat1 = (op.in1 && op.in1->materialized ? op.in1->flat(op.in1) : nullptr);
+			op.flatOut = (op.out->materialized ? op.out->flat(op.out) : nullptr);
+		}
+		const std::size_t n = ops[s.first].out->count;
+		const std::size_t registers = s.last - s.first;
+		parallel_for(0, (n + GRAPH_TILE - 1) / GRAPH_TILE, GRAPH_PARALLEL_GRAIN / GRAPH_TILE, [&](std::size_t t0, std::size_t t1){
+			WorkspacePool<T>& pool = WorkspacePool<T>::local();
+			const std::size_t held = (registers + 2) * GRAPH_TILE;
+			T* regs = pool.acquire(held);
+			T* scratch0 = regs + registers * GRAPH_TILE;
+			T* scratch1 = scratch0 + GRAPH_TILE;
+			for(std::size_t t = t0; t < t1; t++){
+				const std::size_t start = t * GRAPH_TILE;
+				const std::size_t m = std::min(GRAPH_TILE, n - start);
+				for(std::size_t i = s.first; i < s.last; i++){
+					const GraphOp<T>& op = ops[i];
+					const T* a = operand(op.in0, op.flat0, regs, start, m, 0, scratch0);
+					const T* b = (op.in1 ? operand(op.in1, op.flat1, regs, start, m, op.kind == _GraphOpKind::BIAS ? op.in1->count : 0, scratch1) : nullptr);
+					T* o = (op.flatOut ? op.flatOut + start : regs + (i - s.first) * GRAPH_TILE);
+					apply(op, a, b, o, m);
+				}
+			}
+			pool.release(held);
+		});
+	}
+
+public:
+	Graph() {}
+	Graph(Graph&) = delete;
+
+	~Graph(){
+		for(GraphNodeBase<T>* n: nodes) n->destroy(n);
+	}
+
+	// value bound with bind() before each run
+	template<int DIMENSION_COUNT>
+	GraphTensor<DIMENSION_COUNT, T> input(const std::size_t (&dims)[DIMENSION_COUNT]){
+		return GraphTensor<DIMENSION_COUNT, T>(this, newNode(GraphNodeBase<T>::INPUT, dims));
+	}
+
+	// fixed value such as a weight, shares memory with value
+	template<int DIMENSION_COUNT>
+	GraphTensor<DIMENSION_COUNT, T> constant(Tensor<DIMENSION_COUNT, T> value){
+		GraphNode<DIMENSION_COUNT, T>* n = newNode(GraphNodeBase<T>::CONSTANT, value.dimensions);
+		n->value = value;
+		return GraphTensor<DIMENSION_COUNT, T>(this, n);
+	}
+
+	// marks a value that is read after run(), every other intermediate may be fused away or overwritten
+	template<int DIMENSION_COUNT>
+	void output(GraphTensor<DIMENSION_COUNT, T> t){
+		if(compiled) throw std::logic_error("Graph is already compiled");
+		t.node->root->isOutput = true;
+		t.node->isOutput = true;
+	}
+
+	// records out = op(in0, in1) for an op whose output shape was already inferred
+	void record(GraphOp<T> op){
+		if(compiled) throw std::logic_error("Graph is already compiled");
+		uses(op.in0);
+		uses(op.in1);
+		ops.push_back(op);
+	}
+
+	template<int DIMENSION_COUNT>
+	GraphNode<DIMENSION_COUNT, T>* intermediate(const std::size_t (&dims)[DIMENSION_COUNT]){
+		return newNode(GraphNodeBase<T>::INTERMEDIATE, dims);
+	}
+
+	// a view of source, sharing its storage
+	template<int DIMENSION_COUNT>
+	GraphNode<DIMENSION_COUNT, T>* view(const std::size_t (&dims)[DIMENSION_COUNT], GraphNodeBase<T>* source){
+		GraphNode<DIMENSION_COUNT, T>* n = newNode(GraphNodeBase<T>::VIEW, dims);
+		n->root = source->root;
+		return n;
+	}
+
+	void compile(){
+		if(compiled) throw std::logic_error("Graph is already compiled");
+		foldEpilogues();
+		// consecutive equally shaped elementwise ops form one fused step
+		steps.clear();
+		for(std::size_t i = 0; i < ops.size(); i++){
+			if(ops[i].elementwise() && !steps.empty() && steps.back().fused && ops[i].out->sameShape(*ops[steps.back().first].out)){
+				steps.back().last = i + 1;
+			}else{
+				steps.push_back(Step{i, i + 1, ops[i].elementwise()});
+			}
+		}
+		// lifetimes in steps, values only read inside the fused step producing them are kept in its tiles
+		for(std::size_t s = 0; s < steps.size(); s++){
+			for(std::size_t i = steps[s].first; i < steps[s].last; i++){
+				GraphOp<T>& op = ops[i];
+				op.out->defined = s;
+				op.out->lastUse = s;
+				op.out->slot = i - steps[s].first;
+				op.out->materialized = !steps[s].fused || op.out->isOutput;
+			}
+		}
+		for(std::size_t s = 0; s < steps.size(); s++){
+			for(std::size_t i = steps[s].first; i < steps[s].last; i++){
+				for(GraphNodeBase<T>* in: {ops[i].in0, ops[i].in1, ops[i].bias}){
+					if(!in) continue;
+					if(in->kind == GraphNodeBase<T>::INTERMEDIATE && in->defined != s) in->materialized = true;
+					in->root->lastUse = std::max(in->root->lastUse, s);
+					// a view keeps the storage of its root alive
+					if(in->root != in) in->root->materialized = true;
+				}
+			}
+		}
+		for(GraphNodeBase<T>* n: nodes){
+			if(n->isOutput) n->root->lastUse = steps.size();
+		}
+		planArena();
+		compiled = true;
+	}
+
+	template<int DIMENSION_COUNT>
+	void bind(GraphTensor<DIMENSION_COUNT, T> in, Tensor<DIMENSION_COUNT, T> value){
+		if(in.node->kind != GraphNodeBase<T>::INPUT) throw std::invalid_argument("Only inputs can be bound");
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(value.dimensions[i] != in.node->shape[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		}
+		in.node->value = value;
+		in.node->bound = true;
+	}
+
+	// replays the compiled graph on the bound inputs
+	void run(){
+		if(!compiled) throw std::logic_error("Graph has to be compiled before it is run");
+		for(GraphNodeBase<T>* n: nodes){
+			if(n->kind == GraphNodeBase<T>::INPUT && !n->bound) throw std::logic_error("Graph input is not bound");
+		}
+		for(const Step& s: steps){
+			if(s.fused) runFused(s);
+			else ops[s.first].run(ops[s.first]);
+		}
+	}
+
+	// elements held by the arena that stores all intermediates
+	std::size_t arenaElements(){
+		return arenaSize;
+	}
+
+	// number of kernels a run executes
+	std::size_t stepCount(){
+		return steps.size();
+	}
+};
+
+// ----------------------------------------recorded ops----------------------------------------
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> _graphElementwise(GraphOp<T> op, GraphTensor<DIMENSION_COUNT, T> a, GraphTensor<DIMENSION_COUNT, T>* b = nullptr){
+	if(b){
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(a.node->shape[i] != b->node->shape[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		}
+	}
+	Graph<T>& graph = *a.graph;
+	GraphNode<DIMENSION_COUNT, T>* out = graph.intermediate(a.node->shape);
+	op.out = out;
+	op.in0 = a.node;
+	op.in1 = (b ? b->node : nullptr);
+	graph.record(op);
+	return GraphTensor<DIMENSION_COUNT, T>(&graph, out);
+}
+
+template<typename T>
+GraphOp<T> _graphOp(_GraphOpKind kind){
+	GraphOp<T> op;
+	op.kind = kind;
+	return op;
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> add(GraphTensor<DIMENSION_COUNT, T> a, GraphTensor<DIMENSION_COUNT, T> b){
+	return _graphElementwise(_graphOp<T>(_GraphOpKind::ADD), a, &b);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> sub(GraphTensor<DIMENSION_COUNT, T> a, GraphTensor<DIMENSION_COUNT, T> b){
+	return _graphElementwise(_graphOp<T>(_GraphOpKind::SUB), a, &b);
+}
+
+// elementwise product
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> mul(GraphTensor<DIMENSION_COUNT, T> a, GraphTensor<DIMENSION_COUNT, T> b){
+	return _graphElementwise(_graphOp<T>(_GraphOpKind::MUL), a, &b);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> scale(GraphTensor<DIMENSION_COUNT, T> a, T s){
+	GraphOp<T> op = _graphOp<T>(_GraphOpKind::SCALE);
+	op.scalar = s;
+	return _graphElementwise(op, a);
+}
+
+// func applied to every element, the recorded counterpart of a single tensor foreach
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> map(GraphTensor<DIMENSION_COUNT, T> a, T (*func)(T)){
+	GraphOp<T> op = _graphOp<T>(_GraphOpKind::MAP);
+	op.map = func;
+	return _graphElementwise(op, a);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> _graphActivation(GraphTensor<DIMENSION_COUNT, T> a, Activation activation){
+	GraphOp<T> op = _graphOp<T>(_GraphOpKind::ACTIVATION);
+	op.activation = activation;
+	return _graphElementwise(op, a);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> relu(GraphTensor<DIMENSION_COUNT, T> a){
+	return _graphActivation(a, Activation::RELU);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> gelu(GraphTensor<DIMENSION_COUNT, T> a){
+	return _graphActivation(a, Activation::GELU);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> tanh(GraphTensor<DIMENSION_COUNT, T> a){
+	return _graphActivation(a, Activation::TANH);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> sigmoid(GraphTensor<DIMENSION_COUNT, T> a){
+	return _graphActivation(a, Activation::SIGMOID);
+}
+
+template<typename T>
+GraphTensor<2, T> matmul(GraphTensor<2, T> a, GraphTensor<2, T> b){
+	if(a.node->shape[1] != b.node->shape[0]) throw std::invalid_argument("Inner matmul dimensions do not match");
+	Graph<T>& graph = *a.graph;
+	const std::size_t dims[2] = {a.node->shape[0], b.node->shape[1]};
+	GraphOp<T> op;
+	GraphNode<2, T>* out = graph.intermediate(dims);
+	op.kind = _GraphOpKind::MATMUL;
+	op.out = out;
+	op.in0 = a.node;
+	op.in1 = b.node;
+	op.run = _graphMatmul<T>;
+	graph.record(op);
+	return GraphTensor<2, T>(&graph, out);
+}
+
+// -------------------------------------views and in-place operators--------------------------------------
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT - 1, T> GraphTensor<DIMENSION_COUNT, T>::slice(std::size_t x, std::size_t dim){
+	static_assert(DIMENSION_COUNT != 1, "Unable to slice one dimensional tensors");
+	if(dim >= DIMENSION_COUNT) throw std::out_of_range("dim out of range");
+	if(x >= node->shape[dim]) throw std::out_of_range("Index is out of range");
+	std::size_t dims[DIMENSION_COUNT - 1];
+	for(std::size_t i = 0, ni = 0; i < DIMENSION_COUNT; i++){
+		if(i != dim) dims[ni++] = node->shape[i];
+	}
+	GraphNode<DIMENSION_COUNT - 1, T>* out = graph->view(dims, node);
+	GraphOp<T> op;
+	op.kind = _GraphOpKind::VIEW;
+	op.out = out;
+	op.in0 = node;
+	op.arg0 = x;
+	op.arg1 = dim;
+	op.run = [](GraphOp<T>& o){
+		_graphNode<DIMENSION_COUNT - 1>(o.out)->value = _graphNode<DIMENSION_COUNT>(o.in0)->value.slice(o.arg0, o.arg1);
+	};
+	graph->record(op);
+	return GraphTensor<DIMENSION_COUNT - 1, T>(graph, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> GraphTensor<DIMENSION_COUNT, T>::narrow(std::size_t dim, std::size_t start, std::size_t length){
+	if(dim >= DIMENSION_COUNT) throw std::out_of_range("dim out of range");
+	if(start + length > node->shape[dim]) throw std::out_of_range("Range exceeds the dimension");
+	std::size_t dims[DIMENSION_COUNT];
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		dims[i] = (i == dim ? length : node->shape[i]);
+	}
+	GraphNode<DIMENSION_COUNT, T>* out = graph->view(dims, node);
+	GraphOp<T> op;
+	op.kind = _GraphOpKind::VIEW;
+	op.out = out;
+	op.in0 = node;
+	op.arg0 = dim;
+	op.arg1 = start;
+	op.arg2 = length;
+	op.run = [](GraphOp<T>& o){
+		_graphNode<DIMENSION_COUNT>(o.out)->value = _graphNode<DIMENSION_COUNT>(o.in0)->value.narrow(o.arg0, o.arg1, o.arg2);
+	};
+	graph->record(op);
+	return GraphTensor(graph, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T> GraphTensor<DIMENSION_COUNT, T>::swapaxes(std::size_t dim1, std::size_t dim2){
+	if(dim1 >= DIMENSION_COUNT) throw std::out_of_range("dim1 out of range");
+	if(dim2 >= DIMENSION_COUNT) throw std::out_of_range("dim2 out of range");
+	std::size_t dims[DIMENSION_COUNT];
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		dims[i] = node->shape[i];
+	}
+	std::swap(dims[dim1], dims[dim2]);
+	GraphNode<DIMENSION_COUNT, T>* out = graph->view(dims, node);
+	GraphOp<T> op;
+	op.kind = _GraphOpKind::VIEW;
+	op.out = out;
+	op.in0 = node;
+	op.arg0 = dim1;
+	op.arg1 = dim2;
+	op.run = [](GraphOp<T>& o){
+		_graphNode<DIMENSION_COUNT>(o.out)->value = _graphNode<DIMENSION_COUNT>(o.in0)->value.swapaxes(o.arg0, o.arg1);
+	};
+	graph->record(op);
+	return GraphTensor(graph, out);
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T>& GraphTensor<DIMENSION_COUNT, T>::operator+=(GraphTensor t){
+	*this = add(*this, t);
+	return *this;
+}
+
+template<int DIMENSION_COUNT, typename T>
+GraphTensor<DIMENSION_COUNT, T>& GraphTensor<DIMENSION_COUNT, T>::operator-=(GraphTensor t){
+	*this = sub(*this, t);
+	return *this;
+}
+
+template<int DIMENSION_COUNT, typename T>
+template<int O_DIM>
+GraphTensor<DIMENSION_COUNT, T>& GraphTensor<DIMENSION_COUNT, T>::operator+=(GraphTensor<O_DIM, T> t){
+	static_assert(DIMENSION_COUNT>O_DIM, "Dimension counts unfit for broadcasting");
+	for(std::size_t i = 0; i < O_DIM; i++){
+		if(node->shape[DIMENSION_COUNT - O_DIM + i] != t.node->shape[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	GraphNode<DIMENSION_COUNT, T>* out = graph->intermediate(node->shape);
+	GraphOp<T> op;
+	op.kind = _GraphOpKind::BIAS;
+	op.out = out;
+	op.in0 = node;
+	op.in1 = t.node;
+	graph->record(op);
+	node = out;
+	return *this;
+}
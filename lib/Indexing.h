@@ -0,0 +1,242 @@
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "Tensor.h"
+#include "Parallel.h"
+
+#pragma once
+
+#if defined(__GNUC__)
+#define TENSOR_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define TENSOR_PREFETCH(address)
+#endif
+
+// minimum number of elements a thread gets in the indexing kernels
+const std::size_t INDEX_PARALLEL_GRAIN = 1 << 12;
+
+// pooling applied to the rows of each bag by embedding_bag
+enum class BagMode { SUM, MEAN };
+
+// throws unless every index lies in [0, size)
+template<typename I>
+void _checkIndices(Tensor<1, I>& idx, std::size_t size){
+	const I* p = idx.data();
+	const std::size_t stride = idx.dimensionIncrementors[0];
+	for(std::size_t k = 0; k < idx.dimensions[0]; k++){
+		if(p[k * stride] < 0 || static_cast<std::size_t>(p[k * stride]) >= size) throw std::out_of_range("Index is out of range");
+	}
+}
+
+// out[i] = in[i] for n elements, unit-stride runs are block copies
+template<typename T>
+inline void _copyLine(T* out, std::size_t outStride, const T* in, std::size_t inStride, std::size_t n){
+	if(outStride == 1 && inStride == 1 && std::is_trivially_copyable<T>::value){
+		std::memcpy(out, in, n * sizeof(T));
+		return;
+	}
+	for(std::size_t i = 0; i < n; i++){
+		out[i * outStride] = in[i * inStride];
+	}
+}
+
+// Copies a block with the dimensions of a (skipping axis) from b to a, both given by base pointer and strides.
+// The last remaining axis is walked as lines through _copyLine.
+template<int DIMENSION_COUNT, typename T>
+void _copyBlock(std::size_t axis, const std::size_t* dims, T* a, const std::size_t* aInc, const T* b, const std::size_t* bInc){
+	std::size_t last = DIMENSION_COUNT;
+	std::size_t lines = 1;
+	for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+		if(i == axis) continue;
+		if(last == DIMENSION_COUNT){
+			last = i;
+		}else{
+			lines *= dims[i];
+		}
+	}
+	if(last == DIMENSION_COUNT){
+		*a = *b;
+		return;
+	}
+	for(std::size_t line = 0; line < lines; line++){
+		std::size_t rest = line, aOffset = 0, bOffset = 0;
+		for(std::size_t i = last; i-- > 0;){
+			if(i == axis) continue;
+			const std::size_t index = rest % dims[i];
+			rest /= dims[i];
+			aOffset += index * aInc[i];
+			bOffset += index * bInc[i];
+		}
+		_copyLine(a + aOffset, aInc[last], b + bOffset, bInc[last], dims[last]);
+	}
+}
+
+// Runs func(line, lineOffsets) for every line of dims along axis, lines are split over the pool.
+// offsets[t] is the offset of the line start in tensor t given the strides incs[t].
+template<int DIMENSION_COUNT, std::size_t COUNT, typename F>
+void _forEachAxisLine(const std::size_t* dims, std::size_t axis, const std::size_t* (&incs)[COUNT], F func){
+	std::size_t lines = 1;
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(i != axis) lines *= dims[i];
+	}
+	if(lines == 0 || dims[axis] == 0) return;
+	parallel_for(0, lines, INDEX_PARALLEL_GRAIN / dims[axis] + 1, [&](std::size_t l0, std::size_t l1){
+		for(std::size_t line = l0; line < l1; line++){
+			std::size_t rest = line;
+			std::size_t offsets[COUNT] = {};
+			for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+				if(i == axis) continue;
+				const std::size_t index = rest % dims[i];
+				rest /= dims[i];
+				for(std::size_t t = 0; t < COUNT; t++){
+					offsets[t] += index * incs[t][i];
+				}
+			}
+			func(offsets);
+		}
+	});
+}
+
+// out = x with axis restricted to the positions in idx, out must have idx.dimension(0) entries along axis.
+// Each selected slab is copied with block copies when its rows are contiguous, the next slab is prefetched.
+template<int DIMENSION_COUNT, typename T, typename I>
+void index_select(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, Tensor<1, I>& idx, Tensor<DIMENSION_COUNT, T>& out){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(i == axis ? out.dimensions[i] != idx.dimensions[0] : out.dimensions[i] != x.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	_checkIndices(idx, x.dimensions[axis]);
+	std::size_t slab = 1;
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(i != axis) slab *= x.dimensions[i];
+	}
+	if(slab == 0) return;
+	if(out.isCopyOnWrite()) out.detach();
+	const I* indices = idx.data();
+	const std::size_t idxStride = idx.dimensionIncrementors[0];
+	const T* in = x.data();
+	T* o = out.data();
+	const std::size_t n = idx.dimensions[0];
+	parallel_for(0, n, INDEX_PARALLEL_GRAIN / slab + 1, [&](std::size_t k0, std::size_t k1){
+		for(std::size_t k = k0; k < k1; k++){
+			if(k + 1 < k1) TENSOR_PREFETCH(in + indices[(k + 1) * idxStride] * x.dimensionIncrementors[axis]);
+			const T* src = in + indices[k * idxStride] * x.dimensionIncrementors[axis];
+			_copyBlock<DIMENSION_COUNT>(axis, x.dimensions, o + k * out.dimensionIncrementors[axis], out.dimensionIncrementors, src, x.dimensionIncrementors);
+		}
+	});
+}
+
+// out[..., j, ...] = x[..., idx[..., j, ...], ...] along axis, out has the dimensions of idx
+template<int DIMENSION_COUNT, typename T, typename I>
+void gather(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, Tensor<DIMENSION_COUNT, I>& idx, Tensor<DIMENSION_COUNT, T>& out){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(out.dimensions[i] != idx.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		if(i != axis && idx.dimensions[i] > x.dimensions[i]) throw std::invalid_argument("Index tensor is larger than the source");
+	}
+	if(out.isCopyOnWrite()) out.detach();
+	const std::size_t* incs[3] = {x.dimensionIncrementors, idx.dimensionIncrementors, out.dimensionIncrementors};
+	const T* in = x.data();
+	const I* indices = idx.data();
+	T* o = out.data();
+	const std::size_t length = idx.dimensions[axis];
+	const std::size_t limit = x.dimensions[axis];
+	_forEachAxisLine<DIMENSION_COUNT>(idx.dimensions, axis, incs, [&](const std::size_t (&offsets)[3]){
+		for(std::size_t j = 0; j < length; j++){
+			const I index = indices[offsets[1] + j * incs[1][axis]];
+			if(index < 0 || static_cast<std::size_t>(index) >= limit) throw std::out_of_range("Index is out of range");
+			o[offsets[2] + j * incs[2][axis]] = in[offsets[0] + index * incs[0][axis]];
+		}
+	});
+}
+
+// out[..., idx[..., j, ...], ...] += src[..., j, ...] along axis, repeated indices accumulate.
+// Work is split over the lines along axis, which never share an output element, so no atomics are needed.
+template<int DIMENSION_COUNT, typename T, typename I>
+void scatter_add(Tensor<DIMENSION_COUNT, T>& out, std::size_t axis, Tensor<DIMENSION_COUNT, I>& idx, Tensor<DIMENSION_COUNT, T>& src){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(src.dimensions[i] != idx.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		if(i != axis && idx.dimensions[i] > out.dimensions[i]) throw std::invalid_argument("Index tensor is larger than the output");
+	}
+	if(out.isCopyOnWrite()) out.detach();
+	const std::size_t* incs[3] = {out.dimensionIncrementors, idx.dimensionIncrementors, src.dimensionIncrementors};
+	T* o = out.data();
+	const I* indices = idx.data();
+	const T* in = src.data();
+	const std::size_t length = idx.dimensions[axis];
+	const std::size_t limit = out.dimensions[axis];
+	_forEachAxisLine<DIMENSION_COUNT>(idx.dimensions, axis, incs, [&](const std::size_t (&offsets)[3]){
+		for(std::size_t j = 0; j < length; j++){
+			const I index = indices[offsets[1] + j * incs[1][axis]];
+			if(index < 0 || static_cast<std::size_t>(index) >= limit) throw std::out_of_range("Index is out of range");
+			o[offsets[0] + index * incs[0][axis]] += in[offsets[2] + j * incs[2][axis]];
+		}
+	});
+}
+
+// Pools rows of weight [V, D] into out [B, D]: bag b covers indices[offsets[b], offsets[b+1]) (the last bag runs
+// to the end of indices). Rows are summed, optionally scaled by perSampleWeights, and averaged for MEAN.
+// Bags are split over the pool, the row of the next index is prefetched while the current one is added.
+template<typename T, typename I>
+void embedding_bag(Tensor<2, T>& weight, Tensor<1, I>& indices, Tensor<1, I>& offsets, Tensor<2, T>& out, BagMode mode = BagMode::SUM, Tensor<1, T>* perSampleWeights = nullptr){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	const std::size_t bags = offsets.dimensions[0];
+	const std::size_t n = indices.dimensions[0];
+	const std::size_t D = weight.dimensions[1];
+	if(out.dimensions[0] != bags || out.dimensions[1] != D) throw std::invalid_argument("Tensor dimensions don't match");
+	if(perSampleWeights && perSampleWeights->dimensions[0] != n) throw std::invalid_argument("Per sample weights don't match the indices");
+	if(perSampleWeights && mode != BagMode::SUM) throw std::invalid_argument("Per sample weights need SUM pooling");
+	_checkIndices(indices, weight.dimensions[0]);
+	const I* off = offsets.data();
+	const std::size_t offStride = offsets.dimensionIncrementors[0];
+	for(std::size_t b = 0; b < bags; b++){
+		const I end = (b + 1 < bags ? off[(b + 1) * offStride] : static_cast<I>(n));
+		if(off[b * offStride] < 0 || off[b * offStride] > end || static_cast<std::size_t>(end) > n) throw std::invalid_argument("Bag offsets must be increasing and within the indices");
+	}
+	if(out.isCopyOnWrite()) out.detach();
+	const T* w = weight.data();
+	const std::size_t ws0 = weight.dimensionIncrementors[0];
+	const std::size_t ws1 = weight.dimensionIncrementors[1];
+	const I* idx = indices.data();
+	const std::size_t idxStride = indices.dimensionIncrementors[0];
+	const T* scale = perSampleWeights ? perSampleWeights->data() : nullptr;
+	const std::size_t scaleStride = perSampleWeights ? perSampleWeights->dimensionIncrementors[0] : 0;
+	T* o = out.data();
+	const std::size_t os0 = out.dimensionIncrementors[0];
+	const std::size_t os1 = out.dimensionIncrementors[1];
+	const std::size_t meanRows = (bags ? n / bags : 0) + 1;
+	parallel_for(0, bags, INDEX_PARALLEL_GRAIN / (meanRows * D + 1) + 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t b = b0; b < b1; b++){
+			const std::size_t begin = off[b * offStride];
+			const std::size_t end = (b + 1 < bags ? off[(b + 1) * offStride] : n);
+			T* row = o + b * os0;
+			for(std::size_t d = 0; d < D; d++){
+				row[d * os1] = T(0);
+			}
+			for(std::size_t k = begin; k < end; k++){
+				if(k + 1 < end) TENSOR_PREFETCH(w + idx[(k + 1) * idxStride] * ws0);
+				const T* src = w + idx[k * idxStride] * ws0;
+				const T s = scale ? scale[k * scaleStride] : T(1);
+				if(os1 == 1 && ws1 == 1){
+					for(std::size_t d = 0; d < D; d++){
+						row[d] += s * src[d];
+					}
+				}else{
+					for(std::size_t d = 0; d < D; d++){
+						row[d * os1] += s * src[d * ws1];
+					}
+				}
+			}
+			if(mode == BagMode::MEAN && end > begin){
+				const T count = static_cast<T>(end - begin);
+				for(std::size_t d = 0; d < D; d++){
+					row[d * os1] /= count;
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,244 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "FastMath.h"
+
+#pragma once
+
+// minimum number of elements a thread writes when filling a tensor
+const std::size_t FILL_PARALLEL_GRAIN = 1 << 15;
+
+// Writes the values of gen to x in row-major element order. gen(g, vals) produces the GROUP consecutive values of
+// group g (elements g*GROUP .. g*GROUP+GROUP-1), so every element depends on its position only and the result is
+// the same however the groups are split over threads. Each thread writes its own range of the storage first,
+// which also spreads the pages of a fresh tensor over the nodes its threads run on.
+template<std::size_t GROUP, int DIMENSION_COUNT, typename T, typename F>
+void _fillGroups(Tensor<DIMENSION_COUNT, T>& x, F gen){
+	const std::size_t n = x.elementCount();
+	if(n == 0) return;
+	if(x.isCopyOnWrite()) x.detach();
+	T* o = x.data();
+	const bool contiguous = x.isContiguous();
+	parallel_for(0, (n + GROUP - 1) / GROUP, FILL_PARALLEL_GRAIN / GROUP + 1, [&](std::size_t g0, std::size_t g1){
+		T vals[GROUP];
+		const std::size_t end = std::min(g1 * GROUP, n);
+		if(contiguous){
+			std::size_t g = g0;
+			// whole groups, stored without a bounds check per element
+			for(; (g + 1) * GROUP <= end; g++){
+				gen(g, vals);
+				for(std::size_t l = 0; l < GROUP; l++){
+					o[g * GROUP + l] = vals[l];
+				}
+			}
+			if(g < g1){
+				gen(g, vals);
+				for(std::size_t k = g * GROUP; k < end; k++){
+					o[k] = vals[k - g * GROUP];
+				}
+			}
+			return;
+		}
+		// strided views walk the storage position of the first element with an odometer
+		std::size_t index[DIMENSION_COUNT];
+		std::size_t rest = g0 * GROUP, at = 0;
+		for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+			index[i] = rest % x.dimensions[i];
+			rest /= x.dimensions[i];
+			at += index[i] * x.dimensionIncrementors[i];
+		}
+		for(std::size_t g = g0; g < g1; g++){
+			gen(g, vals);
+			for(std::size_t l = 0; l < GROUP && g * GROUP + l < end; l++){
+				o[at] = vals[l];
+				for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+					at += x.dimensionIncrementors[i];
+					if(++index[i] < x.dimensions[i]) break;
+					at -= x.dimensions[i] * x.dimensionIncrementors[i];
+					index[i] = 0;
+				}
+			}
+		}
+	});
+}
+
+// sets every element of x to value
+template<int DIMENSION_COUNT, typename T>
+void fill(Tensor<DIMENSION_COUNT, T>& x, T value){
+	if(x.isCopyOnWrite()) x.detach();
+	if(x.isContiguous()){
+		T* o = x.data();
+		const std::size_t rows = x.dimensions[0];
+		parallel_for_rows(rows, rows ? x.elementCount() / rows : 0, FILL_PARALLEL_GRAIN, [&](std::size_t b, std::size_t e){
+			std::fill(o + b, o + e, value);
+		});
+		return;
+	}
+	_fillGroups<1>(x, [&](std::size_t, T (&vals)[1]){ vals[0] = value; });
+}
+
+template<typename T, int DIMENSION_COUNT>
+Tensor<DIMENSION_COUNT, T> full(const std::size_t (&dims)[DIMENSION_COUNT], T value){
+	Tensor<DIMENSION_COUNT, T> x{dims};
+	fill(x, value);
+	return x;
+}
+
+template<typename T, int DIMENSION_COUNT>
+Tensor<DIMENSION_COUNT, T> zeros(const std::size_t (&dims)[DIMENSION_COUNT]){
+	return full(dims, T(0));
+}
+
+template<typename T, int DIMENSION_COUNT>
+Tensor<DIMENSION_COUNT, T> ones(const std::size_t (&dims)[DIMENSION_COUNT]){
+	return full(dims, T(1));
+}
+
+// element k (in row-major order) of x = start + k * step
+template<int DIMENSION_COUNT, typename T>
+void arange(Tensor<DIMENSION_COUNT, T>& x, T start, T step = T(1)){
+	_fillGroups<1>(x, [&](std::size_t k, T (&vals)[1]){ vals[0] = T(start + T(k) * step); });
+}
+
+// start, start + step, ... up to but excluding stop
+template<typename T>
+Tensor<1, T> arange(T start, T stop, T step = T(1)){
+	if(step == T(0)) throw std::invalid_argument("arange step must not be zero");
+	const double count = std::ceil((double(stop) - double(start)) / double(step));
+	Tensor<1, T> x{{count > 0 ? std::size_t(count) : std::size_t(0)}};
+	arange(x, start, step);
+	return x;
+}
+
+// elementCount() evenly spaced values from start to stop (both included) in row-major order
+template<int DIMENSION_COUNT, typename T>
+void linspace(Tensor<DIMENSION_COUNT, T>& x, T start, T stop){
+	const std::size_t last = x.elementCount() - 1;
+	const double span = double(stop) - double(start);
+	_fillGroups<1>(x, [&](std::size_t k, T (&vals)[1]){
+		// the end points are exact, not subject to rounding of the step
+		vals[0] = (k == last && k != 0 ? stop : T(double(start) + span * (double(k) / double(last ? last : 1))));
+	});
+}
+
+template<typename T>
+Tensor<1, T> linspace(T start, T stop, std::size_t count){
+	Tensor<1, T> x{{count}};
+	if(count) linspace(x, start, stop);
+	return x;
+}
+
+// ones on the main diagonal, zeros elsewhere
+template<typename T>
+void eye(Tensor<2, T>& x){
+	fill(x, T(0));
+	const std::size_t n = std::min(x.dimensions[0], x.dimensions[1]);
+	T* o = x.data();
+	for(std::size_t i = 0; i < n; i++){
+		o[i * (x.dimensionIncrementors[0] + x.dimensionIncrementors[1])] = T(1);
+	}
+}
+
+template<typename T>
+Tensor<2, T> eye(std::size_t n){
+	Tensor<2, T> x{{n, n}};
+	eye(x);
+	return x;
+}
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11).
+// Block c of stream s under key seed is a pure function of (seed, s, c), so any element of a random tensor can be
+// computed independently of the others, which makes parallel fills reproducible for every thread count.
+struct Philox {
+	static constexpr std::uint32_t M0 = 0xD2511F53u;
+	static constexpr std::uint32_t M1 = 0xCD9E8D57u;
+	static constexpr std::uint32_t W0 = 0x9E3779B9u;
+	static constexpr std::uint32_t W1 = 0xBB67AE85u;
+
+	// the four random words of counter (c0, c1, c2, c3) under key (k0, k1)
+	static void block(std::uint32_t (&c)[4], std::uint32_t k0, std::uint32_t k1){
+		for(int r = 0; r < 10; r++){
+			const std::uint64_t p0 = std::uint64_t(M0) * c[0];
+			const std::uint64_t p1 = std::uint64_t(M1) * c[2];
+			const std::uint32_t n0 = std::uint32_t(p1 >> 32) ^ c[1] ^ k0;
+			const std::uint32_t n2 = std::uint32_t(p0 >> 32) ^ c[3] ^ k1;
+			c[0] = n0;
+			c[1] = std::uint32_t(p1);
+			c[2] = n2;
+			c[3] = std::uint32_t(p0);
+			k0 += W0;
+			k1 += W1;
+		}
+	}
+
+	// block index of stream stream under seed, written to out
+	static void generate(std::uint64_t seed, std::uint64_t stream, std::uint64_t index, std::uint32_t (&out)[4]){
+		out[0] = std::uint32_t(index);
+		out[1] = std::uint32_t(index >> 32);
+		out[2] = std::uint32_t(stream);
+		out[3] = std::uint32_t(stream >> 32);
+		block(out, std::uint32_t(seed), std::uint32_t(seed >> 32));
+	}
+};
+
+// uniform values in [0, 1) per Philox block: four floats of 24 bits or two doubles of 53 bits
+template<typename T>
+struct _UnitUniform {
+	static_assert(std::is_floating_point<T>::value, "random fills need a floating point tensor");
+	static constexpr std::size_t PER_BLOCK = (sizeof(T) <= 4 ? 4 : 2);
+
+	static void convert(const std::uint32_t (&w)[4], T (&u)[PER_BLOCK]){
+		if constexpr(PER_BLOCK == 4){
+			for(std::size_t l = 0; l < 4; l++){
+				u[l] = T(w[l] >> 8) * T(1.0 / 16777216.0);
+			}
+		}else{
+			for(std::size_t l = 0; l < 2; l++){
+				const std::uint64_t bits = (std::uint64_t(w[2 * l]) << 32) | w[2 * l + 1];
+				u[l] = T(bits >> 11) * T(1.0 / 9007199254740992.0);
+			}
+		}
+	}
+};
+
+// Fills x with values uniformly distributed in [low, high). Element k (in row-major order) only depends on
+// (seed, stream, k): the result is the same for any thread count and any layout of x. Tensors drawn with the same
+// seed should use different streams.
+template<int DIMENSION_COUNT, typename T>
+void uniform(Tensor<DIMENSION_COUNT, T>& x, T low, T high, std::uint64_t seed, std::uint64_t stream = 0){
+	using U = _UnitUniform<T>;
+	const T scale = high - low;
+	_fillGroups<U::PER_BLOCK>(x, [&](std::size_t g, T (&vals)[U::PER_BLOCK]){
+		std::uint32_t w[4];
+		Philox::generate(seed, stream, g, w);
+		U::convert(w, vals);
+		for(std::size_t l = 0; l < U::PER_BLOCK; l++){
+			vals[l] = low + scale * vals[l];
+		}
+	});
+}
+
+// Fills x with normally distributed values, Box-Muller on pairs of uniforms of one Philox block.
+// Reproducible like uniform().
+template<int DIMENSION_COUNT, typename T>
+void normal(Tensor<DIMENSION_COUNT, T>& x, T mean, T stddev, std::uint64_t seed, std::uint64_t stream = 0){
+	using U = _UnitUniform<T>;
+	const T twoPi = T(6.283185307179586);
+	_fillGroups<U::PER_BLOCK>(x, [&](std::size_t g, T (&vals)[U::PER_BLOCK]){
+		std::uint32_t w[4];
+		Philox::generate(seed, stream, g, w);
+		T u[U::PER_BLOCK];
+		U::convert(w, u);
+		for(std::size_t l = 0; l < U::PER_BLOCK; l += 2){
+			// 1 - u lies in (0, 1], so the logarithm stays finite
+			const T r = stddev * _fastSqrt(T(-2) * _fastLog(T(1) - u[l]));
+			const T angle = twoPi * u[l + 1];
+			vals[l] = mean + r * _fastCos(angle);
+			vals[l + 1] = mean + r * _fastSin(angle);
+		}
+	});
+}
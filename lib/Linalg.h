@@ -0,0 +1,326 @@
+#include <cmath>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "Matmul.h"
+
+#pragma once
+
+// panel width of the blocked factorizations and solves
+const std::size_t LINALG_BLOCK = 64;
+
+// minimum number of multiply-adds a thread gets in the triangular and panel kernels
+const std::size_t LINALG_PARALLEL_GRAIN = 1 << 14;
+
+enum class Triangle { LOWER, UPPER };
+
+// raw strided matrix used by the kernels, blocks and transposes are views
+template<typename T>
+struct _Matrix {
+	T* p;
+	std::size_t rows, cols, s0, s1;
+
+	T& operator()(std::size_t i, std::size_t j) const{
+		return p[i * s0 + j * s1];
+	}
+
+	_Matrix block(std::size_t i0, std::size_t j0, std::size_t r, std::size_t c) const{
+		return {p + i0 * s0 + j0 * s1, r, c, s0, s1};
+	}
+
+	_Matrix transposed() const{
+		return {p, cols, rows, s1, s0};
+	}
+};
+
+template<typename T>
+_Matrix<T> _matrixOf(Tensor<2, T>& x){
+	return {x.data(), x.dimensions[0], x.dimensions[1], x.dimensionIncrementors[0], x.dimensionIncrementors[1]};
+}
+
+// c -= a @ b through the library GEMM, which blocks and parallelizes the update
+template<typename T>
+void _gemmSubtract(const _Matrix<T>& a, const _Matrix<T>& b, const _Matrix<T>& c){
+	if(c.rows == 0 || c.cols == 0 || a.cols == 0) return;
+	Epilogue<T> ep;
+	ep.alpha = T(-1);
+	ep.beta = T(1);
+	_gemmBlocked(c.rows, c.cols, a.cols, (const T*)a.p, a.s0, a.s1, (const T*)b.p, b.s0, b.s1, c.p, c.s0, c.s1,
+		(const T*)nullptr, 0, ep, _defaultGemmConfig(c.rows, c.cols, a.cols, b.s1 != 1));
+}
+
+// lower triangle of c -= a @ a^T for a square diagonal block c, the strictly upper triangle of c is not touched
+template<typename T>
+void _syrkLowerSubtract(const _Matrix<T>& a, const _Matrix<T>& c){
+	const std::size_t n = c.rows;
+	parallel_for(0, n, LINALG_PARALLEL_GRAIN / (n * a.cols + 1) + 1, [&](std::size_t i0, std::size_t i1){
+		for(std::size_t i = i0; i < i1; i++){
+			for(std::size_t j = 0; j <= i; j++){
+				T v = T(0);
+				for(std::size_t k = 0; k < a.cols; k++) v += a(i, k) * a(j, k);
+				c(i, j) -= v;
+			}
+		}
+	});
+}
+
+// solves a x = b for a small triangular a by substitution, the columns of b are split over the pool
+template<typename T>
+void _trsmSmall(const _Matrix<T>& a, const _Matrix<T>& b, bool lower, bool unit){
+	const std::size_t n = a.rows;
+	parallel_for(0, b.cols, LINALG_PARALLEL_GRAIN / (n * n + 1) + 1, [&](std::size_t j0, std::size_t j1){
+		for(std::size_t j = j0; j < j1; j++){
+			for(std::size_t s = 0; s < n; s++){
+				const std::size_t i = (lower ? s : n - 1 - s);
+				T x = b(i, j);
+				if(lower){
+					for(std::size_t k = 0; k < i; k++) x -= a(i, k) * b(k, j);
+				}else{
+					for(std::size_t k = i + 1; k < n; k++) x -= a(i, k) * b(k, j);
+				}
+				b(i, j) = (unit ? x : x / a(i, i));
+			}
+		}
+	});
+}
+
+// Blocked left triangular solve, b = a^-1 b. Each diagonal block is solved by substitution and its rows are then
+// eliminated from the remaining right-hand side with one GEMM.
+template<typename T>
+void _trsmLeft(const _Matrix<T>& a, const _Matrix<T>& b, bool lower, bool unit){
+	const std::size_t n = a.rows;
+	for(std::size_t s = 0; s < n; s += LINALG_BLOCK){
+		const std::size_t kb = (n - s < LINALG_BLOCK ? n - s : LINALG_BLOCK);
+		// lower triangles are walked top-down, upper ones bottom-up
+		const std::size_t k0 = (lower ? s : n - s - kb);
+		const _Matrix<T> bk = b.block(k0, 0, kb, b.cols);
+		_trsmSmall(a.block(k0, k0, kb, kb), bk, lower, unit);
+		if(lower){
+			_gemmSubtract(a.block(k0 + kb, k0, n - k0 - kb, kb), bk, b.block(k0 + kb, 0, n - k0 - kb, b.cols));
+		}else{
+			_gemmSubtract(a.block(0, k0, k0, kb), bk, b.block(0, 0, k0, b.cols));
+		}
+	}
+}
+
+// Solves op(a) x = b in place of b, with a triangular and op(a) = a or a^T. Only the given triangle of a is read,
+// with unitDiagonal its diagonal is taken as ones.
+template<typename T>
+void trsm(Tensor<2, T>& a, Tensor<2, T>& b, Triangle triangle, bool transposeA = false, bool unitDiagonal = false){
+	if(a.dimensions[0] != a.dimensions[1]) throw std::invalid_argument("Triangular matrix must be square");
+	if(b.dimensions[0] != a.dimensions[0]) throw std::invalid_argument("Tensor dimensions don't match");
+	if(b.isCopyOnWrite()) b.detach();
+	_Matrix<T> m = _matrixOf(a);
+	bool lower = (triangle == Triangle::LOWER);
+	if(transposeA){
+		// the transpose of a lower triangle is an upper one over swapped strides
+		m = m.transposed();
+		lower = !lower;
+	}
+	_trsmLeft(m, _matrixOf(b), lower, unitDiagonal);
+}
+
+// unblocked Cholesky of a diagonal block
+template<typename T>
+void _choleskyUnblocked(const _Matrix<T>& a){
+	for(std::size_t j = 0; j < a.rows; j++){
+		T d = a(j, j);
+		for(std::size_t k = 0; k < j; k++) d -= a(j, k) * a(j, k);
+		if(!(d > T(0))) throw std::domain_error("Matrix is not positive definite");
+		const T ljj = std::sqrt(d);
+		a(j, j) = ljj;
+		for(std::size_t i = j + 1; i < a.rows; i++){
+			T v = a(i, j);
+			for(std::size_t k = 0; k < j; k++) v -= a(i, k) * a(j, k);
+			a(i, j) = v / ljj;
+		}
+	}
+}
+
+// Blocked right-looking Cholesky, a = L L^T with L written over the lower triangle of a (the strictly upper
+// triangle is left as it is). Throws std::domain_error if a is not positive definite.
+template<typename T>
+void cholesky(Tensor<2, T>& x){
+	const std::size_t n = x.dimensions[0];
+	if(x.dimensions[1] != n) throw std::invalid_argument("Cholesky needs a square matrix");
+	if(x.isCopyOnWrite()) x.detach();
+	const _Matrix<T> a = _matrixOf(x);
+	for(std::size_t j0 = 0; j0 < n; j0 += LINALG_BLOCK){
+		const std::size_t jb = (n - j0 < LINALG_BLOCK ? n - j0 : LINALG_BLOCK);
+		const std::size_t rest = n - j0 - jb;
+		const _Matrix<T> l11 = a.block(j0, j0, jb, jb);
+		_choleskyUnblocked(l11);
+		if(rest == 0) break;
+		// L21 = A21 L11^-T, solved as L11 L21^T = A21^T on the transposed view
+		const _Matrix<T> l21 = a.block(j0 + jb, j0, rest, jb);
+		_trsmLeft(l11, l21.transposed(), true, false);
+		// A22 -= L21 L21^T over the lower triangle only: per block column a SYRK on the diagonal block, then one GEMM
+		// for the rows below it
+		for(std::size_t c0 = 0; c0 < rest; c0 += LINALG_BLOCK){
+			const std::size_t cb = (rest - c0 < LINALG_BLOCK ? rest - c0 : LINALG_BLOCK);
+			const _Matrix<T> lc = l21.block(c0, 0, cb, jb);
+			_syrkLowerSubtract(lc, a.block(j0 + jb + c0, j0 + jb + c0, cb, cb));
+			_gemmSubtract(l21.block(c0 + cb, 0, rest - c0 - cb, jb), lc.transposed(), a.block(j0 + jb + c0 + cb, j0 + jb + c0, rest - c0 - cb, cb));
+		}
+	}
+}
+
+// Blocked right-looking LU with partial pivoting, a = P L U. L (unit diagonal, not stored) and U are written over
+// a and row i was swapped with row pivots[i] at step i, as in LAPACK getrf but counted from 0.
+// Throws std::domain_error if a column has no nonzero pivot.
+template<typename T, typename I>
+void lu(Tensor<2, T>& x, Tensor<1, I>& pivots){
+	static_assert(std::is_integral<I>::value, "pivots must be integers");
+	const std::size_t M = x.dimensions[0];
+	const std::size_t N = x.dimensions[1];
+	const std::size_t mn = (M < N ? M : N);
+	if(pivots.dimensions[0] != mn) throw std::invalid_argument("Pivot tensor must hold min(rows, columns) entries");
+	if(x.isCopyOnWrite()) x.detach();
+	if(pivots.isCopyOnWrite()) pivots.detach();
+	const _Matrix<T> a = _matrixOf(x);
+	I* piv = pivots.data();
+	const std::size_t ps = pivots.dimensionIncrementors[0];
+	for(std::size_t j0 = 0; j0 < mn; j0 += LINALG_BLOCK){
+		const std::size_t jb = (mn - j0 < LINALG_BLOCK ? mn - j0 : LINALG_BLOCK);
+		// factor the panel of columns j0..j0+jb over all rows below j0
+		for(std::size_t j = j0; j < j0 + jb; j++){
+			std::size_t p = j;
+			T best = std::abs(a(j, j));
+			for(std::size_t i = j + 1; i < M; i++){
+				if(std::abs(a(i, j)) > best){
+					best = std::abs(a(i, j));
+					p = i;
+				}
+			}
+			if(best == T(0)) throw std::domain_error("Matrix is singular");
+			piv[j * ps] = I(p);
+			if(p != j){
+				for(std::size_t c = 0; c < N; c++) std::swap(a(j, c), a(p, c));
+			}
+			const T inv = T(1) / a(j, j);
+			const std::size_t width = j0 + jb - j - 1;
+			parallel_for(j + 1, M, LINALG_PARALLEL_GRAIN / (width + 1) + 1, [&](std::size_t i0, std::size_t i1){
+				for(std::size_t i = i0; i < i1; i++){
+					const T lij = (a(i, j) *= inv);
+					for(std::size_t c = j + 1; c < j0 + jb; c++) a(i, c) -= lij * a(j, c);
+				}
+			});
+		}
+		const std::size_t right = N - j0 - jb;
+		if(right == 0) continue;
+		// U12 = L11^-1 A12, then A22 -= L21 U12
+		const _Matrix<T> u12 = a.block(j0, j0 + jb, jb, right);
+		_trsmLeft(a.block(j0, j0, jb, jb), u12, true, true);
+		_gemmSubtract(a.block(j0 + jb, j0, M - j0 - jb, jb), u12, a.block(j0 + jb, j0 + jb, M - j0 - jb, right));
+	}
+}
+
+// Solves a x = b in place of b, given the factors and pivots lu() left in a
+template<typename T, typename I>
+void lu_solve(Tensor<2, T>& factors, Tensor<1, I>& pivots, Tensor<2, T>& b){
+	const std::size_t n = factors.dimensions[0];
+	if(factors.dimensions[1] != n) throw std::invalid_argument("LU solve needs a square matrix");
+	if(b.dimensions[0] != n || pivots.dimensions[0] != n) throw std::invalid_argument("Tensor dimensions don't match");
+	if(b.isCopyOnWrite()) b.detach();
+	const _Matrix<T> rhs = _matrixOf(b);
+	const I* piv = pivots.data();
+	for(std::size_t i = 0; i < n; i++){
+		const std::size_t p = std::size_t(piv[i * pivots.dimensionIncrementors[0]]);
+		if(p >= n) throw std::out_of_range("Pivot is out of range");
+		if(p != i){
+			for(std::size_t c = 0; c < rhs.cols; c++) std::swap(rhs(i, c), rhs(p, c));
+		}
+	}
+	const _Matrix<T> a = _matrixOf(factors);
+	_trsmLeft(a, rhs, true, true);
+	_trsmLeft(a, rhs, false, false);
+}
+
+// Solves a x = b in place of b, given the Cholesky factor cholesky() left in the lower triangle of a
+template<typename T>
+void cholesky_solve(Tensor<2, T>& factor, Tensor<2, T>& b){
+	trsm(factor, b, Triangle::LOWER);
+	trsm(factor, b, Triangle::LOWER, true);
+}
+
+// Batched versions: the leading axes index independent matrices, which are processed in parallel.
+// Written operands are detached once up front, their slices then write in place.
+
+template<int DIMENSION_COUNT, typename T>
+void trsm(Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT, T>& b, Triangle triangle, bool transposeA = false, bool unitDiagonal = false){
+	static_assert(DIMENSION_COUNT > 2, "batched solves need a leading batch axis");
+	if(a.dimensions[0] != b.dimensions[0]) throw std::invalid_argument("Batch dimensions don't match");
+	if(b.isCopyOnWrite()) b.detach();
+	parallel_for(0, a.dimensions[0], 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t i = b0; i < b1; i++){
+			Tensor<DIMENSION_COUNT - 1, T> ai = a.slice(i);
+			Tensor<DIMENSION_COUNT - 1, T> bi = b.slice(i);
+			bi.setCopyOnWrite(false);
+			trsm(ai, bi, triangle, transposeA, unitDiagonal);
+		}
+	});
+}
+
+template<int DIMENSION_COUNT, typename T>
+void cholesky(Tensor<DIMENSION_COUNT, T>& a){
+	static_assert(DIMENSION_COUNT > 2, "batched factorizations need a leading batch axis");
+	if(a.isCopyOnWrite()) a.detach();
+	parallel_for(0, a.dimensions[0], 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t i = b0; i < b1; i++){
+			Tensor<DIMENSION_COUNT - 1, T> ai = a.slice(i);
+			ai.setCopyOnWrite(false);
+			cholesky(ai);
+		}
+	});
+}
+
+template<int DIMENSION_COUNT, typename T>
+void cholesky_solve(Tensor<DIMENSION_COUNT, T>& factor, Tensor<DIMENSION_COUNT, T>& b){
+	static_assert(DIMENSION_COUNT > 2, "batched solves need a leading batch axis");
+	if(factor.dimensions[0] != b.dimensions[0]) throw std::invalid_argument("Batch dimensions don't match");
+	if(b.isCopyOnWrite()) b.detach();
+	parallel_for(0, factor.dimensions[0], 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t i = b0; i < b1; i++){
+			Tensor<DIMENSION_COUNT - 1, T> fi = factor.slice(i);
+			Tensor<DIMENSION_COUNT - 1, T> bi = b.slice(i);
+			bi.setCopyOnWrite(false);
+			cholesky_solve(fi, bi);
+		}
+	});
+}
+
+// pivots has the batch axes of a followed by min(rows, columns)
+template<int DIMENSION_COUNT, typename T, typename I>
+void lu(Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT - 1, I>& pivots){
+	static_assert(DIMENSION_COUNT > 2, "batched factorizations need a leading batch axis");
+	if(a.dimensions[0] != pivots.dimensions[0]) throw std::invalid_argument("Batch dimensions don't match");
+	if(a.isCopyOnWrite()) a.detach();
+	if(pivots.isCopyOnWrite()) pivots.detach();
+	parallel_for(0, a.dimensions[0], 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t i = b0; i < b1; i++){
+			Tensor<DIMENSION_COUNT - 1, T> ai = a.slice(i);
+			Tensor<DIMENSION_COUNT - 2, I> pi = pivots.slice(i);
+			ai.setCopyOnWrite(false);
+			pi.setCopyOnWrite(false);
+			lu(ai, pi);
+		}
+	});
+}
+
+template<int DIMENSION_COUNT, typename T, typename I>
+void lu_solve(Tensor<DIMENSION_COUNT, T>& factors, Tensor<DIMENSION_COUNT - 1, I>& pivots, Tensor<DIMENSION_COUNT, T>& b){
+	static_assert(DIMENSION_COUNT > 2, "batched solves need a leading batch axis");
+	if(factors.dimensions[0] != b.dimensions[0] || factors.dimensions[0] != pivots.dimensions[0]) throw std::invalid_argument("Batch dimensions don't match");
+	if(b.isCopyOnWrite()) b.detach();
+	parallel_for(0, factors.dimensions[0], 1, [&](std::size_t b0, std::size_t b1){
+		for(std::size_t i = b0; i < b1; i++){
+			Tensor<DIMENSION_COUNT - 1, T> fi = factors.slice(i);
+			Tensor<DIMENSION_COUNT - 2, I> pi = pivots.slice(i);
+			Tensor<DIMENSION_COUNT - 1, T> bi = b.slice(i);
+			bi.setCopyOnWrite(false);
+			lu_solve(fi, pi, bi);
+		}
+	});
+}
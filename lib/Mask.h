@@ -0,0 +1,376 @@
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include "Tensor.h"
+#include "Parallel.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// minimum number of elements a thread compares or blends
+const std::size_t MASK_PARALLEL_GRAIN = 1 << 15;
+
+// Boolean tensor packed to one bit per element. Bit k of the words is the element at row-major position k and
+// the bits past the last element are kept zero, so reductions can count whole words. Copies share the words.
+template<int DIMENSION_COUNT>
+class BitMask {
+PRIVATE:
+	std::size_t dimensions[DIMENSION_COUNT];
+	std::size_t count;
+	Reference<std::uint64_t> words;
+
+	static std::size_t product(const std::size_t (&dims)[DIMENSION_COUNT]){
+		std::size_t n = 1;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			n *= dims[i];
+		}
+		return n;
+	}
+
+public:
+	static constexpr std::size_t WORD_BITS = 64;
+
+	// all elements false
+	BitMask(const std::size_t (&dims)[DIMENSION_COUNT]) : count(product(dims)), words(std::max<std::size_t>(wordCount(), 1)){
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			dimensions[i] = dims[i];
+		}
+		std::fill_n(words.data(), wordCount(), std::uint64_t(0));
+	}
+
+	std::size_t dimension(std::size_t i){
+		return dimensions[i];
+	}
+
+	std::size_t elementCount(){
+		return count;
+	}
+
+	std::size_t wordCount(){
+		return (count + WORD_BITS - 1) / WORD_BITS;
+	}
+
+	// the packed words, wordCount() of them
+	std::uint64_t* data(){
+		return words.data();
+	}
+
+	// row-major position of an element, with bounds checking
+	std::size_t position(const std::size_t (&list)[DIMENSION_COUNT]){
+		std::size_t k = 0;
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(list[i] >= dimensions[i]) throw std::out_of_range("Index " + std::to_string(i) + " is out of range");
+			k = k * dimensions[i] + list[i];
+		}
+		return k;
+	}
+
+	bool operator[](const std::size_t (&list)[DIMENSION_COUNT]){
+		const std::size_t k = position(list);
+		return (words.data()[k / WORD_BITS] >> (k % WORD_BITS)) & 1;
+	}
+
+	void set(const std::size_t (&list)[DIMENSION_COUNT], bool value){
+		const std::size_t k = position(list);
+		const std::uint64_t bit = std::uint64_t(1) << (k % WORD_BITS);
+		std::uint64_t& w = words.data()[k / WORD_BITS];
+		w = (value ? w | bit : w & ~bit);
+	}
+
+	// valid bits of word w
+	std::uint64_t wordMask(std::size_t w){
+		const std::size_t bits = count - w * WORD_BITS;
+		return bits >= WORD_BITS ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+	}
+};
+
+// Walks the storage positions of a strided view in row-major element order, starting at element k
+template<int DIMENSION_COUNT>
+struct _RowMajorCursor {
+	const std::size_t* dims;
+	const std::size_t* incs;
+	std::size_t index[DIMENSION_COUNT];
+	std::size_t at = 0;
+
+	_RowMajorCursor(const std::size_t* dims, const std::size_t* incs, std::size_t k) : dims(dims), incs(incs){
+		for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+			index[i] = k % dims[i];
+			k /= dims[i];
+			at += index[i] * incs[i];
+		}
+	}
+
+	void next(){
+		for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+			at += incs[i];
+			if(++index[i] < dims[i]) break;
+			at -= dims[i] * incs[i];
+			index[i] = 0;
+		}
+	}
+};
+
+template<int DIMENSION_COUNT, typename T>
+void _checkMaskShape(BitMask<DIMENSION_COUNT>& m, Tensor<DIMENSION_COUNT, T>& x){
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(m.dimensions[i] != x.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+}
+
+// Packs pred(a_k, b_k) into a new mask. On contiguous inputs each word is built from 64 branch-free compares
+// which the compiler turns into compare-to-mask instructions, views take the strided path.
+template<int DIMENSION_COUNT, typename T, typename P>
+BitMask<DIMENSION_COUNT> _compare(Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT, T>& b, P pred){
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(a.dimensions[i] != b.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	BitMask<DIMENSION_COUNT> m{a.dimensions};
+	const std::size_t n = m.elementCount();
+	const T* pa = a.data();
+	const T* pb = b.data();
+	std::uint64_t* out = m.data();
+	const bool contiguous = a.isContiguous() && b.isContiguous();
+	parallel_for(0, m.wordCount(), MASK_PARALLEL_GRAIN / BitMask<DIMENSION_COUNT>::WORD_BITS + 1, [&](std::size_t w0, std::size_t w1){
+		const std::size_t W = BitMask<DIMENSION_COUNT>::WORD_BITS;
+		if(contiguous){
+			std::size_t w = w0;
+			for(; w < w1 && (w + 1) * W <= n; w++){
+				const T* x = pa + w * W;
+				const T* y = pb + w * W;
+				std::uint64_t bits = 0;
+				for(std::size_t l = 0; l < W; l++){
+					bits |= std::uint64_t(pred(x[l], y[l])) << l;
+				}
+				out[w] = bits;
+			}
+			if(w < w1){
+				std::uint64_t bits = 0;
+				for(std::size_t k = w * W; k < n; k++){
+					bits |= std::uint64_t(pred(pa[k], pb[k])) << (k - w * W);
+				}
+				out[w] = bits;
+			}
+			return;
+		}
+		_RowMajorCursor<DIMENSION_COUNT> ca(a.dimensions, a.dimensionIncrementors, w0 * W);
+		_RowMajorCursor<DIMENSION_COUNT> cb(b.dimensions, b.dimensionIncrementors, w0 * W);
+		for(std::size_t w = w0; w < w1; w++){
+			const std::size_t end = std::min(n, (w + 1) * W);
+			std::uint64_t bits = 0;
+			for(std::size_t k = w * W; k < end; k++){
+				bits |= std::uint64_t(pred(pa[ca.at], pb[cb.at])) << (k - w * W);
+				ca.next();
+				cb.next();
+			}
+			out[w] = bits;
+		}
+	});
+	return m;
+}
+
+// same as _compare against one value for every element
+template<int DIMENSION_COUNT, typename T, typename P>
+BitMask<DIMENSION_COUNT> _compareScalar(Tensor<DIMENSION_COUNT, T>& a, T b, P pred){
+	BitMask<DIMENSION_COUNT> m{a.dimensions};
+	const std::size_t n = m.elementCount();
+	const T* pa = a.data();
+	std::uint64_t* out = m.data();
+	const bool contiguous = a.isContiguous();
+	parallel_for(0, m.wordCount(), MASK_PARALLEL_GRAIN / BitMask<DIMENSION_COUNT>::WORD_BITS + 1, [&](std::size_t w0, std::size_t w1){
+		const std::size_t W = BitMask<DIMENSION_COUNT>::WORD_BITS;
+		if(contiguous){
+			std::size_t w = w0;
+			for(; w < w1 && (w + 1) * W <= n; w++){
+				const T* x = pa + w * W;
+				std::uint64_t bits = 0;
+				for(std::size_t l = 0; l < W; l++){
+					bits |= std::uint64_t(pred(x[l], b)) << l;
+				}
+				out[w] = bits;
+			}
+			if(w < w1){
+				std::uint64_t bits = 0;
+				for(std::size_t k = w * W; k < n; k++){
+					bits |= std::uint64_t(pred(pa[k], b)) << (k - w * W);
+				}
+				out[w] = bits;
+			}
+			return;
+		}
+		_RowMajorCursor<DIMENSION_COUNT> ca(a.dimensions, a.dimensionIncrementors, w0 * W);
+		for(std::size_t w = w0; w < w1; w++){
+			const std::size_t end = std::min(n, (w + 1) * W);
+			std::uint64_t bits = 0;
+			for(std::size_t k = w * W; k < end; k++){
+				bits |= std::uint64_t(pred(pa[ca.at], b)) << (k - w * W);
+				ca.next();
+			}
+			out[w] = bits;
+		}
+	});
+	return m;
+}
+
+// keeps the scalar operand of the comparison operators out of template deduction, so x > 0 works for float x
+template<typename T>
+struct _MaskScalar {
+	using type = T;
+};
+
+#define TENSOR_MASK_COMPARISON(NAME, OP) \
+template<int DIMENSION_COUNT, typename T> \
+BitMask<DIMENSION_COUNT> NAME(Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT, T>& b){ \
+	return _compare(a, b, [](const T& x, const T& y){ return x OP y; }); \
+} \
+template<int DIMENSION_COUNT, typename T> \
+BitMask<DIMENSION_COUNT> NAME(Tensor<DIMENSION_COUNT, T>& a, typename _MaskScalar<T>::type b){ \
+	return _compareScalar(a, b, [](const T& x, const T& y){ return x OP y; }); \
+} \
+template<int DIMENSION_COUNT, typename T> \
+BitMask<DIMENSION_COUNT> operator OP(Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT, T>& b){ \
+	return NAME(a, b); \
+} \
+template<int DIMENSION_COUNT, typename T> \
+BitMask<DIMENSION_COUNT> operator OP(Tensor<DIMENSION_COUNT, T>& a, typename _MaskScalar<T>::type b){ \
+	return NAME(a, b); \
+}
+
+// elementwise comparisons returning a packed mask, against a tensor of the same shape or a single value
+TENSOR_MASK_COMPARISON(greater, >)
+TENSOR_MASK_COMPARISON(greater_equal, >=)
+TENSOR_MASK_COMPARISON(less, <)
+TENSOR_MASK_COMPARISON(less_equal, <=)
+TENSOR_MASK_COMPARISON(equal, ==)
+TENSOR_MASK_COMPARISON(not_equal, !=)
+
+#undef TENSOR_MASK_COMPARISON
+
+// word-wise combination of two masks of the same shape
+template<int DIMENSION_COUNT, typename F>
+BitMask<DIMENSION_COUNT> _combine(BitMask<DIMENSION_COUNT> a, BitMask<DIMENSION_COUNT> b, F op){
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(a.dimensions[i] != b.dimensions[i]) throw std::invalid_argument("Mask dimensions don't match");
+	}
+	BitMask<DIMENSION_COUNT> m{a.dimensions};
+	const std::uint64_t* x = a.data();
+	const std::uint64_t* y = b.data();
+	std::uint64_t* out = m.data();
+	for(std::size_t w = 0; w < m.wordCount(); w++){
+		out[w] = op(x[w], y[w]) & m.wordMask(w);
+	}
+	return m;
+}
+
+template<int DIMENSION_COUNT>
+BitMask<DIMENSION_COUNT> operator&(BitMask<DIMENSION_COUNT> a, BitMask<DIMENSION_COUNT> b){
+	return _combine(a, b, [](std::uint64_t x, std::uint64_t y){ return x & y; });
+}
+
+template<int DIMENSION_COUNT>
+BitMask<DIMENSION_COUNT> operator|(BitMask<DIMENSION_COUNT> a, BitMask<DIMENSION_COUNT> b){
+	return _combine(a, b, [](std::uint64_t x, std::uint64_t y){ return x | y; });
+}
+
+template<int DIMENSION_COUNT>
+BitMask<DIMENSION_COUNT> operator^(BitMask<DIMENSION_COUNT> a, BitMask<DIMENSION_COUNT> b){
+	return _combine(a, b, [](std::uint64_t x, std::uint64_t y){ return x ^ y; });
+}
+
+template<int DIMENSION_COUNT>
+BitMask<DIMENSION_COUNT> operator~(BitMask<DIMENSION_COUNT> a){
+	return _combine(a, a, [](std::uint64_t x, std::uint64_t){ return ~x; });
+}
+
+// number of true elements
+template<int DIMENSION_COUNT>
+std::size_t count_nonzero(BitMask<DIMENSION_COUNT> m){
+	const std::uint64_t* w = m.data();
+	std::size_t total = 0;
+	for(std::size_t i = 0; i < m.wordCount(); i++){
+		total += (std::size_t)__builtin_popcountll(w[i]);
+	}
+	return total;
+}
+
+template<int DIMENSION_COUNT>
+bool any(BitMask<DIMENSION_COUNT> m){
+	const std::uint64_t* w = m.data();
+	for(std::size_t i = 0; i < m.wordCount(); i++){
+		if(w[i]) return true;
+	}
+	return false;
+}
+
+template<int DIMENSION_COUNT>
+bool all(BitMask<DIMENSION_COUNT> m){
+	const std::uint64_t* w = m.data();
+	for(std::size_t i = 0; i < m.wordCount(); i++){
+		if(w[i] != m.wordMask(i)) return false;
+	}
+	return true;
+}
+
+// out = mask ? a : b elementwise, as a branch-free blend
+template<int DIMENSION_COUNT, typename T>
+void where(BitMask<DIMENSION_COUNT> mask, Tensor<DIMENSION_COUNT, T>& a, Tensor<DIMENSION_COUNT, T>& b, Tensor<DIMENSION_COUNT, T>& out){
+	_checkMaskShape(mask, a);
+	_checkMaskShape(mask, b);
+	_checkMaskShape(mask, out);
+	if(out.isCopyOnWrite()) out.detach();
+	const std::uint64_t* bits = mask.data();
+	const T* pa = a.data();
+	const T* pb = b.data();
+	T* po = out.data();
+	const bool contiguous = a.isContiguous() && b.isContiguous() && out.isContiguous();
+	const std::size_t W = BitMask<DIMENSION_COUNT>::WORD_BITS;
+	parallel_for(0, mask.wordCount(), MASK_PARALLEL_GRAIN / W + 1, [&](std::size_t w0, std::size_t w1){
+		const std::size_t k1 = std::min(mask.elementCount(), w1 * W);
+		if(contiguous){
+			for(std::size_t k = w0 * W; k < k1; k++){
+				po[k] = ((bits[k / W] >> (k % W)) & 1) ? pa[k] : pb[k];
+			}
+			return;
+		}
+		_RowMajorCursor<DIMENSION_COUNT> ca(a.dimensions, a.dimensionIncrementors, w0 * W);
+		_RowMajorCursor<DIMENSION_COUNT> cb(b.dimensions, b.dimensionIncrementors, w0 * W);
+		_RowMajorCursor<DIMENSION_COUNT> co(out.dimensions, out.dimensionIncrementors, w0 * W);
+		for(std::size_t k = w0 * W; k < k1; k++){
+			po[co.at] = ((bits[k / W] >> (k % W)) & 1) ? pa[ca.at] : pb[cb.at];
+			ca.next();
+			cb.next();
+			co.next();
+		}
+	});
+}
+
+// x = mask ? value : x elementwise
+template<int DIMENSION_COUNT, typename T>
+void masked_fill(Tensor<DIMENSION_COUNT, T>& x, BitMask<DIMENSION_COUNT> mask, T value){
+	_checkMaskShape(mask, x);
+	if(x.isCopyOnWrite()) x.detach();
+	const std::uint64_t* bits = mask.data();
+	T* px = x.data();
+	const bool contiguous = x.isContiguous();
+	const std::size_t W = BitMask<DIMENSION_COUNT>::WORD_BITS;
+	parallel_for(0, mask.wordCount(), MASK_PARALLEL_GRAIN / W + 1, [&](std::size_t w0, std::size_t w1){
+		const std::size_t k1 = std::min(mask.elementCount(), w1 * W);
+		if(contiguous){
+			for(std::size_t k = w0 * W; k < k1; k++){
+				px[k] = ((bits[k / W] >> (k % W)) & 1) ? value : px[k];
+			}
+			return;
+		}
+		_RowMajorCursor<DIMENSION_COUNT> cx(x.dimensions, x.dimensionIncrementors, w0 * W);
+		for(std::size_t k = w0 * W; k < k1; k++){
+			px[cx.at] = ((bits[k / W] >> (k % W)) & 1) ? value : px[cx.at];
+			cx.next();
+		}
+	});
+}
@@ -1,99 +1,799 @@
+#include <cmath>
+#include <vector>
+#include <typeinfo>
 #include "Tensor.h"
+#include "Parallel.h"
+#include "Workspace.h"
+#include "Autotune.h"
+#include "FastMath.h"
+#include "Frozen.h"
+
+#pragma once
+
+// activation function applied by the matmul epilogue
+enum class Activation { NONE, RELU, GELU, TANH, SIGMOID };
+
+// Optional epilogue fused into the matmul write-back, computed while the output tile is still in registers:
+// x3 = activation(alpha * (x1 @ x2) + bias + beta * x3)
+template<typename T>
+struct Epilogue {
+	T alpha = 1;
+	// beta = 1 accumulates the result onto the existing x3 contents (residual), beta = 0 never reads x3
+	T beta = 0;
+	// broadcast along the last (N) axis of the output, nullptr disables the bias
+	Tensor<1, T>* bias = nullptr;
+	Activation activation = Activation::NONE;
+};
+
+template<typename T>
+inline T _activate(T x, Activation activation){
+	switch(activation){
+		case Activation::RELU:
+			return x > T(0) ? x : T(0);
+		case Activation::GELU:
+			if constexpr(_HAS_FAST_MATH<T>) return _fastGelu(x);
+			return static_cast<T>(0.5 * x * (1.0 + std::erf(x * 0.7071067811865476)));
+		case Activation::TANH:
+			if constexpr(_HAS_FAST_MATH<T>) return _fastTanh(x);
+			return static_cast<T>(std::tanh(x));
+		case Activation::SIGMOID:
+			if constexpr(_HAS_FAST_MATH<T>) return _fastSigmoid(x);
+			return static_cast<T>(1.0 / (1.0 + std::exp(-static_cast<double>(x))));
+		default:
+			return x;
+	}
+}
+
+// applies the epilogue to the accumulated value acc and writes it to out, j is the index along the bias axis
+template<typename T3>
+inline void _storeEpilogue(T3& out, T3 acc, const T3* bias, std::size_t j, const Epilogue<T3>& ep){
+	T3 v = ep.alpha * acc;
+	if(bias) v += bias[j];
+	if(ep.beta != T3(0)) v += ep.beta * out;
+	out = _activate(v, ep.activation);
+}
+
+// returns a pointer to the bias values of the epilogue (nullptr if unused) and checks its length against n
+template<typename T3>
+inline const T3* _epilogueBias(const Epilogue<T3>& ep, std::size_t n, std::size_t& stride){
+	stride = 0;
+	if(!ep.bias) return nullptr;
+	if(ep.bias->dimensions[0] != n) throw std::invalid_argument("Bias does not match output dimensions");
+	stride = ep.bias->dimensionIncrementors[0];
+	return ep.bias->data();
+}
 
 
 template<typename T, int DIMENSION_COUNT, typename T2, int DIMENSION_COUNT2, typename T3>
-void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT2, T3> x3){
+void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT2, T3> x3, const Epilogue<T3>& ep){
 	for(std::size_t i=0; i<x2.dimensions[0]; i++){
 		//dimension reduction (1:N broadcast)
-		_matmul(x1, x2.slice(i), x3.slice(i));
+		_matmul(x1, x2.slice(i), x3.slice(i), ep);
 	}
 }
 
 template<typename T, int DIMENSION_COUNT, typename T2, int DIMENSION_COUNT2, typename T3>
-void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT, T3> x3){
+void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT, T3> x3, const Epilogue<T3>& ep){
 	for(std::size_t i=0; i<x1.dimensions[0]; i++){
 		//dimension reduction (1:N broadcast)
-		_matmul(x1.slice(i), x2, x3.slice(i));
+		_matmul(x1.slice(i), x2, x3.slice(i), ep);
 	}
 }
 template<typename T, int DIMENSION_COUNT, typename T2, typename T3>
-void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT, T2> x2, Tensor<DIMENSION_COUNT, T3> x3){
+void _matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT, T2> x2, Tensor<DIMENSION_COUNT, T3> x3, const Epilogue<T3>& ep){
 	for(std::size_t i=0; i<x1.dimensions[0]; i++){
-		_matmul(x1.slice(i), x2.slice(i), x3.slice(i));
+		_matmul(x1.slice(i), x2.slice(i), x3.slice(i), ep);
 	}
 }
-// 2x2 dimension matmul
+// register tile of the 2x2 dimension kernel
+const std::size_t MATMUL_MR = 4;
+const std::size_t MATMUL_NR = 4;
+
+// base 2-D kernel on raw strided pointers: c[M,N] = epilogue(a[M,K] @ b[K,N])
+template<typename T, typename T2, typename T3>
+void _gemmKernel(std::size_t M, std::size_t N, std::size_t K,
+		const T* a, std::size_t as0, std::size_t as1,
+		const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1,
+		const T3* bias, std::size_t biasStride, const Epilogue<T3>& ep){
+	//actual mat mul, one MR x NR output tile at a time
+	for(std::size_t i0 = 0; i0 < M; i0 += MATMUL_MR){
+		const std::size_t mr = (M - i0 < MATMUL_MR ? M - i0 : MATMUL_MR);
+		for(std::size_t j0 = 0; j0 < N; j0 += MATMUL_NR){
+			const std::size_t nr = (N - j0 < MATMUL_NR ? N - j0 : MATMUL_NR);
+			T3 acc[MATMUL_MR][MATMUL_NR] = {};
+			for(std::size_t k = 0; k < K; k++){
+				for(std::size_t r = 0; r < mr; r++){
+					const T av = a[(i0 + r) * as0 + k * as1];
+					for(std::size_t q = 0; q < nr; q++){
+						acc[r][q] += av * b[k * bs0 + (j0 + q) * bs1];
+					}
+				}
+			}
+			//epilogue, applied before the tile leaves registers
+			for(std::size_t r = 0; r < mr; r++){
+				for(std::size_t q = 0; q < nr; q++){
+					_storeEpilogue(c[(i0 + r) * cs0 + (j0 + q) * cs1], acc[r][q], bias, (j0 + q) * biasStride, ep);
+				}
+			}
+		}
+	}
+}
+
+// cache-blocked 2-D matmul: the K axis is walked in panels of cfg.blockK, output blocks of cfg.blockM x cfg.blockN are
+// spread over cfg.threads threads and each block runs the register kernel, optionally on packed copies of its panels
 template<typename T, typename T2, typename T3>
-void _matmul(Tensor<2, T> x1, Tensor<2, T2> x2, Tensor<2, T3> x3){
-	//actual mat mul
-	for(std::size_t i = 0;i < x1.dimensions[0]; i++){
-		Tensor<1, T> x1_1 = x1.slice(i);
-		Tensor<1, T3> x3_1 = x3.slice(i);
-		for(std::size_t j = 0;j < x2.dimensions[1]; j++){
-			x3_1[{j}]=0;
-			Tensor<1, T2> x2_2 = x2.slice(j, 1);
-			for(std::size_t k = 0; k < x1.dimensions[1]; k++){
-				x3_1[{j}] += x1_1[{k}]*x2_2[{k}];
+void _gemmBlocked(std::size_t M, std::size_t N, std::size_t K,
+		const T* a, std::size_t as0, std::size_t as1,
+		const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1,
+		const T3* bias, std::size_t biasStride, const Epilogue<T3>& ep, const GemmConfig& cfg){
+	const std::size_t blockM = (cfg.blockM ? cfg.blockM : M);
+	const std::size_t blockN = (cfg.blockN ? cfg.blockN : N);
+	const std::size_t blockK = (cfg.blockK && K ? cfg.blockK : (K ? K : 1));
+	const std::size_t mBlocks = (M + blockM - 1) / blockM;
+	const std::size_t nBlocks = (N + blockN - 1) / blockN;
+	const std::size_t tasks = mBlocks * nBlocks;
+	const std::size_t threads = (cfg.threads < 1 ? 1 : (cfg.threads > tasks ? tasks : cfg.threads));
+	for(std::size_t k0 = 0; k0 < K || k0 == 0; k0 += blockK){
+		const std::size_t kc = (K - k0 < blockK ? K - k0 : blockK);
+		const bool last = k0 + blockK >= K;
+		// later panels accumulate onto the earlier ones, bias and activation only run after the last panel
+		Epilogue<T3> panelEp = ep;
+		if(k0 > 0) panelEp.beta = 1;
+		if(!last) panelEp.activation = Activation::NONE;
+		const T3* panelBias = (last ? bias : nullptr);
+		// one output block against the current K panel, on the calling thread's workspace
+		auto block = [&](std::size_t i0, std::size_t mc, std::size_t j0, std::size_t nc){
+			WorkspacePool<T>& poolA = WorkspacePool<T>::local();
+			WorkspacePool<T2>& poolB = WorkspacePool<T2>::local();
+			// both panels come from one pool when T == T2, so room for both is made before the first acquire
+			const std::size_t sizeA = (cfg.packA ? blockM * blockK : 0);
+			const std::size_t sizeB = (cfg.packB ? blockK * blockN : 0);
+			if((void*)&poolA == (void*)&poolB){
+				poolA.reserve(sizeA + sizeB);
+			}else{
+				poolA.reserve(sizeA);
+				poolB.reserve(sizeB);
+			}
+			const T* ap = a + i0 * as0 + k0 * as1;
+			std::size_t ap0 = as0, ap1 = as1;
+			const T2* bp = b + k0 * bs0 + j0 * bs1;
+			std::size_t bp0 = bs0, bp1 = bs1;
+			T* packedA = nullptr;
+			T2* packedB = nullptr;
+			if(cfg.packA){
+				packedA = poolA.acquire(mc * kc);
+				for(std::size_t i = 0; i < mc; i++){
+					for(std::size_t k = 0; k < kc; k++){
+						packedA[i * kc + k] = ap[i * ap0 + k * ap1];
+					}
+				}
+				ap = packedA;
+				ap0 = kc;
+				ap1 = 1;
 			}
+			if(cfg.packB){
+				packedB = poolB.acquire(kc * nc);
+				for(std::size_t k = 0; k < kc; k++){
+					for(std::size_t j = 0; j < nc; j++){
+						packedB[k * nc + j] = bp[k * bp0 + j * bp1];
+					}
+				}
+				bp = packedB;
+				bp0 = nc;
+				bp1 = 1;
+			}
+			_gemmKernel(mc, nc, kc, ap, ap0, ap1, bp, bp0, bp1, c + i0 * cs0 + j0 * cs1, cs0, cs1,
+				panelBias ? panelBias + j0 * biasStride : panelBias, biasStride, panelEp);
+			if(packedB) poolB.release(kc * nc);
+			if(packedA) poolA.release(mc * kc);
+		};
+		if(threads > 1 && Numa::enabled()){
+			// rows of a and c run on the node holding them when they are PARTITIONED (see numa_place)
+			parallel_for_nodes(M, blockM, [&](std::size_t i0, std::size_t i1){
+				for(std::size_t j0 = 0; j0 < N; j0 += blockN){
+					block(i0, i1 - i0, j0, (N - j0 < blockN ? N - j0 : blockN));
+				}
+			});
+		}else{
+			ThreadPool::instance().run(threads, [&](std::size_t thread){
+				for(std::size_t task = thread; task < tasks; task += threads){
+					const std::size_t i0 = (task / nBlocks) * blockM;
+					const std::size_t j0 = (task % nBlocks) * blockN;
+					block(i0, (M - i0 < blockM ? M - i0 : blockM), j0, (N - j0 < blockN ? N - j0 : blockN));
+				}
+			});
 		}
+		if(K == 0) break;
 	}
 }
+
+// blocking used when the tuner is off: no packing for small problems, all threads for large ones
+inline GemmConfig _defaultGemmConfig(std::size_t M, std::size_t N, std::size_t K, bool stridedB){
+	GemmConfig c;
+	c.packB = stridedB && M > MATMUL_MR;
+	c.threads = (M * N * K >= (std::size_t(1) << 18) ? ThreadPool::instance().size() : 1);
+	return c;
+}
+
+// picks the blocking for a 2-D product, asking the tuner (and benchmarking on a scratch output) when it is enabled
+template<typename T, typename T2, typename T3>
+GemmConfig _gemmConfig(std::size_t M, std::size_t N, std::size_t K,
+		const T* a, std::size_t as0, std::size_t as1, const T2* b, std::size_t bs0, std::size_t bs1, bool rowMajorC){
+	if(!GemmTuner::enabled) return _defaultGemmConfig(M, N, K, bs1 != 1);
+	const std::string dtype = std::string(typeid(T).name()) + "," + typeid(T2).name() + "," + typeid(T3).name();
+	const std::string layout = std::string(as1 == 1 ? "r" : "c") + (bs1 == 1 ? "r" : "c") + (rowMajorC ? "r" : "c");
+	const std::string key = GemmTuner::signature(M, N, K, dtype, layout);
+	GemmTuner& tuner = GemmTuner::instance();
+	GemmConfig tuned;
+	if(tuner.find(key, tuned)) return tuned;
+	// benchmark output, allocated once outside the timed runs
+	std::vector<T3> scratch(M * N);
+	return tuner.lookup(key, GemmTuner::candidates(M, N, K), [&](const GemmConfig& cfg){
+		_gemmBlocked(M, N, K, a, as0, as1, b, bs0, bs1, scratch.data(), N, std::size_t(1), (const T3*)nullptr, 0, Epilogue<T3>{}, cfg);
+	});
+}
+
+// Opt-in Strassen recursion for large square 2-D products, off by default.
+// Strassen is only normwise stable. With n0 the cut-off size and u the unit roundoff of T3
+//     max|C - fl(C)| <= [(n/n0)^log2(12) * (n0^2 + 5*n0) - 5n] * u * max|A| * max|B|   (Higham, Thm 23.3)
+// while the classical kernel guarantees |C - fl(C)| <= n * u * |A||B| elementwise, so small entries of C can lose
+// relative accuracy. Each level of recursion roughly multiplies the error bound by 12/4 = 3.
+// With a multi-threaded pool the top one or two levels run their 7 (49) products as pool tasks, which holds all
+// of those products at once: (7/4)^levels * n^2 extra elements of workspace.
+struct FastMatmul {
+	static bool enabled;
+	// smallest side length that is split further, smaller (sub)products use the classical kernel
+	static std::size_t threshold;
+};
+bool FastMatmul::enabled = false;
+std::size_t FastMatmul::threshold = 512;
+
+// Strassen only pays off for large square products, everything else stays on the classical path
+inline bool _useStrassen(std::size_t M, std::size_t N, std::size_t K){
+	return FastMatmul::enabled && M == N && N == K && M >= FastMatmul::threshold && M >= 2;
+}
+
+// workspace elements needed by _strassen for side length n
+inline std::size_t _strassenWorkspace(std::size_t n){
+	if(n < FastMatmul::threshold || n < 2) return 0;
+	const std::size_t h = n / 2;
+	return 3 * h * h + _strassenWorkspace(h);
+}
+
+// scratch of the strassen recursion, kept apart from WorkspacePool<T3>::local() which the leaf GEMMs pack into
+template<typename T3>
+WorkspacePool<T3>& _strassenPool(){
+	static thread_local WorkspacePool<T3> pool {};
+	return pool;
+}
+
+// c = a + sign * b for h x h blocks, the result is contiguous with row stride h
+template<typename T3, typename T>
+inline void _blockAdd(std::size_t h, const T* a, std::size_t as0, std::size_t as1, const T* b, std::size_t bs0, std::size_t bs1, T3 sign, T3* c){
+	for(std::size_t i = 0; i < h; i++){
+		for(std::size_t j = 0; j < h; j++){
+			c[i * h + j] = T3(a[i * as0 + j * as1]) + sign * T3(b[i * bs0 + j * bs1]);
+		}
+	}
+}
+
+// c += sign * p for an h x h contiguous block p
+template<typename T3>
+inline void _blockAccumulate(std::size_t h, const T3* p, T3 sign, T3* c, std::size_t cs0, std::size_t cs1){
+	for(std::size_t i = 0; i < h; i++){
+		for(std::size_t j = 0; j < h; j++){
+			c[i * cs0 + j * cs1] += sign * p[i * h + j];
+		}
+	}
+}
+
+// classical c = epilogue(a @ b) through the blocked GEMM with the tuned (or default) blocking, no bias
+template<typename T, typename T2, typename T3>
+void _gemmTuned(std::size_t M, std::size_t N, std::size_t K, const T* a, std::size_t as0, std::size_t as1,
+		const T2* b, std::size_t bs0, std::size_t bs1, T3* c, std::size_t cs0, std::size_t cs1, const Epilogue<T3>& ep){
+	_gemmBlocked(M, N, K, a, as0, as1, b, bs0, bs1, c, cs0, cs1, (const T3*)nullptr, 0, ep,
+		_gemmConfig<T, T2, T3>(M, N, K, a, as0, as1, b, bs0, bs1, cs1 == 1));
+}
+
+// Dynamic peeling: completes c = a @ b for n x n operands once the leading m x m block of c holds
+// a[:m, :m] @ b[:m, :m], the remaining n - m rows and columns are computed classically
+template<typename T, typename T2, typename T3>
+void _strassenPeel(std::size_t n, std::size_t m, const T* a, std::size_t as0, std::size_t as1, const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1){
+	if(m == n) return;
+	const std::size_t r = n - m;
+	const Epilogue<T3> plain{};
+	const Epilogue<T3> accumulate{1, 1};
+	_gemmTuned(m, m, r, a + m * as1, as0, as1, b + m * bs0, bs0, bs1, c, cs0, cs1, accumulate);
+	_gemmTuned(m, r, n, a, as0, as1, b + m * bs1, bs0, bs1, c + m * cs1, cs0, cs1, plain);
+	_gemmTuned(r, n, n, a + m * as0, as0, as1, b, bs0, bs1, c + m * cs0, cs0, cs1, plain);
+}
+
+// c[n,n] = a[n,n] @ b[n,n], operands are addressed as (pointer, row stride, column stride)
+template<typename T, typename T2, typename T3>
+void _strassen(std::size_t n, const T* a, std::size_t as0, std::size_t as1, const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1, WorkspacePool<T3>& pool){
+	if(n < FastMatmul::threshold || n < 2){
+		_gemmTuned(n, n, n, a, as0, as1, b, bs0, bs1, c, cs0, cs1, Epilogue<T3>{});
+		return;
+	}
+	if(n % 2 == 1){
+		// strassen on the even leading block, then the last row and column
+		_strassen(n - 1, a, as0, as1, b, bs0, bs1, c, cs0, cs1, pool);
+		_strassenPeel(n, n - 1, a, as0, as1, b, bs0, bs1, c, cs0, cs1);
+		return;
+	}
+	const std::size_t h = n / 2;
+	const T* a11 = a;
+	const T* a12 = a + h * as1;
+	const T* a21 = a + h * as0;
+	const T* a22 = a + h * as0 + h * as1;
+	const T2* b11 = b;
+	const T2* b12 = b + h * bs1;
+	const T2* b21 = b + h * bs0;
+	const T2* b22 = b + h * bs0 + h * bs1;
+	T3* c11 = c;
+	T3* c12 = c + h * cs1;
+	T3* c21 = c + h * cs0;
+	T3* c22 = c + h * cs0 + h * cs1;
+
+	T3* s = pool.acquire(h * h);
+	T3* t = pool.acquire(h * h);
+	T3* p = pool.acquire(h * h);
+	for(std::size_t i = 0; i < n; i++){
+		for(std::size_t j = 0; j < n; j++){
+			c[i * cs0 + j * cs1] = 0;
+		}
+	}
+	// M1 = (A11 + A22)(B11 + B22) -> C11, C22
+	_blockAdd(h, a11, as0, as1, a22, as0, as1, T3(1), s);
+	_blockAdd(h, b11, bs0, bs1, b22, bs0, bs1, T3(1), t);
+	_strassen(h, (const T3*)s, h, 1, (const T3*)t, h, 1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c11, cs0, cs1);
+	_blockAccumulate(h, p, T3(1), c22, cs0, cs1);
+	// M2 = (A21 + A22) B11 -> C21, -C22
+	_blockAdd(h, a21, as0, as1, a22, as0, as1, T3(1), s);
+	_strassen(h, (const T3*)s, h, 1, b11, bs0, bs1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c21, cs0, cs1);
+	_blockAccumulate(h, p, T3(-1), c22, cs0, cs1);
+	// M3 = A11 (B12 - B22) -> C12, C22
+	_blockAdd(h, b12, bs0, bs1, b22, bs0, bs1, T3(-1), t);
+	_strassen(h, a11, as0, as1, (const T3*)t, h, 1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c12, cs0, cs1);
+	_blockAccumulate(h, p, T3(1), c22, cs0, cs1);
+	// M4 = A22 (B21 - B11) -> C11, C21
+	_blockAdd(h, b21, bs0, bs1, b11, bs0, bs1, T3(-1), t);
+	_strassen(h, a22, as0, as1, (const T3*)t, h, 1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c11, cs0, cs1);
+	_blockAccumulate(h, p, T3(1), c21, cs0, cs1);
+	// M5 = (A11 + A12) B22 -> -C11, C12
+	_blockAdd(h, a11, as0, as1, a12, as0, as1, T3(1), s);
+	_strassen(h, (const T3*)s, h, 1, b22, bs0, bs1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(-1), c11, cs0, cs1);
+	_blockAccumulate(h, p, T3(1), c12, cs0, cs1);
+	// M6 = (A21 - A11)(B11 + B12) -> C22
+	_blockAdd(h, a21, as0, as1, a11, as0, as1, T3(-1), s);
+	_blockAdd(h, b11, bs0, bs1, b12, bs0, bs1, T3(1), t);
+	_strassen(h, (const T3*)s, h, 1, (const T3*)t, h, 1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c22, cs0, cs1);
+	// M7 = (A12 - A22)(B21 + B22) -> C11
+	_blockAdd(h, a12, as0, as1, a22, as0, as1, T3(-1), s);
+	_blockAdd(h, b21, bs0, bs1, b22, bs0, bs1, T3(1), t);
+	_strassen(h, (const T3*)s, h, 1, (const T3*)t, h, 1, p, h, 1, pool);
+	_blockAccumulate(h, p, T3(1), c11, cs0, cs1);
+	pool.release(3 * h * h);
+}
+
+// Strassen's scheme as coefficient tables over the quadrants 11, 12, 21, 22: product k multiplies
+// (sum_q STRASSEN_A[k][q] A_q) by (sum_q STRASSEN_B[k][q] B_q), and C_q = sum_k STRASSEN_C[q][k] M_k
+const int STRASSEN_A[7][4] = {{1,0,0,1}, {0,0,1,1}, {1,0,0,0}, {0,0,0,1}, {1,1,0,0}, {-1,0,1,0}, {0,1,0,-1}};
+const int STRASSEN_B[7][4] = {{1,0,0,1}, {1,0,0,0}, {0,1,0,-1}, {-1,0,1,0}, {0,0,0,1}, {1,1,0,0}, {0,0,1,1}};
+const int STRASSEN_C[4][7] = {{1,0,0,1,-1,0,1}, {0,0,1,0,1,0,0}, {0,1,0,1,0,0,0}, {1,-1,1,0,0,1,0}};
+
+// Over several unrolled levels a block of side s is named by its quadrant path (one base 4 digit per level, the
+// innermost level first) and a product by its task index (one base 7 digit per level). Returns the coefficient
+// the tables give the pair and sets the offset of the block.
+template<std::size_t ROWS, std::size_t COLS>
+inline int _strassenCoefficient(const int (&table)[ROWS][COLS], bool pathFirst, std::size_t task, std::size_t path,
+		std::size_t levels, std::size_t s, std::size_t& row, std::size_t& col){
+	int coefficient = 1;
+	row = 0;
+	col = 0;
+	for(std::size_t l = 0; l < levels; l++){
+		const std::size_t k = task % 7, q = path % 4;
+		coefficient *= (pathFirst ? table[q][k] : table[k][q]);
+		row += (q / 2) * (s << l);
+		col += (q % 2) * (s << l);
+		task /= 7;
+		path /= 4;
+	}
+	return coefficient;
+}
+
+// the operand of product task over x, written contiguously to out (s x s)
+template<typename T3, typename T>
+void _strassenOperand(const int (&table)[7][4], std::size_t task, std::size_t levels, std::size_t s,
+		const T* x, std::size_t xs0, std::size_t xs1, T3* out){
+	bool first = true;
+	for(std::size_t path = 0; path < (std::size_t(1) << (2 * levels)); path++){
+		std::size_t row, col;
+		const int coefficient = _strassenCoefficient(table, false, task, path, levels, s, row, col);
+		if(coefficient == 0) continue;
+		const T* block = x + row * xs0 + col * xs1;
+		for(std::size_t i = 0; i < s; i++){
+			for(std::size_t j = 0; j < s; j++){
+				const T3 v = T3(coefficient) * T3(block[i * xs0 + j * xs1]);
+				out[i * s + j] = (first ? v : out[i * s + j] + v);
+			}
+		}
+		first = false;
+	}
+}
+
+// The top levels of the recursion unrolled into independent products of side s = n >> levels that are spread over
+// the pool, each one formed and multiplied by the serial recursion on the thread running it. n must be a multiple
+// of 2^levels.
+template<typename T, typename T2, typename T3>
+void _strassenParallel(std::size_t n, std::size_t levels, const T* a, std::size_t as0, std::size_t as1, const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1){
+	const std::size_t s = n >> levels;
+	std::size_t tasks = 1;
+	for(std::size_t l = 0; l < levels; l++) tasks *= 7;
+	// the products live in the caller's pool, which also serves the tasks the caller runs itself
+	const std::size_t perTask = 2 * s * s + _strassenWorkspace(s);
+	_strassenPool<T3>().reserve(tasks * s * s + perTask);
+	WorkspaceLease<T3> productLease(_strassenPool<T3>(), tasks * s * s);
+	T3* products = productLease.data();
+	ThreadPool::instance().run(tasks, [&](std::size_t task){
+		WorkspacePool<T3>& local = _strassenPool<T3>();
+		local.reserve(perTask);
+		WorkspaceLease<T3> left(local, s * s), right(local, s * s);
+		_strassenOperand(STRASSEN_A, task, levels, s, a, as0, as1, left.data());
+		_strassenOperand(STRASSEN_B, task, levels, s, b, bs0, bs1, right.data());
+		_strassen(s, (const T3*)left.data(), s, 1, (const T3*)right.data(), s, 1, products + task * s * s, s, 1, local);
+	});
+	// every row of every output block sums its products
+	parallel_for(0, (std::size_t(1) << (2 * levels)) * s, 1, [&](std::size_t r0, std::size_t r1){
+		for(std::size_t r = r0; r < r1; r++){
+			const std::size_t path = r / s, i = r % s;
+			bool first = true;
+			for(std::size_t task = 0; task < tasks; task++){
+				std::size_t row, col;
+				const int coefficient = _strassenCoefficient(STRASSEN_C, true, task, path, levels, s, row, col);
+				if(coefficient == 0) continue;
+				const T3* p = products + task * s * s + i * s;
+				T3* out = c + (row + i) * cs0 + col * cs1;
+				for(std::size_t j = 0; j < s; j++){
+					const T3 v = T3(coefficient) * p[j];
+					out[j * cs1] = (first ? v : out[j * cs1] + v);
+				}
+				first = false;
+			}
+		}
+	});
+}
+
+// Number of top levels run as pool tasks: one level keeps up to 7 threads busy, two levels (49 products) any larger
+// pool. Only levels the serial recursion would split as well are unrolled.
+inline std::size_t _strassenParallelLevels(std::size_t n){
+	const std::size_t threads = ThreadPool::instance().size();
+	const std::size_t wanted = (threads <= 1 ? 0 : (threads <= 7 ? 1 : 2));
+	std::size_t levels = 0;
+	while(levels < wanted && (n >> levels) >= FastMatmul::threshold && (n >> levels) >= 2) levels++;
+	return levels;
+}
+
+// runs the strassen product and applies the epilogue as a separate pass over the output, the top levels of the
+// recursion run as pool tasks
+template<typename T, typename T2, typename T3>
+void _strassenMatmul(std::size_t n, const T* a, std::size_t as0, std::size_t as1, const T2* b, std::size_t bs0, std::size_t bs1,
+		T3* c, std::size_t cs0, std::size_t cs1, const T3* bias, std::size_t biasStride, const Epilogue<T3>& ep,
+		std::size_t levels){
+	WorkspacePool<T3>& pool = _strassenPool<T3>();
+	// with beta the old output is still needed, so the product goes to the workspace first
+	const bool separate = ep.beta != T3(0);
+	// the unrolled levels work on the leading block of side m, the rest is peeled off
+	const std::size_t m = n >> levels << levels;
+	std::size_t work = _strassenWorkspace(n);
+	if(levels > 0){
+		const std::size_t s = m >> levels;
+		std::size_t tasks = 1;
+		for(std::size_t l = 0; l < levels; l++) tasks *= 7;
+		work = tasks * s * s + 2 * s * s + _strassenWorkspace(s);
+	}
+	pool.reserve(work + (separate ? n * n : 0));
+	T3* product = c;
+	std::size_t ps0 = cs0, ps1 = cs1;
+	if(separate){
+		product = pool.acquire(n * n);
+		ps0 = n;
+		ps1 = 1;
+	}
+	if(levels == 0){
+		_strassen(n, a, as0, as1, b, bs0, bs1, product, ps0, ps1, pool);
+	}else{
+		_strassenParallel(m, levels, a, as0, as1, b, bs0, bs1, product, ps0, ps1);
+		_strassenPeel(n, m, a, as0, as1, b, bs0, bs1, product, ps0, ps1);
+	}
+	for(std::size_t i = 0; i < n; i++){
+		for(std::size_t j = 0; j < n; j++){
+			_storeEpilogue(c[i * cs0 + j * cs1], product[i * ps0 + j * ps1], bias, j * biasStride, ep);
+		}
+	}
+	if(separate) pool.release(n * n);
+}
+
+// 2x2 dimension matmul
+template<typename T, typename T2, typename T3>
+void _matmul(Tensor<2, T> x1, Tensor<2, T2> x2, Tensor<2, T3> x3, const Epilogue<T3>& ep){
+	const std::size_t M = x1.dimensions[0];
+	const std::size_t K = x1.dimensions[1];
+	const std::size_t N = x2.dimensions[1];
+	if(x2.dimensions[0] != K) throw std::invalid_argument("Inner matmul dimensions do not match");
+	if(x3.dimensions[0] != M || x3.dimensions[1] != N) throw std::invalid_argument("Output array dimension mismatch");
+	if(M == 0 || N == 0) return;
+	TENSOR_PROFILE_OP(MATMUL, M * N, 2 * M * N * K);
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, N, biasStride);
+
+	if(_useStrassen(M, N, K)){
+		_strassenMatmul(M, x1.data(), x1.dimensionIncrementors[0], x1.dimensionIncrementors[1],
+			x2.data(), x2.dimensionIncrementors[0], x2.dimensionIncrementors[1],
+			x3.data(), x3.dimensionIncrementors[0], x3.dimensionIncrementors[1], bias, biasStride, ep, _strassenParallelLevels(M));
+		return;
+	}
+	const GemmConfig cfg = _gemmConfig<T, T2, T3>(M, N, K, x1.data(), x1.dimensionIncrementors[0], x1.dimensionIncrementors[1],
+		x2.data(), x2.dimensionIncrementors[0], x2.dimensionIncrementors[1], x3.dimensionIncrementors[1] == 1);
+	_gemmBlocked(M, N, K, x1.data(), x1.dimensionIncrementors[0], x1.dimensionIncrementors[1],
+		x2.data(), x2.dimensionIncrementors[0], x2.dimensionIncrementors[1],
+		x3.data(), x3.dimensionIncrementors[0], x3.dimensionIncrementors[1], bias, biasStride, ep, cfg);
+}
+
+// minimum number of multiply-adds a thread gets in the vector kernels
+const std::size_t MATMUL_PARALLEL_GRAIN = 1 << 15;
+
+// dot product of n contiguous elements, split over independent accumulators so the loop vectorizes
+template<typename T3, typename T, typename T2>
+inline T3 _dotContiguous(const T* a, const T2* b, std::size_t n){
+	T3 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	std::size_t k = 0;
+	for(; k + 4 <= n; k += 4){
+		s0 += a[k] * b[k];
+		s1 += a[k + 1] * b[k + 1];
+		s2 += a[k + 2] * b[k + 2];
+		s3 += a[k + 3] * b[k + 3];
+	}
+	for(; k < n; k++){
+		s0 += a[k] * b[k];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
+
+template<typename T3, typename T, typename T2>
+inline T3 _dotStrided(const T* a, std::size_t as, const T2* b, std::size_t bs, std::size_t n){
+	if(as == 1 && bs == 1) return _dotContiguous<T3>(a, b, n);
+	T3 s = 0;
+	for(std::size_t k = 0; k < n; k++){
+		s += a[k * as] * b[k * bs];
+	}
+	return s;
+}
+
+// matrix-vector product x3 = x1 @ x2, GEVM runs through here on a transposed view of the matrix
+template<typename T, typename T2, typename T3>
+void _gemv(Tensor<2, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep){
+	const std::size_t M = x1.dimensions[0];
+	const std::size_t K = x1.dimensions[1];
+	if(x2.dimensions[0] != K) throw std::invalid_argument("Inner matmul dimensions do not match");
+	if(x3.dimensions[0] != M) throw std::invalid_argument("Output array dimension mismatch");
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, M, biasStride);
+	if(M == 0) return;
+	TENSOR_PROFILE_OP(MATMUL, M, 2 * M * K);
+
+	const T* a = x1.data();
+	const T2* v = x2.data();
+	T3* y = x3.data();
+	const std::size_t as0 = x1.dimensionIncrementors[0], as1 = x1.dimensionIncrementors[1];
+	const std::size_t vs = x2.dimensionIncrementors[0], ys = x3.dimensionIncrementors[0];
+	const std::size_t grain = (K == 0 ? M : MATMUL_PARALLEL_GRAIN / K + 1);
+
+	if(as0 == 1 && as1 != 1){
+		// column-major matrix: stream down the contiguous columns with axpy updates
+		parallel_for(0, M, grain, [&](std::size_t i0, std::size_t i1){
+			// accumulators from the thread's workspace, a warm call does not allocate
+			WorkspaceLease<T3> lease(i1 - i0);
+			T3* acc = lease.data();
+			for(std::size_t i = 0; i < i1 - i0; i++) acc[i] = T3(0);
+			for(std::size_t k = 0; k < K; k++){
+				const T* col = a + k * as1 + i0;
+				const T2 vk = v[k * vs];
+				for(std::size_t i = 0; i < i1 - i0; i++){
+					acc[i] += col[i] * vk;
+				}
+			}
+			for(std::size_t i = i0; i < i1; i++){
+				_storeEpilogue(y[i * ys], acc[i - i0], bias, i * biasStride, ep);
+			}
+		});
+	}else{
+		// row-major matrix: one dot product per contiguous row, rows run on the node holding them
+		parallel_for_nodes(M, grain, [&](std::size_t i0, std::size_t i1){
+			for(std::size_t i = i0; i < i1; i++){
+				const T3 acc = _dotStrided<T3>(a + i * as0, as1, v, vs, K);
+				_storeEpilogue(y[i * ys], acc, bias, i * biasStride, ep);
+			}
+		});
+	}
+}
+
+// dot product of two vectors, partial sums are reduced across the thread pool for long vectors
+template<typename T3, typename T, typename T2>
+T3 _dot(Tensor<1, T> x1, Tensor<1, T2> x2){
+	const std::size_t K = x1.dimensions[0];
+	if(x2.dimensions[0] != K) throw std::invalid_argument("Inner matmul dimensions do not match");
+	TENSOR_PROFILE_OP(MATMUL, 1, 2 * K);
+	const T* a = x1.data();
+	const T2* b = x2.data();
+	const std::size_t as = x1.dimensionIncrementors[0], bs = x2.dimensionIncrementors[0];
+	std::size_t chunks = K / MATMUL_PARALLEL_GRAIN;
+	if(chunks > ThreadPool::instance().size()) chunks = ThreadPool::instance().size();
+	if(chunks <= 1) return _dotStrided<T3>(a, as, b, bs, K);
+	const std::size_t chunkSize = (K + chunks - 1) / chunks;
+	WorkspaceLease<T3> lease(chunks);
+	T3* partial = lease.data();
+	for(std::size_t c = 0; c < chunks; c++) partial[c] = T3(0);
+	ThreadPool::instance().run(chunks, [&](std::size_t c){
+		const std::size_t k0 = c * chunkSize;
+		const std::size_t k1 = (k0 + chunkSize < K ? k0 + chunkSize : K);
+		if(k0 < k1) partial[c] = _dotStrided<T3>(a + k0 * as, as, b + k0 * bs, bs, k1 - k0);
+	});
+	T3 s = 0;
+	for(std::size_t c = 0; c < chunks; c++){
+		s += partial[c];
+	}
+	return s;
+}
+
+// outer product x3 = x1 (column) @ x2 (row)
+template<typename T, typename T2, typename T3>
+void _outer(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<2, T3> x3, const Epilogue<T3>& ep){
+	const std::size_t M = x1.dimensions[0];
+	const std::size_t N = x2.dimensions[0];
+	if(x3.dimensions[0] != M || x3.dimensions[1] != N) throw std::invalid_argument("Output array dimension mismatch");
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, N, biasStride);
+	TENSOR_PROFILE_OP(MATMUL, M * N, M * N);
+	const T* a = x1.data();
+	const T2* b = x2.data();
+	T3* c = x3.data();
+	const std::size_t as = x1.dimensionIncrementors[0], bs = x2.dimensionIncrementors[0];
+	const std::size_t cs0 = x3.dimensionIncrementors[0], cs1 = x3.dimensionIncrementors[1];
+	parallel_for_nodes(M, MATMUL_PARALLEL_GRAIN / (N + 1) + 1, [&](std::size_t i0, std::size_t i1){
+		for(std::size_t i = i0; i < i1; i++){
+			const T ai = a[i * as];
+			T3* row = c + i * cs0;
+			for(std::size_t j = 0; j < N; j++){
+				_storeEpilogue(row[j * cs1], T3(ai * b[j * bs]), bias, j * biasStride, ep);
+			}
+		}
+	});
+}
+
+// x3 = epilogue(x1 @ x2). x3 is written in place for the caller, a copy-on-write x3 whose buffer is shared with
+// other tensors throws std::logic_error (all overloads), detach() it before the call.
 template<typename T, int DIMENSION_COUNT, typename T2, int DIMENSION_COUNT2, typename T3, int DIMENSION_COUNT3>
-void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3){
+void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
 	
 	//checking non-broadcasting dimension matches
 	const std::size_t minIDim = (DIMENSION_COUNT<DIMENSION_COUNT2 ? DIMENSION_COUNT : DIMENSION_COUNT2);
 	const std::size_t maxIDim = (DIMENSION_COUNT<DIMENSION_COUNT2 ? DIMENSION_COUNT2 : DIMENSION_COUNT);
 	if(maxIDim != DIMENSION_COUNT3)throw std::invalid_argument("Output array does not match dimensions");
+	// batch axes lead the matrix axes and are aligned from the right
 	for(std::size_t i = 2; i < minIDim; i++){
-		if(x1.dimensions[i]!=x2.dimensions[i])throw std::invalid_argument("Dimensions do not match for non-broadcasting indices");
+		if(x1.dimensions[DIMENSION_COUNT-1-i]!=x2.dimensions[DIMENSION_COUNT2-1-i])throw std::invalid_argument("Dimensions do not match for non-broadcasting indices");
 	}
 	if(DIMENSION_COUNT>DIMENSION_COUNT2){
-		for(std::size_t i = 2; i < DIMENSION_COUNT; i++){
+		for(std::size_t i = 0; i + 2 < DIMENSION_COUNT; i++){
 			if(x1.dimensions[i] != x3.dimensions[i]) throw std::invalid_argument("Output array dimension mismatch");
 		}
 	}else{
-		for(std::size_t i = 2; i < DIMENSION_COUNT2; i++){
+		for(std::size_t i = 0; i + 2 < DIMENSION_COUNT2; i++){
 			if(x2.dimensions[i] != x3.dimensions[i]) throw std::invalid_argument("Output array dimension mismatch");
 		}
 	}
 	
 	//expand all matrices in case 1-dims exist
-	_matmul(x1, x2, x3);
+	_matmul(x1, x2, x3, ep);
 	
 }
 
 template<typename T, typename T2, int DIMENSION_COUNT2, typename T3, int DIMENSION_COUNT3>
-void matmul(Tensor<1, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3){
-	matmul(x1.expand(), x2, x3);
+void matmul(Tensor<1, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1.expand(), x2, x3, ep);
 }
 
 template<typename T, int DIMENSION_COUNT, typename T2, typename T3, int DIMENSION_COUNT3>
-void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<1, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3){
-	matmul(x1, x2.expand(), x3);
+void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<1, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1, x2.expand(), x3, ep);
 }
 
 template<typename T, int DIMENSION_COUNT, typename T2, int DIMENSION_COUNT2, typename T3>
-void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<1, T3> x3){
-	matmul(x1, x2, x3.expand());
+void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1, x2, x3.expand(), ep);
 }
 
 template<typename T, int DIMENSION_COUNT, typename T2, typename T3>
-void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3){
-	matmul(x1, x2.expand(), x3.expand());
+void matmul(Tensor<DIMENSION_COUNT, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1, x2.expand(), x3.expand(), ep);
 }
 
 template<typename T, typename T2, int DIMENSION_COUNT2, typename T3>
-void matmul(Tensor<1, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<1, T3> x3){
-	matmul(x1.expand(), x2, x3.expand());
+void matmul(Tensor<1, T> x1, Tensor<DIMENSION_COUNT2, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1.expand(), x2, x3.expand(), ep);
 }
 
 template<typename T, typename T2, typename T3, int DIMENSION_COUNT3>
-void matmul(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3){
-	matmul(x1.expand(), x2.expand(), x3);
+void matmul(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<DIMENSION_COUNT3, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	matmul(x1.expand(), x2.expand(), x3, ep);
+}
+
+// dot product, x3 holds a single element
+template<typename T, typename T2, typename T3>
+void matmul(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	if(x3.dimensions[0] != 1) throw std::invalid_argument("Output array dimension mismatch");
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, 1, biasStride);
+	_storeEpilogue(x3[{0}], _dot<T3>(x1, x2), bias, 0, ep);
+}
+
+// matrix-vector product
+template<typename T, typename T2, typename T3>
+void matmul(Tensor<2, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	_gemv(x1, x2, x3, ep);
+}
+
+// vector-matrix product
+template<typename T, typename T2, typename T3>
+void matmul(Tensor<1, T> x1, Tensor<2, T2> x2, Tensor<1, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	_gemv(x2.swapaxes(0, 1), x1, x3, ep);
+}
+
+// outer product
+template<typename T, typename T2, typename T3>
+void matmul(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<2, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1, x2);
+	_outer(x1, x2, x3, ep);
 }
 
+// matrix product against frozen weights, the weight handle is read without touching its reference count
 template<typename T, typename T2, typename T3>
-void matmul(Tensor<1, T> x1, Tensor<1, T2> x2, Tensor<1, T3> x3){
-	matmul(x1.expand(), x2.expand(), x3.expand());
+void matmul(Tensor<2, T> x1, const FrozenTensor<2, T2>& w, Tensor<2, T3> x3, const Epilogue<T3>& ep = Epilogue<T3>{}){
+	x3.claimOutput(x1);
+	const std::size_t M = x1.dimensions[0];
+	const std::size_t K = x1.dimensions[1];
+	const std::size_t N = w.dimensions[1];
+	if(w.dimensions[0] != K) throw std::invalid_argument("Inner matmul dimensions do not match");
+	if(x3.dimensions[0] != M || x3.dimensions[1] != N) throw std::invalid_argument("Output array dimension mismatch");
+	if(M == 0 || N == 0) return;
+	TENSOR_PROFILE_OP(MATMUL, M * N, 2 * M * N * K);
+	std::size_t biasStride;
+	const T3* bias = _epilogueBias(ep, N, biasStride);
+	const GemmConfig cfg = _gemmConfig<T, T2, T3>(M, N, K, x1.data(), x1.dimensionIncrementors[0], x1.dimensionIncrementors[1],
+		w.data(), w.dimensionIncrementors[0], w.dimensionIncrementors[1], x3.dimensionIncrementors[1] == 1);
+	_gemmBlocked(M, N, K, x1.data(), x1.dimensionIncrementors[0], x1.dimensionIncrementors[1],
+		w.data(), w.dimensionIncrementors[0], w.dimensionIncrementors[1],
+		x3.data(), x3.dimensionIncrementors[0], x3.dimensionIncrementors[1], bias, biasStride, ep, cfg);
 }
@@ -0,0 +1,274 @@
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+#pragma once
+
+// Live memory accounting of every buffer allocated through Reference. Always compiled in: each allocation and
+// release updates a handful of counters next to the new[]/delete[] it already does, queries are plain atomic loads.
+
+// element types the accounting tells apart
+enum class DType { FLOAT32, FLOAT64, INT8, INT16, INT32, INT64, UINT8, UINT16, UINT32, UINT64, BOOL, OTHER, COUNT };
+
+template <typename T>
+constexpr DType dtypeOf()
+{
+    if (std::is_same<T, bool>::value) return DType::BOOL;
+    if (std::is_floating_point<T>::value) return sizeof(T) == 4 ? DType::FLOAT32 : sizeof(T) == 8 ? DType::FLOAT64 : DType::OTHER;
+    if (!std::is_integral<T>::value) return DType::OTHER;
+    const bool s = std::is_signed<T>::value;
+    switch (sizeof(T)) {
+        case 1: return s ? DType::INT8 : DType::UINT8;
+        case 2: return s ? DType::INT16 : DType::UINT16;
+        case 4: return s ? DType::INT32 : DType::UINT32;
+        case 8: return s ? DType::INT64 : DType::UINT64;
+        default: return DType::OTHER;
+    }
+}
+
+// number of distinct tags, tag 0 is the untagged memory
+const std::size_t MEMORY_MAX_TAGS = 64;
+
+// deepest call stack kept for a large allocation
+const std::size_t MEMORY_STACK_DEPTH = 24;
+
+// a live allocation at or above the capture threshold, with the call stack that made it
+struct LargeAllocation {
+    std::size_t bytes;
+    DType dtype;
+    std::string tag;
+    std::vector<void*> frames;
+
+    // one line per frame, function names where the binary exports them (link with -rdynamic)
+    std::vector<std::string> symbols() const
+    {
+        std::vector<std::string> lines;
+#if defined(__GLIBC__)
+        char** names = backtrace_symbols(frames.data(), static_cast<int>(frames.size()));
+        if (!names) return lines;
+        for (std::size_t i = 0; i < frames.size(); i++) lines.push_back(names[i]);
+        free(names);
+#endif
+        return lines;
+    }
+};
+
+class MemoryTracker {
+public:
+    // called once with the live bytes and the limit when an allocation takes the live size above the soft limit
+    using LimitCallback = std::function<void(std::size_t liveBytes, std::size_t limit)>;
+
+private:
+    struct State {
+        std::atomic<std::size_t> liveBytes {0};
+        std::atomic<std::size_t> peakBytes {0};
+        std::atomic<std::size_t> liveBuffers {0};
+        std::atomic<std::uint64_t> allocations {0};
+        std::atomic<std::size_t> byType[static_cast<int>(DType::COUNT)] {};
+        std::atomic<std::size_t> byTag[MEMORY_MAX_TAGS] {};
+
+        std::mutex tagMutex;
+        std::vector<std::string> tagNames {""};
+
+        std::atomic<std::size_t> softLimit {0};
+        std::atomic<bool> overLimit {false};
+        std::mutex callbackMutex;
+        LimitCallback callback;
+
+        std::atomic<std::size_t> captureThreshold {0};
+        std::mutex largeMutex;
+        std::map<const void*, LargeAllocation> large;
+        // entries in large, read without the lock so releases skip it while nothing was captured
+        std::atomic<std::size_t> largeCount {0};
+    };
+
+    static State& state()
+    {
+        static State s {};
+        return s;
+    }
+
+    static std::size_t& currentTag()
+    {
+        static thread_local std::size_t tag = 0;
+        return tag;
+    }
+
+    friend class MemoryTag;
+
+public:
+    // id of a tag name, registered on first use
+    static std::size_t tagId(const std::string& name)
+    {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.tagMutex);
+        for (std::size_t i = 0; i < s.tagNames.size(); i++) {
+            if (s.tagNames[i] == name) return i;
+        }
+        if (s.tagNames.size() == MEMORY_MAX_TAGS) throw std::length_error("Too many memory tags");
+        s.tagNames.push_back(name);
+        return s.tagNames.size() - 1;
+    }
+
+    // tag allocations of the calling thread are charged to
+    static std::size_t activeTag()
+    {
+        return currentTag();
+    }
+
+    // ---------------------------------------hooks of Reference---------------------------------------
+
+    static void allocated(const void* p, std::size_t bytes, DType dtype, std::size_t tag)
+    {
+        State& s = state();
+        const std::size_t live = s.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        std::size_t peak = s.peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !s.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+        s.liveBuffers.fetch_add(1, std::memory_order_relaxed);
+        s.allocations.fetch_add(1, std::memory_order_relaxed);
+        s.byType[static_cast<int>(dtype)].fetch_add(bytes, std::memory_order_relaxed);
+        s.byTag[tag].fetch_add(bytes, std::memory_order_relaxed);
+
+        const std::size_t threshold = s.captureThreshold.load(std::memory_order_relaxed);
+        if (threshold && bytes >= threshold) {
+            LargeAllocation a {bytes, dtype, tagName(tag), {}};
+#if defined(__GLIBC__)
+            void* frames[MEMORY_STACK_DEPTH];
+            const int depth = backtrace(frames, static_cast<int>(MEMORY_STACK_DEPTH));
+            a.frames.assign(frames, frames + depth);
+#endif
+            std::lock_guard<std::mutex> lock(s.largeMutex);
+            s.large[p] = a;
+            s.largeCount.store(s.large.size(), std::memory_order_relaxed);
+        }
+
+        const std::size_t limit = s.softLimit.load(std::memory_order_relaxed);
+        // only the allocation crossing the limit reports, the next one after the live size fell below it again
+        if (limit && live > limit && !s.overLimit.exchange(true)) {
+            std::lock_guard<std::mutex> lock(s.callbackMutex);
+            if (s.callback) s.callback(live, limit);
+        }
+    }
+
+    static void released(const void* p, std::size_t bytes, DType dtype, std::size_t tag)
+    {
+        State& s = state();
+        const std::size_t live = s.liveBytes.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+        s.liveBuffers.fetch_sub(1, std::memory_order_relaxed);
+        s.byType[static_cast<int>(dtype)].fetch_sub(bytes, std::memory_order_relaxed);
+        s.byTag[tag].fetch_sub(bytes, std::memory_order_relaxed);
+        if (s.largeCount.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(s.largeMutex);
+            s.large.erase(p);
+            s.largeCount.store(s.large.size(), std::memory_order_relaxed);
+        }
+        if (live <= s.softLimit.load(std::memory_order_relaxed)) s.overLimit.store(false, std::memory_order_relaxed);
+    }
+
+    // ------------------------------------query API------------------------------------
+
+    // bytes held by all live buffers
+    static std::size_t liveBytes()
+    {
+        return state().liveBytes.load(std::memory_order_relaxed);
+    }
+
+    static std::size_t liveBytes(DType dtype)
+    {
+        return state().byType[static_cast<int>(dtype)].load(std::memory_order_relaxed);
+    }
+
+    // bytes of the live buffers allocated under the tag
+    static std::size_t liveBytes(const std::string& tag)
+    {
+        return state().byTag[tagId(tag)].load(std::memory_order_relaxed);
+    }
+
+    // highest live size since start or the last resetPeak()
+    static std::size_t peakBytes()
+    {
+        return state().peakBytes.load(std::memory_order_relaxed);
+    }
+
+    static void resetPeak()
+    {
+        state().peakBytes.store(liveBytes(), std::memory_order_relaxed);
+    }
+
+    static std::size_t liveBuffers()
+    {
+        return state().liveBuffers.load(std::memory_order_relaxed);
+    }
+
+    // number of buffers allocated since start
+    static std::uint64_t allocationCount()
+    {
+        return state().allocations.load(std::memory_order_relaxed);
+    }
+
+    static std::string tagName(std::size_t tag)
+    {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.tagMutex);
+        return tag < s.tagNames.size() ? s.tagNames[tag] : std::string();
+    }
+
+    // Calls callback (on the allocating thread) when an allocation takes the live size above bytes. Nothing is
+    // refused, the callback decides what to do. 0 removes the limit.
+    static void setSoftLimit(std::size_t bytes, LimitCallback callback = nullptr)
+    {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.callbackMutex);
+        s.callback = callback;
+        s.overLimit.store(bytes && liveBytes() > bytes);
+        s.softLimit.store(bytes);
+    }
+
+    // Records the call stack of every allocation of at least bytes while it is live, 0 turns capturing off.
+    // Capturing costs a stack walk per large allocation, small ones are not affected.
+    static void captureStacks(std::size_t bytes)
+    {
+        state().captureThreshold.store(bytes);
+    }
+
+    static std::vector<LargeAllocation> largeAllocations()
+    {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.largeMutex);
+        std::vector<LargeAllocation> list;
+        for (const auto& a : s.large) list.push_back(a.second);
+        return list;
+    }
+};
+
+// Charges the allocations the calling thread makes during its lifetime to a tag, scopes nest
+class MemoryTag {
+private:
+    std::size_t previous;
+
+public:
+    MemoryTag(const std::string& name)
+        : previous(MemoryTracker::currentTag())
+    {
+        MemoryTracker::currentTag() = MemoryTracker::tagId(name);
+    }
+
+    MemoryTag(MemoryTag&) = delete;
+
+    ~MemoryTag()
+    {
+        MemoryTracker::currentTag() = previous;
+    }
+};
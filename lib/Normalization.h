@@ -0,0 +1,161 @@
+#include <cmath>
+#include <limits>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "FastMath.h"
+
+#pragma once
+
+// minimum number of elements a thread gets in the row-wise kernels
+const std::size_t NORM_PARALLEL_GRAIN = 1 << 14;
+
+// Runs func(xRow, outRow, rowLength, xStride, outStride) for every row of x along axis, rows are split over the pool.
+// Works on any strided view, x and out may be the same tensor.
+template<int DIMENSION_COUNT, typename T, typename F>
+void _forEachRow(Tensor<DIMENSION_COUNT, T>& x, Tensor<DIMENSION_COUNT, T>& out, std::size_t axis, F func){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(x.dimensions[i] != out.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	const std::size_t length = x.dimensions[axis];
+	std::size_t rows = 1;
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(i != axis) rows *= x.dimensions[i];
+	}
+	if(rows == 0 || length == 0) return;
+	T* xData = x.data();
+	T* outData = out.data();
+	const std::size_t xStride = x.dimensionIncrementors[axis];
+	const std::size_t outStride = out.dimensionIncrementors[axis];
+	parallel_for(0, rows, NORM_PARALLEL_GRAIN / length + 1, [&](std::size_t r0, std::size_t r1){
+		for(std::size_t r = r0; r < r1; r++){
+			// decompose the row index over the remaining axes, last axis fastest
+			std::size_t rest = r, xOffset = 0, outOffset = 0;
+			for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+				if(i == axis) continue;
+				const std::size_t index = rest % x.dimensions[i];
+				rest /= x.dimensions[i];
+				xOffset += index * x.dimensionIncrementors[i];
+				outOffset += index * out.dimensionIncrementors[i];
+			}
+			func(xData + xOffset, outData + outOffset, length, xStride, outStride);
+		}
+	});
+}
+
+// exp through the branch-free kernel where there is one
+template<typename T>
+inline T _softmaxExp(T x){
+	if constexpr(_HAS_FAST_MATH<T>) return _fastExp(x);
+	else return std::exp(x);
+}
+
+// Max of a row, then the sum of exp(x - max) in a second branch-free pass that vectorizes.
+// Returns false for a row that is entirely -inf (fully masked), which has no defined maximum.
+template<typename T>
+inline bool _softmaxStats(const T* x, std::size_t length, std::size_t stride, T& max, T& sum){
+	max = x[0];
+	for(std::size_t i = 1; i < length; i++){
+		const T v = x[i * stride];
+		max = v > max ? v : max;
+	}
+	sum = 0;
+	if(max == -std::numeric_limits<T>::infinity()) return false;
+	for(std::size_t i = 0; i < length; i++){
+		sum += _softmaxExp(x[i * stride] - max);
+	}
+	return true;
+}
+
+// The kernels below write out in place for the caller (out may be x), a copy-on-write out whose buffer is shared
+// with other tensors throws std::logic_error, detach() it first.
+
+// out = softmax(x) along axis, a fully masked row comes out as zeros
+template<int DIMENSION_COUNT, typename T>
+void softmax(Tensor<DIMENSION_COUNT, T> x, Tensor<DIMENSION_COUNT, T> out, std::size_t axis = DIMENSION_COUNT - 1){
+	out.claimOutput(x);
+	_forEachRow(x, out, axis, [](const T* xr, T* outr, std::size_t length, std::size_t xs, std::size_t outs){
+		T max, sum;
+		if(!_softmaxStats(xr, length, xs, max, sum)){
+			for(std::size_t i = 0; i < length; i++){
+				outr[i * outs] = 0;
+			}
+			return;
+		}
+		const T scale = T(1) / sum;
+		for(std::size_t i = 0; i < length; i++){
+			outr[i * outs] = _softmaxExp(xr[i * xs] - max) * scale;
+		}
+	});
+}
+
+// out = log(softmax(x)) along axis, a fully masked row comes out as -inf
+template<int DIMENSION_COUNT, typename T>
+void log_softmax(Tensor<DIMENSION_COUNT, T> x, Tensor<DIMENSION_COUNT, T> out, std::size_t axis = DIMENSION_COUNT - 1){
+	out.claimOutput(x);
+	_forEachRow(x, out, axis, [](const T* xr, T* outr, std::size_t length, std::size_t xs, std::size_t outs){
+		T max, sum;
+		if(!_softmaxStats(xr, length, xs, max, sum)){
+			for(std::size_t i = 0; i < length; i++){
+				outr[i * outs] = -std::numeric_limits<T>::infinity();
+			}
+			return;
+		}
+		const T shift = max + std::log(sum);
+		for(std::size_t i = 0; i < length; i++){
+			outr[i * outs] = xr[i * xs] - shift;
+		}
+	});
+}
+
+// out = (x - mean) / sqrt(var + eps) * gamma + beta along axis, gamma and beta are optional
+template<int DIMENSION_COUNT, typename T>
+void layer_norm(Tensor<DIMENSION_COUNT, T> x, Tensor<DIMENSION_COUNT, T> out, std::size_t axis = DIMENSION_COUNT - 1,
+		Tensor<1, T>* gamma = nullptr, Tensor<1, T>* beta = nullptr, T eps = T(1e-5)){
+	out.claimOutput(x);
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(gamma && gamma->dimensions[0] != x.dimensions[axis]) throw std::invalid_argument("gamma does not match the normalized axis");
+	if(beta && beta->dimensions[0] != x.dimensions[axis]) throw std::invalid_argument("beta does not match the normalized axis");
+	const T* g = gamma ? gamma->data() : nullptr;
+	const T* b = beta ? beta->data() : nullptr;
+	const std::size_t gs = gamma ? gamma->dimensionIncrementors[0] : 0;
+	const std::size_t bs = beta ? beta->dimensionIncrementors[0] : 0;
+	_forEachRow(x, out, axis, [&](const T* xr, T* outr, std::size_t length, std::size_t xs, std::size_t outs){
+		// Welford mean / variance in one pass
+		T mean = 0, m2 = 0;
+		for(std::size_t i = 0; i < length; i++){
+			const T v = xr[i * xs];
+			const T delta = v - mean;
+			mean += delta / T(i + 1);
+			m2 += delta * (v - mean);
+		}
+		const T inv = T(1) / std::sqrt(m2 / T(length) + eps);
+		for(std::size_t i = 0; i < length; i++){
+			T v = (xr[i * xs] - mean) * inv;
+			if(g) v *= g[i * gs];
+			if(b) v += b[i * bs];
+			outr[i * outs] = v;
+		}
+	});
+}
+
+// out = x / sqrt(mean(x^2) + eps) * gamma along axis, gamma is optional
+template<int DIMENSION_COUNT, typename T>
+void rms_norm(Tensor<DIMENSION_COUNT, T> x, Tensor<DIMENSION_COUNT, T> out, std::size_t axis = DIMENSION_COUNT - 1,
+		Tensor<1, T>* gamma = nullptr, T eps = T(1e-6)){
+	out.claimOutput(x);
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(gamma && gamma->dimensions[0] != x.dimensions[axis]) throw std::invalid_argument("gamma does not match the normalized axis");
+	const T* g = gamma ? gamma->data() : nullptr;
+	const std::size_t gs = gamma ? gamma->dimensionIncrementors[0] : 0;
+	_forEachRow(x, out, axis, [&](const T* xr, T* outr, std::size_t length, std::size_t xs, std::size_t outs){
+		T sumSquares = 0;
+		for(std::size_t i = 0; i < length; i++){
+			sumSquares += xr[i * xs] * xr[i * xs];
+		}
+		const T inv = T(1) / std::sqrt(sumSquares / T(length) + eps);
+		for(std::size_t i = 0; i < length; i++){
+			outr[i * outs] = g ? xr[i * xs] * inv * g[i * gs] : xr[i * xs] * inv;
+		}
+	});
+}
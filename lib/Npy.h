@@ -0,0 +1,558 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "Tensor.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// bytes moved per read or write call when element data is streamed through a buffer
+const std::size_t NPY_IO_BLOCK = 1 << 22;
+
+inline bool _nativeLittleEndian(){
+	const std::uint16_t probe = 1;
+	return *reinterpret_cast<const unsigned char*>(&probe) == 1;
+}
+
+// NumPy type string of T in native byte order, e.g. "<f4" or "|u1"
+template<typename T>
+std::string _npyDescr(){
+	static_assert(std::is_arithmetic<T>::value, ".npy files hold arithmetic types only");
+	const char kind = (std::is_same<T, bool>::value ? 'b' : std::is_floating_point<T>::value ? 'f' : std::is_signed<T>::value ? 'i' : 'u');
+	const char order = (sizeof(T) == 1 ? '|' : _nativeLittleEndian() ? '<' : '>');
+	return std::string(1, order) + kind + std::to_string(sizeof(T));
+}
+
+template<typename T>
+void _byteSwap(T* values, std::size_t n){
+	for(std::size_t k = 0; k < n; k++){
+		unsigned char* bytes = reinterpret_cast<unsigned char*>(values + k);
+		std::reverse(bytes, bytes + sizeof(T));
+	}
+}
+
+// Full .npy header (magic, version, length and the padded dict) for an array of the given type and shape.
+// The dict is padded so the element data starts 64-byte aligned, as NumPy does.
+inline std::string _npyHeader(const std::string& descr, bool fortranOrder, const std::size_t* dims, std::size_t rank){
+	std::string shape = "(";
+	for(std::size_t i = 0; i < rank; i++){
+		shape += std::to_string(dims[i]) + (rank == 1 ? "," : i + 1 < rank ? ", " : "");
+	}
+	shape += ")";
+	std::string dict = "{'descr': '" + descr + "', 'fortran_order': " + (fortranOrder ? "True" : "False") + ", 'shape': " + shape + ", }";
+	// version 1.0 stores the dict length in 2 bytes, 2.0 in 4
+	const bool wide = (dict.size() + 1 + 10 > 65535);
+	const std::size_t prefix = (wide ? 12 : 10);
+	dict.append((64 - (prefix + dict.size() + 1) % 64) % 64, ' ');
+	dict += '\n';
+	std::string header = "\x93NUMPY";
+	header += char(wide ? 2 : 1);
+	header += char(0);
+	for(std::size_t b = 0; b < (wide ? 4u : 2u); b++){
+		header += char((dict.size() >> (8 * b)) & 0xFF);
+	}
+	return header + dict;
+}
+
+// type, order and shape of an array stored in .npy format
+struct NpyHeader {
+	std::string descr;
+	bool fortranOrder = false;
+	std::vector<std::size_t> shape;
+
+	std::size_t elementCount() const{
+		std::size_t n = 1;
+		for(std::size_t d: shape){
+			n *= d;
+		}
+		return n;
+	}
+};
+
+// value text following 'key': in a header dict
+inline std::size_t _npyField(const std::string& dict, const std::string& key){
+	const std::size_t at = dict.find("'" + key + "'");
+	if(at == std::string::npos) throw std::runtime_error("npy header has no " + key);
+	const std::size_t colon = dict.find(':', at);
+	if(colon == std::string::npos) throw std::runtime_error("Malformed npy header");
+	return dict.find_first_not_of(' ', colon + 1);
+}
+
+// parses the header at the current position of in, leaving it at the first element
+inline NpyHeader _readNpyHeader(std::istream& in){
+	char magic[8];
+	if(!in.read(magic, 8) || std::memcmp(magic, "\x93NUMPY", 6) != 0) throw std::runtime_error("Not an npy file");
+	const std::size_t lengthBytes = (magic[6] == 1 ? 2 : 4);
+	unsigned char length[4] = {};
+	if(!in.read(reinterpret_cast<char*>(length), std::streamsize(lengthBytes))) throw std::runtime_error("Truncated npy header");
+	std::size_t dictLength = 0;
+	for(std::size_t b = lengthBytes; b-- > 0;){
+		dictLength = (dictLength << 8) | length[b];
+	}
+	std::string dict(dictLength, ' ');
+	if(!in.read(&dict[0], std::streamsize(dictLength))) throw std::runtime_error("Truncated npy header");
+
+	NpyHeader header;
+	std::size_t at = _npyField(dict, "descr");
+	const std::size_t close = dict.find(dict[at], at + 1);
+	if(close == std::string::npos) throw std::runtime_error("Malformed npy header");
+	header.descr = dict.substr(at + 1, close - at - 1);
+	header.fortranOrder = (dict.compare(_npyField(dict, "fortran_order"), 4, "True") == 0);
+	at = _npyField(dict, "shape");
+	const std::size_t end = dict.find(')', at);
+	if(dict[at] != '(' || end == std::string::npos) throw std::runtime_error("Malformed npy header");
+	for(std::size_t i = at + 1; i < end;){
+		i = dict.find_first_of("0123456789", i);
+		if(i >= end) break;
+		std::size_t used;
+		header.shape.push_back(std::stoull(dict.substr(i, end - i), &used));
+		i += used;
+	}
+	return header;
+}
+
+// true if the file's elements can be read into T as they are, swapBytes is set for the opposite byte order
+template<typename T>
+bool _npyMatches(const std::string& descr, bool& swapBytes){
+	const std::string native = _npyDescr<T>();
+	if(descr.size() != native.size() || descr.compare(1, std::string::npos, native, 1, std::string::npos) != 0) return false;
+	const char order = descr[0];
+	swapBytes = (sizeof(T) > 1 && (order == '<' || order == '>') && order != native[0]);
+	return order == '<' || order == '>' || order == '|' || order == '=';
+}
+
+// view of x with its axes in reverse order, the layout a Fortran-order array has in row-major terms
+template<int DIMENSION_COUNT, typename T>
+Tensor<DIMENSION_COUNT, T> _reverseAxes(Tensor<DIMENSION_COUNT, T>& x){
+	Tensor<DIMENSION_COUNT, T> view{x};
+	for(std::size_t i = 0; i < DIMENSION_COUNT / 2; i++){
+		view = view.swapaxes(i, DIMENSION_COUNT - 1 - i);
+	}
+	return view;
+}
+
+template<int DIMENSION_COUNT, typename T>
+bool _isFortranContiguous(Tensor<DIMENSION_COUNT, T>& x){
+	std::size_t expected = 1;
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(x.dimensions[i] != 1 && x.dimensionIncrementors[i] != expected) return false;
+		expected *= x.dimensions[i];
+	}
+	return true;
+}
+
+// Hands the elements of x in row-major order to io(buffer, count) in blocks of up to NPY_IO_BLOCK bytes.
+// Contiguous views are passed through without a copy, strided ones go through a buffer that is gathered from x
+// before each call (gather) or scattered into x after it.
+template<int DIMENSION_COUNT, typename T, typename F>
+void _npyBlocks(Tensor<DIMENSION_COUNT, T>& x, bool gather, F io){
+	const std::size_t n = x.elementCount();
+	const std::size_t block = NPY_IO_BLOCK / sizeof(T);
+	T* p = x.data();
+	if(x.isContiguous()){
+		for(std::size_t b = 0; b < n; b += block){
+			io(p + b, std::min(block, n - b));
+		}
+		return;
+	}
+	// not a vector, which would pack bools
+	std::unique_ptr<T[]> buffer(new T[std::min(block, n)]);
+	std::size_t index[DIMENSION_COUNT] = {};
+	std::size_t at = 0;
+	auto walk = [&](std::size_t m, bool toBuffer){
+		for(std::size_t k = 0; k < m; k++){
+			if(toBuffer) buffer[k] = p[at];
+			else p[at] = buffer[k];
+			for(std::size_t i = DIMENSION_COUNT; i-- > 0;){
+				at += x.dimensionIncrementors[i];
+				if(++index[i] < x.dimensions[i]) break;
+				at -= x.dimensions[i] * x.dimensionIncrementors[i];
+				index[i] = 0;
+			}
+		}
+	};
+	for(std::size_t b = 0; b < n; b += block){
+		const std::size_t m = std::min(block, n - b);
+		if(gather) walk(m, true);
+		io(buffer.get(), m);
+		if(!gather) walk(m, false);
+	}
+}
+
+// Writes x in .npy format through write(bytes, count). A Fortran-contiguous view (e.g. the swapaxes of a
+// row-major matrix) is written with fortran_order set, straight from its storage.
+template<int DIMENSION_COUNT, typename T, typename W>
+void _writeNpy(Tensor<DIMENSION_COUNT, T>& x, W write){
+	const bool fortranOrder = !x.isContiguous() && _isFortranContiguous(x);
+	const std::string header = _npyHeader(_npyDescr<T>(), fortranOrder, x.dimensions, DIMENSION_COUNT);
+	write(header.data(), header.size());
+	Tensor<DIMENSION_COUNT, T> stored = (fortranOrder ? _reverseAxes(x) : x);
+	_npyBlocks(stored, true, [&](const T* values, std::size_t m){
+		write(reinterpret_cast<const char*>(values), m * sizeof(T));
+	});
+}
+
+// bytes _writeNpy produces for x
+template<int DIMENSION_COUNT, typename T>
+std::size_t _npySize(Tensor<DIMENSION_COUNT, T>& x){
+	const bool fortranOrder = !x.isContiguous() && _isFortranContiguous(x);
+	return _npyHeader(_npyDescr<T>(), fortranOrder, x.dimensions, DIMENSION_COUNT).size() + x.elementCount() * sizeof(T);
+}
+
+template<int DIMENSION_COUNT, typename T>
+void save_npy(const std::string& path, Tensor<DIMENSION_COUNT, T>& x){
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if(!out) throw std::runtime_error("Unable to open " + path);
+	_writeNpy(x, [&](const char* bytes, std::size_t count){
+		out.write(bytes, std::streamsize(count));
+	});
+	if(!out) throw std::runtime_error("Failed to write " + path);
+}
+
+// Streaming reader of one .npy array, from a file or an uncompressed .npz entry. The header is parsed on
+// construction, the elements are read straight into preallocated tensors in blocks of NPY_IO_BLOCK bytes.
+class NpyReader {
+PRIVATE:
+	std::string path;
+	std::ifstream file;
+	NpyHeader header;
+	// elements read so far
+	std::size_t position = 0;
+
+	template<int DIMENSION_COUNT, typename T>
+	void check(){
+		if(header.shape.size() != DIMENSION_COUNT) throw std::invalid_argument(path + " holds " + std::to_string(header.shape.size()) + " dimensions");
+		bool swapBytes;
+		if(!_npyMatches<T>(header.descr, swapBytes)) throw std::invalid_argument(path + " holds " + header.descr + ", not " + _npyDescr<T>());
+	}
+
+	// reads x.elementCount() elements in row-major order into x
+	template<int DIMENSION_COUNT, typename T>
+	void readInto(Tensor<DIMENSION_COUNT, T>& x){
+		bool swapBytes;
+		_npyMatches<T>(header.descr, swapBytes);
+		_npyBlocks(x, false, [&](T* values, std::size_t m){
+			if(!file.read(reinterpret_cast<char*>(values), std::streamsize(m * sizeof(T)))) throw std::runtime_error("Unexpected end of " + path);
+			if(swapBytes) _byteSwap(values, m);
+		});
+		position += x.elementCount();
+	}
+
+public:
+	// offset is where the array starts in the file, for entries of an archive
+	NpyReader(const std::string& filePath, std::size_t offset = 0) : path(filePath), file(filePath, std::ios::binary){
+		if(!file) throw std::runtime_error("Unable to open " + path);
+		file.seekg(std::streamoff(offset));
+		header = _readNpyHeader(file);
+	}
+
+	NpyReader(NpyReader&) = delete;
+
+	const NpyHeader& info() const{
+		return header;
+	}
+
+	std::size_t dimension(std::size_t i) const{
+		return header.shape.at(i);
+	}
+
+	// elements not read yet
+	std::size_t remaining() const{
+		return header.elementCount() - position;
+	}
+
+	// Reads the array into a new tensor. Row-major arrays are read into contiguous storage, Fortran-order arrays
+	// into storage of the reversed shape that is returned as a view with the axes swapped back, without reordering.
+	template<int DIMENSION_COUNT, typename T>
+	Tensor<DIMENSION_COUNT, T> load(){
+		check<DIMENSION_COUNT, T>();
+		if(position != 0) throw std::logic_error("Array was already partially read");
+		std::size_t dims[DIMENSION_COUNT];
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			dims[i] = header.shape[header.fortranOrder ? DIMENSION_COUNT - 1 - i : i];
+		}
+		Reference<T> storage(header.elementCount());
+		Tensor<DIMENSION_COUNT, T> stored{dims, storage};
+		readInto(stored);
+		return header.fortranOrder ? _reverseAxes(stored) : stored;
+	}
+
+	// Reads the whole array into x, which has the array's shape and any layout. Fortran-order data is read in
+	// storage order into the reversed-axes view of x.
+	template<int DIMENSION_COUNT, typename T>
+	void read(Tensor<DIMENSION_COUNT, T>& x){
+		check<DIMENSION_COUNT, T>();
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(x.dimensions[i] != header.shape[i]) throw std::invalid_argument("Tensor dimensions don't match");
+		}
+		if(position != 0) throw std::logic_error("Array was already partially read");
+		if(x.isCopyOnWrite()) x.detach();
+		if(header.fortranOrder){
+			Tensor<DIMENSION_COUNT, T> stored = _reverseAxes(x);
+			readInto(stored);
+		}else{
+			readInto(x);
+		}
+	}
+
+	// Reads the next rows along axis 0 of a row-major array into the leading rows of rows, whose other axes
+	// match the array. Returns the number of rows read, 0 at the end.
+	template<int DIMENSION_COUNT, typename T>
+	std::size_t readRows(Tensor<DIMENSION_COUNT, T>& rows){
+		check<DIMENSION_COUNT, T>();
+		if(header.fortranOrder) throw std::logic_error("Fortran-order arrays can't be read by rows");
+		std::size_t rowSize = 1;
+		for(std::size_t i = 1; i < DIMENSION_COUNT; i++){
+			if(rows.dimensions[i] != header.shape[i]) throw std::invalid_argument("Tensor dimensions don't match");
+			rowSize *= header.shape[i];
+		}
+		if(rowSize == 0) return 0;
+		const std::size_t count = std::min(rows.dimensions[0], remaining() / rowSize);
+		if(count == 0) return 0;
+		if(rows.isCopyOnWrite()) rows.detach();
+		Tensor<DIMENSION_COUNT, T> part = rows.narrow(0, 0, count);
+		readInto(part);
+		return count;
+	}
+};
+
+template<int DIMENSION_COUNT, typename T>
+Tensor<DIMENSION_COUNT, T> load_npy(const std::string& path){
+	NpyReader reader{path};
+	return reader.load<DIMENSION_COUNT, T>();
+}
+
+// CRC-32 (IEEE) as used by zip archives, continued from crc
+inline std::uint32_t _crc32(std::uint32_t crc, const char* bytes, std::size_t count){
+	static const auto table = [](){
+		std::vector<std::uint32_t> t(256);
+		for(std::uint32_t n = 0; n < 256; n++){
+			std::uint32_t c = n;
+			for(int k = 0; k < 8; k++){
+				c = (c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1);
+			}
+			t[n] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for(std::size_t i = 0; i < count; i++){
+		crc = table[(crc ^ static_cast<unsigned char>(bytes[i])) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+inline void _putLE(std::string& out, std::uint64_t value, std::size_t bytes){
+	for(std::size_t b = 0; b < bytes; b++){
+		out += char((value >> (8 * b)) & 0xFF);
+	}
+}
+
+inline std::uint64_t _getLE(const unsigned char* in, std::size_t bytes){
+	std::uint64_t value = 0;
+	for(std::size_t b = bytes; b-- > 0;){
+		value = (value << 8) | in[b];
+	}
+	return value;
+}
+
+// Writes an .npz archive (uncompressed zip of .npy entries, as numpy.savez does), one array at a time straight
+// from the tensor. Entries and the archive are limited to 4 GiB, zip64 is not written.
+class NpzWriter {
+PRIVATE:
+	struct Entry {
+		std::string name;
+		std::uint32_t crc;
+		std::uint32_t size;
+		std::uint32_t offset;
+	};
+	std::string path;
+	std::ofstream file;
+	std::vector<Entry> entries;
+	bool closed = false;
+
+	static std::uint32_t limited(std::size_t value){
+		if(value > 0xFFFFFFFFu) throw std::length_error("npz archives over 4 GiB are not supported");
+		return std::uint32_t(value);
+	}
+
+	// local or central header fields shared by both records: version, flags, method, time, date, crc and sizes
+	static void putCommon(std::string& record, const Entry& e){
+		_putLE(record, 20, 2);
+		_putLE(record, 0, 2);
+		_putLE(record, 0, 2);
+		_putLE(record, 0, 2);
+		_putLE(record, 0x21, 2);
+		_putLE(record, e.crc, 4);
+		_putLE(record, e.size, 4);
+		_putLE(record, e.size, 4);
+		_putLE(record, e.name.size(), 2);
+		_putLE(record, 0, 2);
+	}
+
+public:
+	NpzWriter(const std::string& filePath) : path(filePath), file(filePath, std::ios::binary | std::ios::trunc){
+		if(!file) throw std::runtime_error("Unable to open " + path);
+	}
+
+	NpzWriter(NpzWriter&) = delete;
+
+	~NpzWriter(){
+		try{
+			close();
+		}catch(...){
+		}
+	}
+
+	// stores x as name.npy, numpy.load exposes it under name
+	template<int DIMENSION_COUNT, typename T>
+	void add(const std::string& name, Tensor<DIMENSION_COUNT, T>& x){
+		if(closed) throw std::logic_error("Archive is closed");
+		Entry e{name + ".npy", 0, limited(_npySize(x)), limited(std::size_t(file.tellp()))};
+		std::string local;
+		_putLE(local, 0x04034b50, 4);
+		putCommon(local, e);
+		local += e.name;
+		file.write(local.data(), std::streamsize(local.size()));
+		_writeNpy(x, [&](const char* bytes, std::size_t count){
+			e.crc = _crc32(e.crc, bytes, count);
+			file.write(bytes, std::streamsize(count));
+		});
+		// the checksum is only known now, patch it into the local header
+		const std::streamoff end = file.tellp();
+		std::string crc;
+		_putLE(crc, e.crc, 4);
+		file.seekp(std::streamoff(e.offset) + 14);
+		file.write(crc.data(), 4);
+		file.seekp(end);
+		limited(std::size_t(end));
+		if(!file) throw std::runtime_error("Failed to write " + path);
+		entries.push_back(e);
+	}
+
+	// writes the central directory, called by the destructor if not called before
+	void close(){
+		if(closed) return;
+		closed = true;
+		const std::size_t start = std::size_t(file.tellp());
+		std::string directory;
+		for(const Entry& e: entries){
+			_putLE(directory, 0x02014b50, 4);
+			_putLE(directory, 20, 2);
+			putCommon(directory, e);
+			// comment length, disk, internal and external attributes
+			_putLE(directory, 0, 2);
+			_putLE(directory, 0, 2);
+			_putLE(directory, 0, 2);
+			_putLE(directory, 0, 4);
+			_putLE(directory, e.offset, 4);
+			directory += e.name;
+		}
+		_putLE(directory, 0x06054b50, 4);
+		_putLE(directory, 0, 4);
+		_putLE(directory, entries.size(), 2);
+		_putLE(directory, entries.size(), 2);
+		_putLE(directory, directory.size() - 12, 4);
+		_putLE(directory, limited(start), 4);
+		_putLE(directory, 0, 2);
+		file.write(directory.data(), std::streamsize(directory.size()));
+		file.close();
+		if(!file) throw std::runtime_error("Failed to write " + path);
+	}
+};
+
+// Reads the entries of an .npz archive. Only the central directory is read up front, each array is read from
+// its entry on request. Entries must be stored uncompressed (numpy.savez, not savez_compressed).
+class NpzReader {
+PRIVATE:
+	std::string path;
+	// offset of each entry's .npy data, by array name
+	std::map<std::string, std::size_t> entries;
+
+public:
+	NpzReader(const std::string& filePath) : path(filePath){
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if(!file) throw std::runtime_error("Unable to open " + path);
+		const std::size_t size = std::size_t(file.tellg());
+		// the end of central directory record is in the last 22 bytes plus up to 64 KiB of comment
+		const std::size_t tail = std::min<std::size_t>(size, 22 + 65535);
+		std::vector<unsigned char> end(tail);
+		file.seekg(std::streamoff(size - tail));
+		file.read(reinterpret_cast<char*>(end.data()), std::streamsize(tail));
+		std::size_t record = tail;
+		while(record-- > 0){
+			if(record + 22 <= tail && _getLE(&end[record], 4) == 0x06054b50) break;
+		}
+		if(record >= tail) throw std::runtime_error(path + " is not a zip archive");
+		const std::size_t count = _getLE(&end[record + 10], 2);
+		const std::size_t directorySize = _getLE(&end[record + 12], 4);
+		const std::size_t directoryOffset = _getLE(&end[record + 16], 4);
+		if(directoryOffset == 0xFFFFFFFFu) throw std::runtime_error("zip64 archives are not supported");
+		std::vector<unsigned char> directory(directorySize);
+		file.seekg(std::streamoff(directoryOffset));
+		if(!file.read(reinterpret_cast<char*>(directory.data()), std::streamsize(directorySize))) throw std::runtime_error("Truncated archive " + path);
+		for(std::size_t e = 0, at = 0; e < count; e++){
+			if(at + 46 > directorySize || _getLE(&directory[at], 4) != 0x02014b50) throw std::runtime_error("Malformed archive " + path);
+			const std::size_t method = _getLE(&directory[at + 10], 2);
+			const std::size_t nameLength = _getLE(&directory[at + 28], 2);
+			const std::size_t skip = _getLE(&directory[at + 30], 2) + _getLE(&directory[at + 32], 2);
+			const std::size_t local = _getLE(&directory[at + 42], 4);
+			std::string name(reinterpret_cast<const char*>(&directory[at + 46]), nameLength);
+			at += 46 + nameLength + skip;
+			if(name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) name.resize(name.size() - 4);
+			if(method != 0){
+				// kept with an invalid offset so load() can tell the entry exists
+				entries[name] = std::size_t(-1);
+				continue;
+			}
+			unsigned char header[30];
+			file.seekg(std::streamoff(local));
+			if(!file.read(reinterpret_cast<char*>(header), 30)) throw std::runtime_error("Truncated archive " + path);
+			entries[name] = local + 30 + _getLE(header + 26, 2) + _getLE(header + 28, 2);
+		}
+	}
+
+	std::vector<std::string> names() const{
+		std::vector<std::string> list;
+		for(const auto& e: entries){
+			list.push_back(e.first);
+		}
+		return list;
+	}
+
+	bool contains(const std::string& name) const{
+		return entries.count(name) != 0;
+	}
+
+	std::size_t offset(const std::string& name) const{
+		auto e = entries.find(name);
+		if(e == entries.end()) throw std::out_of_range(path + " has no array " + name);
+		if(e->second == std::size_t(-1)) throw std::runtime_error("Compressed npz entries are not supported, save with numpy.savez");
+		return e->second;
+	}
+
+	// streaming reader of the array stored under name
+	NpyReader open(const std::string& name) const{
+		return NpyReader(path, offset(name));
+	}
+
+	template<int DIMENSION_COUNT, typename T>
+	Tensor<DIMENSION_COUNT, T> load(const std::string& name) const{
+		NpyReader reader{path, offset(name)};
+		return reader.load<DIMENSION_COUNT, T>();
+	}
+};
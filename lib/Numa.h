@@ -0,0 +1,234 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstddef>
+#include "Tensor.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// Page placement policies for tensor storage
+enum class NumaPolicy {
+    DEFAULT, // first touch, left to the kernel
+    INTERLEAVE, // pages spread round-robin over all nodes
+    LOCAL, // all pages on one node
+    PARTITIONED // leading axis split into one contiguous range per node
+};
+
+// Machine topology and placement primitives. Topology is read from sysfs and placement goes through the
+// mbind / sched_setaffinity system calls directly, so no libnuma link is needed.
+// On single-node machines (and off Linux) every call is a no-op.
+class Numa {
+PRIVATE:
+    // kernel constants from <numaif.h>
+    static constexpr int MPOL_BIND_ = 2;
+    static constexpr int MPOL_INTERLEAVE_ = 3;
+    static constexpr unsigned MPOL_MF_MOVE_ = 1u << 1;
+
+    // Nodes are numbered densely in the order of their kernel ids, nodeIds maps them back for mbind
+    struct Topology {
+        std::vector<std::size_t> nodeIds;
+        std::vector<std::vector<std::size_t>> nodeCpus;
+        std::vector<std::size_t> cpuNode;
+    };
+
+    // parses sysfs cpu lists such as "0-3,8,10-11"
+    static std::vector<std::size_t> parseList(const std::string& text)
+    {
+        std::vector<std::size_t> out;
+        std::stringstream ss(text);
+        std::string part;
+        while (std::getline(ss, part, ',')) {
+            if (part.empty() || part == "\n") continue;
+            const std::size_t dash = part.find('-');
+            const std::size_t first = std::stoul(part.substr(0, dash));
+            const std::size_t last = (dash == std::string::npos ? first : std::stoul(part.substr(dash + 1)));
+            for (std::size_t i = first; i <= last; i++) out.push_back(i);
+        }
+        return out;
+    }
+
+    static std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path);
+        std::string text;
+        std::getline(in, text);
+        return text;
+    }
+
+    // Builds the topology from the online node list, cpulist(id) reads the cpu list of node id. Only online nodes
+    // with cpus count, so sparse ids ("0,2") and memory-only nodes don't turn into empty nodes.
+    template <typename F>
+    static Topology buildTopology(const std::string& online, F cpulist)
+    {
+        Topology t;
+        for (std::size_t id : parseList(online)) {
+            std::vector<std::size_t> cpus = parseList(cpulist(id));
+            if (cpus.empty()) continue;
+            for (std::size_t cpu : cpus) {
+                if (t.cpuNode.size() <= cpu) t.cpuNode.resize(cpu + 1, 0);
+                t.cpuNode[cpu] = t.nodeIds.size();
+            }
+            t.nodeIds.push_back(id);
+            t.nodeCpus.push_back(cpus);
+        }
+        if (t.nodeCpus.empty()) {
+            t.nodeIds.assign(1, 0);
+            t.nodeCpus.resize(1);
+        }
+        return t;
+    }
+
+    static Topology& topology()
+    {
+        static Topology topo = buildTopology(
+#if defined(__linux__)
+            readFile("/sys/devices/system/node/online"),
+#else
+            std::string(),
+#endif
+            [](std::size_t id) { return readFile("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"); });
+        return topo;
+    }
+
+    static long& pinnedNode()
+    {
+        static thread_local long node = -1;
+        return node;
+    }
+
+    static bool mbind(void* begin, std::size_t bytes, int mode, const std::vector<std::size_t>& nodes)
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        // mbind works on whole pages, so only the pages fully inside the range are placed
+        const std::uintptr_t page = (std::uintptr_t)sysconf(_SC_PAGESIZE);
+        const std::uintptr_t first = ((std::uintptr_t)begin + page - 1) / page * page;
+        const std::uintptr_t last = ((std::uintptr_t)begin + bytes) / page * page;
+        if (last <= first) return false;
+        const std::vector<std::size_t>& ids = topology().nodeIds;
+        std::vector<unsigned long> mask(ids.back() / (8 * sizeof(unsigned long)) + 1, 0);
+        for (std::size_t n : nodes) mask[ids[n] / (8 * sizeof(unsigned long))] |= 1ul << (ids[n] % (8 * sizeof(unsigned long)));
+        return syscall(SYS_mbind, (void*)first, last - first, mode, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, MPOL_MF_MOVE_) == 0;
+#else
+        (void)begin; (void)bytes; (void)mode; (void)nodes;
+        return false;
+#endif
+    }
+
+public:
+    static std::size_t nodeCount()
+    {
+        return topology().nodeCpus.size();
+    }
+
+    static bool enabled()
+    {
+        return nodeCount() > 1;
+    }
+
+    // node the calling thread is pinned to, or the node of the cpu it currently runs on
+    static std::size_t currentNode()
+    {
+        if (pinnedNode() >= 0) return (std::size_t)pinnedNode();
+#if defined(__linux__)
+        const int cpu = sched_getcpu();
+        const Topology& t = topology();
+        if (cpu >= 0 && (std::size_t)cpu < t.cpuNode.size()) return t.cpuNode[cpu];
+#endif
+        return 0;
+    }
+
+    // restricts the calling thread to the cpus of one node
+    static bool pinCurrentThread(std::size_t node)
+    {
+        if (!enabled() || node >= nodeCount()) return false;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (std::size_t cpu : topology().nodeCpus[node]) CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+        pinnedNode() = (long)node;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // [begin, end) of the rows owned by node when rows are partitioned over all nodes
+    static void partitionRows(std::size_t rows, std::size_t node, std::size_t& begin, std::size_t& end)
+    {
+        const std::size_t nodes = nodeCount();
+        begin = rows * node / nodes;
+        end = rows * (node + 1) / nodes;
+    }
+
+    // places the pages of [data, data+bytes), returns false when nothing was moved
+    static bool place(void* data, std::size_t bytes, NumaPolicy policy, std::size_t node = 0)
+    {
+        if (!enabled() || node >= nodeCount()) return false;
+        switch (policy) {
+        case NumaPolicy::INTERLEAVE: {
+            std::vector<std::size_t> all;
+            for (std::size_t n = 0; n < nodeCount(); n++) all.push_back(n);
+            return mbind(data, bytes, MPOL_INTERLEAVE_, all);
+        }
+        case NumaPolicy::LOCAL:
+            return mbind(data, bytes, MPOL_BIND_, { node });
+        case NumaPolicy::PARTITIONED:
+            // without a row structure the range is split evenly by bytes
+            {
+                bool placed = false;
+                for (std::size_t n = 0; n < nodeCount(); n++) {
+                    std::size_t b, e;
+                    partitionRows(bytes, n, b, e);
+                    placed |= mbind((char*)data + b, e - b, MPOL_BIND_, { n });
+                }
+                return placed;
+            }
+        default:
+            return false;
+        }
+    }
+};
+
+// Places the pages spanned by a tensor according to policy. PARTITIONED splits the leading axis like
+// Numa::partitionRows, so parallel_for_nodes over the same rows runs each range on the node holding it.
+// Best called right after allocation, before the storage is first written; already touched pages are migrated.
+template <int N, typename T>
+bool numa_place(Tensor<N, T>& t, NumaPolicy policy, std::size_t node = 0)
+{
+    // an empty tensor spans no pages, and the span arithmetic below would underflow
+    if (!Numa::enabled() || policy == NumaPolicy::DEFAULT || t.elementCount() == 0) return false;
+    std::size_t rowSpan = 1;
+    for (int i = 1; i < N; i++) {
+        rowSpan += (t.dimensions[i] - 1) * t.dimensionIncrementors[i];
+    }
+    const std::size_t rows = t.dimensions[0];
+    const std::size_t rowStride = t.dimensionIncrementors[0];
+    if (policy != NumaPolicy::PARTITIONED) {
+        return Numa::place(t.data(), ((rows - 1) * rowStride + rowSpan) * sizeof(T), policy, node);
+    }
+    bool placed = false;
+    for (std::size_t n = 0; n < Numa::nodeCount(); n++) {
+        std::size_t b, e;
+        Numa::partitionRows(rows, n, b, e);
+        if (e == b) continue;
+        placed |= Numa::place(t.data() + b * rowStride, ((e - b - 1) * rowStride + rowSpan) * sizeof(T), NumaPolicy::LOCAL, n);
+    }
+    return placed;
+}
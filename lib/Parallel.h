@@ -0,0 +1,215 @@
+#include <thread>
+#include <vector>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "Numa.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// Persistent worker pool shared by all kernels of the library.
+// The calling thread takes part in the work; nested or concurrent runs fall back to running serially.
+// On multi-node machines workers are pinned evenly across the NUMA nodes.
+class ThreadPool {
+PRIVATE:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex runMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    // the running job as a non-owning callable: the caller's functor and a trampoline that invokes it
+    void* job = nullptr;
+    void (*call)(void*, std::size_t) = nullptr;
+    std::size_t jobCount = 0;
+    std::atomic<std::size_t> next {0};
+    std::size_t pending = 0;
+    std::size_t generation = 0;
+    bool stopping = false;
+    std::exception_ptr error = nullptr;
+
+    static bool& insideWorker()
+    {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    void work()
+    {
+        std::size_t i;
+        while ((i = next++) < jobCount) {
+            try {
+                call(job, i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+    }
+
+    void workerLoop(std::size_t node)
+    {
+        insideWorker() = true;
+        Numa::pinCurrentThread(node);
+        std::size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+public:
+    ThreadPool(std::size_t threads = std::thread::hardware_concurrency())
+    {
+        for (std::size_t i = 1; i < threads; i++) {
+            const std::size_t node = i * Numa::nodeCount() / threads;
+            workers.emplace_back([this, node] { workerLoop(node); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    // library-wide pool
+    static ThreadPool& instance()
+    {
+        static ThreadPool pool {};
+        return pool;
+    }
+
+    // number of threads taking part in a run, including the caller
+    std::size_t size()
+    {
+        return workers.size() + 1;
+    }
+
+    // Runs func(i) for every i in [0, tasks), returns once all tasks have finished.
+    // func is only referenced for the duration of the run, dispatching does not allocate.
+    template <typename F>
+    void run(std::size_t tasks, F&& func)
+    {
+        using Func = typename std::remove_reference<F>::type;
+        std::unique_lock<std::mutex> exclusive(runMutex, std::defer_lock);
+        if (tasks <= 1 || workers.empty() || insideWorker() || !exclusive.try_lock()) {
+            for (std::size_t i = 0; i < tasks; i++) func(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+            call = [](void* f, std::size_t i) { (*static_cast<Func*>(f))(i); };
+            jobCount = tasks;
+            next = 0;
+            pending = workers.size();
+            error = nullptr;
+            generation++;
+        }
+        wake.notify_all();
+        insideWorker() = true;
+        work();
+        insideWorker() = false;
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return pending == 0; });
+        job = nullptr;
+        call = nullptr;
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Splits [begin, end) into chunks of at least grain items and runs func(chunkBegin, chunkEnd) across the pool
+template <typename F>
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F func)
+{
+    if (end <= begin) return;
+    ThreadPool& pool = ThreadPool::instance();
+    const std::size_t n = end - begin;
+    if (grain == 0) grain = 1;
+    std::size_t chunks = n / grain;
+    if (chunks > pool.size() * 4) chunks = pool.size() * 4;
+    if (chunks <= 1) {
+        func(begin, end);
+        return;
+    }
+    const std::size_t chunkSize = (n + chunks - 1) / chunks;
+    chunks = (n + chunkSize - 1) / chunkSize;
+    pool.run(chunks, [&](std::size_t c) {
+        const std::size_t b = begin + c * chunkSize;
+        const std::size_t e = (b + chunkSize < end ? b + chunkSize : end);
+        func(b, e);
+    });
+}
+
+// Runs func(chunkBegin, chunkEnd) over [0, rows) where the rows are partitioned over the NUMA nodes as in
+// Numa::partitionRows. Each thread first takes chunks of its own node's partition, then helps the others.
+// On a single node this is parallel_for.
+template <typename F>
+void parallel_for_nodes(std::size_t rows, std::size_t grain, F func)
+{
+    const std::size_t nodes = Numa::nodeCount();
+    if (nodes <= 1) {
+        parallel_for(0, rows, grain, func);
+        return;
+    }
+    ThreadPool& pool = ThreadPool::instance();
+    if (grain == 0) grain = 1;
+    // per node claim cursors, on the stack for common node counts so a call does not allocate
+    std::atomic<std::size_t> cursors[16];
+    std::unique_ptr<std::atomic<std::size_t>[]> more(nodes > 16 ? new std::atomic<std::size_t>[nodes] : nullptr);
+    std::atomic<std::size_t>* cursor = (more ? more.get() : cursors);
+    for (std::size_t n = 0; n < nodes; n++) {
+        std::size_t b, e;
+        Numa::partitionRows(rows, n, b, e);
+        cursor[n] = b;
+    }
+    pool.run(pool.size(), [&](std::size_t) {
+        const std::size_t home = Numa::currentNode();
+        for (std::size_t k = 0; k < nodes; k++) {
+            const std::size_t n = (home + k) % nodes;
+            std::size_t b, e;
+            Numa::partitionRows(rows, n, b, e);
+            std::size_t chunk;
+            while ((chunk = cursor[n].fetch_add(grain)) < e) {
+                func(chunk, (chunk + grain < e ? chunk + grain : e));
+            }
+        }
+    });
+}
+
+// Runs func(elementBegin, elementEnd) over the elements of a contiguous tensor with rows leading rows of rowSize
+// elements each. On multi-node machines whole rows are scheduled with parallel_for_nodes, so a PARTITIONED tensor
+// is processed on the nodes holding it; otherwise the elements are split like parallel_for.
+template <typename F>
+void parallel_for_rows(std::size_t rows, std::size_t rowSize, std::size_t grain, F func)
+{
+    if (!Numa::enabled() || rowSize == 0) {
+        parallel_for(0, rows * rowSize, grain, func);
+        return;
+    }
+    parallel_for_nodes(rows, grain / rowSize + 1, [&](std::size_t r0, std::size_t r1) {
+        func(r0 * rowSize, r1 * rowSize);
+    });
+}
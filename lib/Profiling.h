@@ -0,0 +1,230 @@
+#include <cstdint>
+
+#pragma once
+
+// Hot-path instrumentation, compiled in with -DTENSOR_PROFILING.
+// Without the define every hook below expands to nothing, so the library pays exactly zero for it.
+
+#ifdef TENSOR_PROFILING
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <thread>
+#include <functional>
+
+// operations with their own counters
+enum class ProfiledOp { MATMUL, ADD_ASSIGN, SUB_ASSIGN, CLONE, FOREACH, SLICE, COUNT };
+
+// snapshot of the counters of one operation
+struct OpStats {
+    std::uint64_t calls = 0;
+    std::uint64_t elements = 0;
+    std::uint64_t flops = 0;
+    std::uint64_t nanoseconds = 0;
+};
+
+class Profiler {
+public:
+    struct TraceEvent {
+        const char* name;
+        std::uint64_t startNs;
+        std::uint64_t durationNs;
+        std::size_t thread;
+    };
+
+private:
+    struct Counters {
+        std::atomic<std::uint64_t> calls {0};
+        std::atomic<std::uint64_t> elements {0};
+        std::atomic<std::uint64_t> flops {0};
+        std::atomic<std::uint64_t> nanoseconds {0};
+    };
+    struct State {
+        Counters ops[static_cast<int>(ProfiledOp::COUNT)];
+        std::atomic<std::uint64_t> allocations {0};
+        std::atomic<std::uint64_t> allocatedBytes {0};
+        std::atomic<std::uint64_t> refcountOps {0};
+        std::atomic<bool> tracing {false};
+        std::mutex traceMutex;
+        std::vector<TraceEvent> trace;
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    };
+
+    static State& state()
+    {
+        static State s {};
+        return s;
+    }
+
+public:
+    static const char* name(ProfiledOp op)
+    {
+        static const char* names[] = {"matmul", "operator+=", "operator-=", "clone", "foreach", "slice"};
+        return names[static_cast<int>(op)];
+    }
+
+    static std::uint64_t now()
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - state().epoch).count());
+    }
+
+    static void recordOp(ProfiledOp op, std::uint64_t elements, std::uint64_t flops, std::uint64_t nanoseconds)
+    {
+        Counters& c = state().ops[static_cast<int>(op)];
+        c.calls++;
+        c.elements += elements;
+        c.flops += flops;
+        c.nanoseconds += nanoseconds;
+    }
+
+    static void recordAllocation(std::uint64_t bytes)
+    {
+        state().allocations++;
+        state().allocatedBytes += bytes;
+    }
+
+    static void recordRefcount()
+    {
+        state().refcountOps++;
+    }
+
+    static void recordEvent(const char* eventName, std::uint64_t startNs, std::uint64_t durationNs)
+    {
+        if (!state().tracing) return;
+        std::lock_guard<std::mutex> lock(state().traceMutex);
+        state().trace.push_back(TraceEvent {eventName, startNs, durationNs, std::hash<std::thread::id> {}(std::this_thread::get_id())});
+    }
+
+    // ------------------------------------query API------------------------------------
+
+    static OpStats stats(ProfiledOp op)
+    {
+        Counters& c = state().ops[static_cast<int>(op)];
+        OpStats s;
+        s.calls = c.calls;
+        s.elements = c.elements;
+        s.flops = c.flops;
+        s.nanoseconds = c.nanoseconds;
+        return s;
+    }
+
+    static std::uint64_t allocations()
+    {
+        return state().allocations;
+    }
+
+    // bytes allocated through Reference since the last reset (not the live size)
+    static std::uint64_t allocatedBytes()
+    {
+        return state().allocatedBytes;
+    }
+
+    static std::uint64_t refcountOps()
+    {
+        return state().refcountOps;
+    }
+
+    // trace events are only collected while tracing is on
+    static void setTracing(bool enabled)
+    {
+        state().tracing = enabled;
+    }
+
+    static void reset()
+    {
+        for (Counters& c : state().ops) {
+            c.calls = 0;
+            c.elements = 0;
+            c.flops = 0;
+            c.nanoseconds = 0;
+        }
+        state().allocations = 0;
+        state().allocatedBytes = 0;
+        state().refcountOps = 0;
+        std::lock_guard<std::mutex> lock(state().traceMutex);
+        state().trace.clear();
+    }
+
+    // writes s as the contents of a JSON string
+    static void writeJsonString(std::ostream& out, const char* s)
+    {
+        static const char hex[] = "0123456789abcdef";
+        for (; *s; s++) {
+            const unsigned char c = static_cast<unsigned char>(*s);
+            if (c == '"' || c == '\\') {
+                out << '\\' << *s;
+            } else if (c < 0x20) {
+                out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+            } else {
+                out << *s;
+            }
+        }
+    }
+
+    // writes the collected events in the Chrome trace event format (chrome://tracing, Perfetto)
+    static void dumpChromeTrace(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(state().traceMutex);
+        out << "{\"traceEvents\":[";
+        for (std::size_t i = 0; i < state().trace.size(); i++) {
+            const TraceEvent& e = state().trace[i];
+            out << (i ? "," : "") << "{\"name\":\"";
+            writeJsonString(out, e.name);
+            out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+                << ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durationNs / 1000.0 << "}";
+        }
+        out << "]}";
+    }
+};
+
+// Times the enclosing scope. With an op it feeds the op counters, with a plain name it only adds a trace event.
+class ScopedTimer {
+private:
+    const char* label;
+    bool counted;
+    ProfiledOp op = ProfiledOp::COUNT;
+    std::uint64_t elements = 0;
+    std::uint64_t flops = 0;
+    std::uint64_t start;
+
+public:
+    ScopedTimer(ProfiledOp profiledOp, std::uint64_t elementCount, std::uint64_t flopCount)
+        : label(Profiler::name(profiledOp)), counted(true), op(profiledOp), elements(elementCount), flops(flopCount), start(Profiler::now())
+    {
+    }
+
+    ScopedTimer(const char* name)
+        : label(name), counted(false), start(Profiler::now())
+    {
+    }
+
+    ScopedTimer(ScopedTimer&) = delete;
+
+    ~ScopedTimer()
+    {
+        const std::uint64_t duration = Profiler::now() - start;
+        if (counted) Profiler::recordOp(op, elements, flops, duration);
+        Profiler::recordEvent(label, start, duration);
+    }
+};
+
+#define TENSOR_PROFILE_CONCAT_(a, b) a##b
+#define TENSOR_PROFILE_CONCAT(a, b) TENSOR_PROFILE_CONCAT_(a, b)
+#define TENSOR_PROFILE_OP(op, elements, flops) ScopedTimer TENSOR_PROFILE_CONCAT(_tensorProfile, __LINE__)(ProfiledOp::op, (elements), (flops))
+#define TENSOR_PROFILE_SCOPE(name) ScopedTimer TENSOR_PROFILE_CONCAT(_tensorProfile, __LINE__)(name)
+#define TENSOR_PROFILE_ALLOCATION(bytes) Profiler::recordAllocation(bytes)
+#define TENSOR_PROFILE_REFCOUNT() Profiler::recordRefcount()
+
+#else
+
+#define TENSOR_PROFILE_OP(op, elements, flops)
+#define TENSOR_PROFILE_SCOPE(name)
+#define TENSOR_PROFILE_ALLOCATION(bytes)
+#define TENSOR_PROFILE_REFCOUNT()
+
+#endif
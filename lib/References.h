@@ -1,6 +1,10 @@
 
 
 #include <map>
+#include <mutex>
+#include <atomic>
+#include "Profiling.h"
+#include "Memory.h"
 
 #ifdef TESTING
 #define PRIVATE public
@@ -10,32 +14,72 @@
 #define PROTECTED protected
 #endif
 
-// Counts references of void* - non-templated to organize all pointer types in a single static var
+// registry entry of a live buffer: its reference count and what the memory accounting charged for it
+struct BufferRecord {
+    std::atomic<std::size_t> uses {0};
+    std::size_t bytes = 0;
+    DType dtype = DType::OTHER;
+    std::size_t tag = 0;
+
+    // reads as the reference count
+    operator std::size_t() const
+    {
+        return uses.load(std::memory_order_acquire);
+    }
+};
+
+// Counts references of void* - non-templated to organize all pointer types in a single static var.
+// The map is only touched under registryMutex when a buffer is allocated or freed, each Reference keeps a pointer to
+// the (node stable) record of its buffer, so copies and non-final releases never look the map up and are safe to run
+// concurrently from any number of threads. The records hold the byte size, type and tag of every live buffer for
+// MemoryTracker.
 class RefCounter {
 PRIVATE : 
-        static std::map<void*, std::size_t> refCounter;
+        static std::map<void*, BufferRecord> refCounter;
+        static std::mutex registryMutex;
 PROTECTED : 
     template <typename T>
-    T* inc(std::size_t s)
+    T* inc(std::size_t s, BufferRecord*& uses)
     {
         T* arr = new T[s];
-        refCounter[arr] = 1;
+        TENSOR_PROFILE_ALLOCATION(s * sizeof(T));
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            uses = &refCounter[arr];
+        }
+        uses->uses.store(1, std::memory_order_relaxed);
+        uses->bytes = s * sizeof(T);
+        uses->dtype = dtypeOf<T>();
+        uses->tag = MemoryTracker::activeTag();
+        // outside the registry lock, a soft limit callback may allocate
+        MemoryTracker::allocated(arr, uses->bytes, uses->dtype, uses->tag);
         return arr;
     }
-    void inc(void* x)
+    void inc(BufferRecord* uses)
     {
-        refCounter[x]++;
+        TENSOR_PROFILE_REFCOUNT();
+        uses->uses.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::size_t count(BufferRecord* uses)
+    {
+        return uses->uses.load(std::memory_order_acquire);
     }
     template <typename T>
-    void dec(T* x)
+    void dec(T* x, BufferRecord* uses)
     {
-        refCounter[x] -= 1;
-        if (refCounter[x] == 0) {
+        TENSOR_PROFILE_REFCOUNT();
+        if (uses->uses.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            MemoryTracker::released(x, uses->bytes, uses->dtype, uses->tag);
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                refCounter.erase(x);
+            }
             delete[] x;
         }
     }
 };
-std::map<void*, std::size_t> RefCounter::refCounter {};
+std::map<void*, BufferRecord> RefCounter::refCounter {};
+std::mutex RefCounter::registryMutex {};
 
 // Templated wrapper for the RefCounter - handles templated array deletion with reassignment
 template <typename T>
@@ -43,32 +87,58 @@ class Reference : protected RefCounter {
 PRIVATE: 
     T* val;
     std::size_t size;
+    BufferRecord* uses;
 public:
     Reference(const std::size_t s = 1)
     {
         size = s;
-        val = inc<T>(size);
+        val = inc<T>(size, uses);
     }
 
     Reference(Reference& r)
     {
         size = r.size;
-        inc(r.val);
+        inc(r.uses);
         val = r.val;
+        uses = r.uses;
     }
 
     Reference operator=(Reference r)
     {
         size = r.size;
-        dec(val);
-        inc(r.val);
+        dec(val, uses);
+        inc(r.uses);
         val = r.val;
+        uses = r.uses;
         return *this;
     }
 
     ~Reference()
     {
-        dec(val);
+        dec(val, uses);
+    }
+
+    // number of elements in the buffer
+    std::size_t length()
+    {
+        return size;
+    }
+
+    // number of References sharing the buffer
+    std::size_t useCount()
+    {
+        return count(uses);
+    }
+
+    // raw pointer to the start of the buffer, no bounds checking
+    T* data()
+    {
+        return val;
+    }
+
+    const T* data() const
+    {
+        return val;
     }
 
     T& operator[](const std::size_t x)
@@ -77,4 +147,11 @@ public:
             throw std::out_of_range("Index is out of range");
         return val[x];
     }
+
+    const T& operator[](const std::size_t x) const
+    {
+        if (x >= size || x < 0)
+            throw std::out_of_range("Index is out of range");
+        return val[x];
+    }
 };
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include "Tensor.h"
+#include "Parallel.h"
+#include "Indexing.h"
+
+#pragma once
+
+// lines at least this long are also split over the pool when there are too few lines to keep it busy
+const std::size_t SORT_PARALLEL_LENGTH = 1 << 16;
+
+// an element of a line together with its position along the axis
+template<typename T, typename I>
+struct _Ranked {
+	T value;
+	I index;
+};
+
+// x > y with NaN above every number, which keeps the ordering strict weak
+template<typename T>
+inline bool _greaterValue(const T& x, const T& y){
+	if constexpr(std::is_floating_point<T>::value){
+		if(std::isnan(x)) return !std::isnan(y);
+		if(std::isnan(y)) return false;
+	}
+	return x > y;
+}
+
+// a comes before b in a descending (largest) or ascending order, equal values keep their original order
+template<typename T, typename I>
+inline bool _ranksBefore(const _Ranked<T, I>& a, const _Ranked<T, I>& b, bool largest){
+	if(_greaterValue(a.value, b.value)) return largest;
+	if(_greaterValue(b.value, a.value)) return !largest;
+	return a.index < b.index;
+}
+
+// Keeps the best k of in[b..e) (stride apart) in a bounded heap whose top is the worst candidate kept, so most
+// elements of a long line cost one comparison. Returns the candidates best first.
+template<typename T, typename I>
+void _selectTop(const T* in, std::size_t stride, std::size_t b, std::size_t e, std::size_t k, bool largest, std::vector<_Ranked<T, I>>& heap){
+	auto before = [largest](const _Ranked<T, I>& x, const _Ranked<T, I>& y){ return _ranksBefore(x, y, largest); };
+	heap.clear();
+	heap.reserve(k);
+	for(std::size_t i = b; i < e; i++){
+		const _Ranked<T, I> r{in[i * stride], I(i)};
+		if(heap.size() < k){
+			heap.push_back(r);
+			std::push_heap(heap.begin(), heap.end(), before);
+		}else if(k && before(r, heap.front())){
+			std::pop_heap(heap.begin(), heap.end(), before);
+			heap.back() = r;
+			std::push_heap(heap.begin(), heap.end(), before);
+		}
+	}
+	std::sort_heap(heap.begin(), heap.end(), before);
+}
+
+// number of pieces a line of n elements is split into
+inline std::size_t _sortParts(std::size_t n){
+	const std::size_t parts = n / SORT_PARALLEL_LENGTH;
+	const std::size_t threads = ThreadPool::instance().size();
+	return parts < 1 ? 1 : (parts > threads ? threads : parts);
+}
+
+// best k of one line, best first. Long lines are split into parts that select their own best k in parallel,
+// the candidates of all parts are then narrowed down to k.
+template<typename T, typename I>
+void _topkLine(const T* in, std::size_t stride, std::size_t n, std::size_t k, bool largest, std::vector<_Ranked<T, I>>& best){
+	auto before = [largest](const _Ranked<T, I>& x, const _Ranked<T, I>& y){ return _ranksBefore(x, y, largest); };
+	if(k * 4 >= n){
+		// a large share of the line is kept, sorting beats the heap
+		best.resize(n);
+		for(std::size_t i = 0; i < n; i++){
+			best[i] = {in[i * stride], I(i)};
+		}
+		std::partial_sort(best.begin(), best.begin() + k, best.end(), before);
+		best.resize(k);
+		return;
+	}
+	const std::size_t parts = _sortParts(n);
+	if(parts == 1){
+		_selectTop(in, stride, 0, n, k, largest, best);
+		return;
+	}
+	std::vector<std::vector<_Ranked<T, I>>> partial(parts);
+	parallel_for(0, parts, 1, [&](std::size_t p0, std::size_t p1){
+		for(std::size_t p = p0; p < p1; p++){
+			_selectTop(in, stride, n * p / parts, n * (p + 1) / parts, k, largest, partial[p]);
+		}
+	});
+	best.clear();
+	for(auto& part: partial){
+		best.insert(best.end(), part.begin(), part.end());
+	}
+	std::partial_sort(best.begin(), best.begin() + k, best.end(), before);
+	best.resize(k);
+}
+
+// sorts v, splitting long ranges into pieces sorted in parallel and merged pairwise in parallel rounds
+template<typename R, typename C>
+void _parallelSort(std::vector<R>& v, C before){
+	const std::size_t n = v.size();
+	const std::size_t parts = _sortParts(n);
+	if(parts == 1){
+		std::sort(v.begin(), v.end(), before);
+		return;
+	}
+	parallel_for(0, parts, 1, [&](std::size_t p0, std::size_t p1){
+		for(std::size_t p = p0; p < p1; p++){
+			std::sort(v.begin() + n * p / parts, v.begin() + n * (p + 1) / parts, before);
+		}
+	});
+	for(std::size_t width = 1; width < parts; width *= 2){
+		const std::size_t merges = (parts + 2 * width - 1) / (2 * width);
+		parallel_for(0, merges, 1, [&](std::size_t m0, std::size_t m1){
+			for(std::size_t m = m0; m < m1; m++){
+				const std::size_t first = 2 * width * m;
+				const std::size_t middle = std::min(first + width, parts);
+				const std::size_t last = std::min(first + 2 * width, parts);
+				std::inplace_merge(v.begin() + n * first / parts, v.begin() + n * middle / parts, v.begin() + n * last / parts, before);
+			}
+		});
+	}
+}
+
+// values and positions of the k best elements along an axis
+template<int DIMENSION_COUNT, typename T>
+struct TopK {
+	Tensor<DIMENSION_COUNT, T> values;
+	Tensor<DIMENSION_COUNT, std::int64_t> indices;
+};
+
+// Writes the k largest (or smallest) elements of every line of x along axis to values and their positions to
+// indices, best first, ties resolved towards the lower position. values and indices have the shape of x with k
+// entries along axis. Works on strided views, lines run in parallel and long lines are split further.
+template<int DIMENSION_COUNT, typename T, typename I>
+void topk_into(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, std::size_t k, Tensor<DIMENSION_COUNT, T>& values, Tensor<DIMENSION_COUNT, I>& indices, bool largest = true){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(k > x.dimensions[axis]) throw std::invalid_argument("k exceeds the axis length");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		const std::size_t expected = (i == axis ? k : x.dimensions[i]);
+		if(values.dimensions[i] != expected || indices.dimensions[i] != expected) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	if(k == 0) return;
+	if(values.isCopyOnWrite()) values.detach();
+	if(indices.isCopyOnWrite()) indices.detach();
+	const std::size_t* incs[3] = {x.dimensionIncrementors, values.dimensionIncrementors, indices.dimensionIncrementors};
+	const T* in = x.data();
+	T* vo = values.data();
+	I* io = indices.data();
+	const std::size_t n = x.dimensions[axis];
+	_forEachAxisLine<DIMENSION_COUNT>(x.dimensions, axis, incs, [&](const std::size_t (&offsets)[3]){
+		std::vector<_Ranked<T, I>> best;
+		_topkLine(in + offsets[0], incs[0][axis], n, k, largest, best);
+		for(std::size_t j = 0; j < k; j++){
+			vo[offsets[1] + j * incs[1][axis]] = best[j].value;
+			io[offsets[2] + j * incs[2][axis]] = best[j].index;
+		}
+	});
+}
+
+template<int DIMENSION_COUNT, typename T>
+TopK<DIMENSION_COUNT, T> topk(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, std::size_t k, bool largest = true){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	std::size_t dims[DIMENSION_COUNT];
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		dims[i] = (i == axis ? k : x.dimensions[i]);
+	}
+	TopK<DIMENSION_COUNT, T> result{Tensor<DIMENSION_COUNT, T>{dims}, Tensor<DIMENSION_COUNT, std::int64_t>{dims}};
+	topk_into(x, axis, k, result.values, result.indices, largest);
+	return result;
+}
+
+// Sorts every line of x along axis in place, NaNs are placed above every number
+template<int DIMENSION_COUNT, typename T>
+void sort(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, bool descending = false){
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	if(x.isCopyOnWrite()) x.detach();
+	const std::size_t* incs[1] = {x.dimensionIncrementors};
+	T* data = x.data();
+	const std::size_t n = x.dimensions[axis];
+	const std::size_t stride = incs[0][axis];
+	auto before = [descending](const T& a, const T& b){ return descending ? _greaterValue(a, b) : _greaterValue(b, a); };
+	_forEachAxisLine<DIMENSION_COUNT>(x.dimensions, axis, incs, [&](const std::size_t (&offsets)[1]){
+		T* line = data + offsets[0];
+		if(stride == 1 && _sortParts(n) == 1){
+			std::sort(line, line + n, before);
+			return;
+		}
+		// strided or long lines are sorted in a contiguous buffer
+		std::vector<T> buffer(n);
+		for(std::size_t j = 0; j < n; j++){
+			buffer[j] = line[j * stride];
+		}
+		_parallelSort(buffer, before);
+		for(std::size_t j = 0; j < n; j++){
+			line[j * stride] = buffer[j];
+		}
+	});
+}
+
+// Writes the positions that sort every line of x along axis to indices (same shape as x), equal values keep
+// their order. x is not modified.
+template<int DIMENSION_COUNT, typename T, typename I>
+void argsort(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, Tensor<DIMENSION_COUNT, I>& indices, bool descending = false){
+	static_assert(std::is_integral<I>::value, "indices must be integers");
+	if(axis >= DIMENSION_COUNT) throw std::out_of_range("axis out of range");
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(indices.dimensions[i] != x.dimensions[i]) throw std::invalid_argument("Tensor dimensions don't match");
+	}
+	if(indices.isCopyOnWrite()) indices.detach();
+	const std::size_t* incs[2] = {x.dimensionIncrementors, indices.dimensionIncrementors};
+	const T* in = x.data();
+	I* io = indices.data();
+	const std::size_t n = x.dimensions[axis];
+	_forEachAxisLine<DIMENSION_COUNT>(x.dimensions, axis, incs, [&](const std::size_t (&offsets)[2]){
+		std::vector<_Ranked<T, I>> buffer(n);
+		for(std::size_t j = 0; j < n; j++){
+			buffer[j] = {in[offsets[0] + j * incs[0][axis]], I(j)};
+		}
+		_parallelSort(buffer, [descending](const _Ranked<T, I>& a, const _Ranked<T, I>& b){ return _ranksBefore(a, b, descending); });
+		for(std::size_t j = 0; j < n; j++){
+			io[offsets[1] + j * incs[1][axis]] = buffer[j].index;
+		}
+	});
+}
+
+template<int DIMENSION_COUNT, typename T>
+Tensor<DIMENSION_COUNT, std::int64_t> argsort(Tensor<DIMENSION_COUNT, T>& x, std::size_t axis, bool descending = false){
+	Tensor<DIMENSION_COUNT, std::int64_t> indices{x.dimensions};
+	argsort(x, axis, indices, descending);
+	return indices;
+}
@@ -0,0 +1,247 @@
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <future>
+#include <array>
+#include "Tensor.h"
+#include "Matmul.h"
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// Tensor stored in a file as raw row-major elements and processed in chunks of rows along axis 0,
+// only the chunks currently being worked on are held in memory.
+template <int DIMENSION_COUNT, typename T>
+class ChunkedTensor {
+PRIVATE:
+    std::string path;
+    std::size_t dimensions[DIMENSION_COUNT];
+    std::size_t chunkRows;
+    // elements per row of axis 0
+    std::size_t rowSize = 1;
+    std::fstream file;
+    std::mutex fileMutex;
+
+    void seek(std::size_t chunk)
+    {
+        if (chunk >= chunkCount()) throw std::out_of_range("Chunk is out of range");
+        const std::streamoff position = static_cast<std::streamoff>(chunk * chunkRows * rowSize * sizeof(T));
+        file.seekg(position);
+        file.seekp(position);
+    }
+
+public:
+    // opens the store at path, create = true makes a new zero-filled store of the given shape
+    ChunkedTensor(const std::string& filePath, const std::size_t (&list)[DIMENSION_COUNT], std::size_t rowsPerChunk, bool create = false)
+        : path(filePath), chunkRows(rowsPerChunk)
+    {
+        if (chunkRows == 0) throw std::invalid_argument("Chunks need at least one row");
+        for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+            dimensions[i] = list[i];
+            if (i > 0) rowSize *= list[i];
+        }
+        if (create) {
+            std::ofstream init(path, std::ios::binary | std::ios::trunc);
+            const std::size_t bytes = dimensions[0] * rowSize * sizeof(T);
+            if (bytes > 0) {
+                init.seekp(static_cast<std::streamoff>(bytes - 1));
+                init.put(0);
+            }
+        }
+        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file) throw std::runtime_error("Unable to open chunk store " + path);
+    }
+
+    ChunkedTensor(ChunkedTensor&) = delete;
+
+    std::size_t dimension(std::size_t i)
+    {
+        return dimensions[i];
+    }
+
+    std::size_t chunkCount()
+    {
+        return (dimensions[0] + chunkRows - 1) / chunkRows;
+    }
+
+    // rows of axis 0 held by chunk (the last chunk may be short)
+    std::size_t rowsIn(std::size_t chunk)
+    {
+        const std::size_t first = chunk * chunkRows;
+        return (dimensions[0] - first < chunkRows ? dimensions[0] - first : chunkRows);
+    }
+
+    // elements held by chunk
+    std::size_t elementsIn(std::size_t chunk)
+    {
+        return rowsIn(chunk) * rowSize;
+    }
+
+    // rows of axis 0 in a full chunk
+    std::size_t rowsPerChunk()
+    {
+        return chunkRows;
+    }
+
+    // elements in a full chunk, the size of a chunk buffer
+    std::size_t chunkSize()
+    {
+        return chunkRows * rowSize;
+    }
+
+    void read(std::size_t chunk, T* destination)
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        seek(chunk);
+        file.read(reinterpret_cast<char*>(destination), static_cast<std::streamsize>(rowsIn(chunk) * rowSize * sizeof(T)));
+        if (!file) throw std::runtime_error("Failed to read chunk from " + path);
+    }
+
+    void write(std::size_t chunk, const T* source)
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        seek(chunk);
+        file.write(reinterpret_cast<const char*>(source), static_cast<std::streamsize>(rowsIn(chunk) * rowSize * sizeof(T)));
+        if (!file) throw std::runtime_error("Failed to write chunk to " + path);
+    }
+
+    // view of a chunk buffer as a tensor of the chunk's shape
+    Tensor<DIMENSION_COUNT, T> view(std::size_t chunk, Reference<T>& buffer)
+    {
+        std::size_t dims[DIMENSION_COUNT];
+        for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+            dims[i] = dimensions[i];
+        }
+        dims[0] = rowsIn(chunk);
+        return Tensor<DIMENSION_COUNT, T>(dims, buffer);
+    }
+
+    // reads a chunk into a newly allocated tensor
+    Tensor<DIMENSION_COUNT, T> load(std::size_t chunk)
+    {
+        Reference<T> buffer(chunkSize());
+        read(chunk, buffer.data());
+        return view(chunk, buffer);
+    }
+};
+
+// Streaming executor: walks the chunks of equally shaped stores in order, handing func(chunk, buffers) the chunk of
+// every store while the next chunks are read on a background thread. Memory stays bounded at two chunk buffers
+// per store. With writeBack the (possibly modified) chunk of the first store is written back to its file.
+template<int DIMENSION_COUNT, typename T, std::size_t COUNT, typename F>
+void _streamChunks(std::array<ChunkedTensor<DIMENSION_COUNT, T>*, COUNT> stores, bool writeBack, F func){
+	static_assert(COUNT > 0, "Store count has to be greater than 0");
+	for(std::size_t t = 1; t < COUNT; t++){
+		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+			if(stores[t]->dimension(i) != stores[0]->dimension(i)) throw std::invalid_argument("Dimensions don't match");
+		}
+		if(stores[t]->chunkSize() != stores[0]->chunkSize()) throw std::invalid_argument("Stores are chunked differently");
+	}
+	const std::size_t chunks = stores[0]->chunkCount();
+	Reference<T> buffers[2][COUNT];
+	for(std::size_t slot = 0; slot < 2; slot++){
+		for(std::size_t t = 0; t < COUNT; t++){
+			buffers[slot][t] = Reference<T>(stores[t]->chunkSize());
+		}
+	}
+	auto load = [&](std::size_t chunk){
+		for(std::size_t t = 0; t < COUNT; t++){
+			stores[t]->read(chunk, buffers[chunk % 2][t].data());
+		}
+	};
+	if(chunks > 0) load(0);
+	for(std::size_t c = 0; c < chunks; c++){
+		std::future<void> prefetch;
+		if(c + 1 < chunks) prefetch = std::async(std::launch::async, load, c + 1);
+		try{
+			func(c, buffers[c % 2]);
+			if(writeBack) stores[0]->write(c, buffers[c % 2][0].data());
+		}catch(...){
+			if(prefetch.valid()) prefetch.wait();
+			throw;
+		}
+		if(prefetch.valid()) prefetch.get();
+	}
+}
+
+// Runs func element-wise over the stores chunk by chunk, like Tensor::foreach. Only the first store is written back.
+template<int DIMENSION_COUNT, typename T, std::size_t COUNT>
+void stream_foreach(std::array<ChunkedTensor<DIMENSION_COUNT, T>*, COUNT> stores, void(*func)(T*(&values)[COUNT])){
+	_streamChunks(stores, true, [&](std::size_t chunk, Reference<T> (&buffers)[COUNT]){
+		T* base[COUNT];
+		for(std::size_t t = 0; t < COUNT; t++){
+			base[t] = buffers[t].data();
+		}
+		const std::size_t n = stores[0]->elementsIn(chunk);
+		parallel_for(0, n, 1 << 14, [&](std::size_t b, std::size_t e){
+			T* vals[COUNT];
+			for(std::size_t i = b; i < e; i++){
+				for(std::size_t t = 0; t < COUNT; t++){
+					vals[t] = base[t] + i;
+				}
+				func(vals);
+			}
+		});
+	});
+}
+
+// out = func(in) element-wise, the output store is only written
+template<int DIMENSION_COUNT, typename T, typename F>
+void stream_map(ChunkedTensor<DIMENSION_COUNT, T>& in, ChunkedTensor<DIMENSION_COUNT, T>& out, F func){
+	for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
+		if(in.dimension(i) != out.dimension(i)) throw std::invalid_argument("Dimensions don't match");
+	}
+	Reference<T> result(out.chunkSize());
+	std::array<ChunkedTensor<DIMENSION_COUNT, T>*, 1> stores{&in};
+	_streamChunks(stores, false, [&](std::size_t chunk, Reference<T> (&buffers)[1]){
+		const T* x = buffers[0].data();
+		T* y = result.data();
+		parallel_for(0, in.elementsIn(chunk), 1 << 14, [&](std::size_t b, std::size_t e){
+			for(std::size_t i = b; i < e; i++){
+				y[i] = func(x[i]);
+			}
+		});
+		out.write(chunk, y);
+	});
+}
+
+// folds all elements of the store with acc = func(acc, x), chunks are reduced in order
+template<int DIMENSION_COUNT, typename T, typename F>
+T stream_reduce(ChunkedTensor<DIMENSION_COUNT, T>& in, T init, F func){
+	T acc = init;
+	std::array<ChunkedTensor<DIMENSION_COUNT, T>*, 1> stores{&in};
+	_streamChunks(stores, false, [&](std::size_t chunk, Reference<T> (&buffers)[1]){
+		const T* x = buffers[0].data();
+		const std::size_t n = in.elementsIn(chunk);
+		for(std::size_t i = 0; i < n; i++){
+			acc = func(acc, x[i]);
+		}
+	});
+	return acc;
+}
+
+// row-blocked c = epilogue(a @ b) with a and c streamed chunk by chunk and b resident in memory
+template<typename T, typename T2>
+void stream_matmul(ChunkedTensor<2, T>& a, Tensor<2, T2> b, ChunkedTensor<2, T>& c, const Epilogue<T>& ep = Epilogue<T>{}){
+	if(a.dimension(1) != b.dimensions[0]) throw std::invalid_argument("Inner matmul dimensions do not match");
+	if(c.dimension(0) != a.dimension(0) || c.dimension(1) != b.dimensions[1]) throw std::invalid_argument("Output array dimension mismatch");
+	if(c.rowsPerChunk() != a.rowsPerChunk()) throw std::invalid_argument("Stores are chunked differently");
+	// an empty output has nothing to write, an empty inner dimension still writes epilogue(0) like matmul does
+	if(a.dimension(0) == 0 || b.dimensions[1] == 0) return;
+	Reference<T> result(c.chunkSize());
+	std::array<ChunkedTensor<2, T>*, 1> stores{&a};
+	_streamChunks(stores, false, [&](std::size_t chunk, Reference<T> (&buffers)[1]){
+		Tensor<2, T> out = c.view(chunk, result);
+		// with beta the previous contents of c take part in the result
+		if(ep.beta != T(0)) c.read(chunk, result.data());
+		matmul(a.view(chunk, buffers[0]), b, out, ep);
+		c.write(chunk, result.data());
+	});
+}
@@ -1,5 +1,9 @@
 #include <stdexcept>
 #include <array>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
 #include "References.h"
 
 #pragma once
@@ -14,19 +18,28 @@
 
 
 
-template <int DIMENSION_COUNT, typename T>
+template <int DIMENSION_COUNT, typename T, typename INDEX = std::size_t>
 class Tensor {
+    static_assert(std::is_integral<INDEX>::value && std::is_unsigned<INDEX>::value, "INDEX has to be an unsigned integer type");
+    template <int, typename, typename> friend class Tensor;
 PRIVATE: 
 
-    std::size_t dimensions[DIMENSION_COUNT];
-    std::size_t dimensionIncrementors[DIMENSION_COUNT];
-    std::size_t offset = 0;
+    // Shape, strides and offset are stored as INDEX. With a 32-bit INDEX (see CompactTensor) the metadata of a
+    // view shrinks by half, at the price of limiting the underlying buffer to 2^32-1 elements.
+    INDEX dimensions[DIMENSION_COUNT];
+    INDEX dimensionIncrementors[DIMENSION_COUNT];
+    INDEX offset = 0;
+    // writes through the non-const operator[], iterator and +=/-= first detach from shared storage
+    bool copyOnWrite = false;
     Reference<T> values;
 
 public:
     // initializes a Tensor with set dimensions
     Tensor(const std::size_t (&list)[DIMENSION_COUNT]);
 
+    // initializes a contiguous Tensor with set dimensions over existing storage, starting at offset
+    Tensor(const std::size_t (&list)[DIMENSION_COUNT], Reference<T>& storage, std::size_t offset = 0);
+
 	// empty constructor, initializes all dimensions with size 1
     Tensor();
 
@@ -37,20 +50,79 @@ public:
 
     T& operator[](const std::size_t (&list)[DIMENSION_COUNT]);
 
+    // read-only access, never triggers a copy-on-write detach
+    const T& operator[](const std::size_t (&list)[DIMENSION_COUNT]) const;
+
+    // reads an element without triggering a copy-on-write detach
+    T read(const std::size_t (&list)[DIMENSION_COUNT]) const;
+
+    // Opt-in copy-on-write: views and copies of this tensor share its storage until one of them writes through
+    // operator[], the iterator or +=/-=, which then copies the viewed region into storage of its own if the
+    // buffer is still shared. Views taken from a copy-on-write tensor inherit the mode. Reads through read(),
+    // operator[] on a const tensor or the const_iterator (cbegin(), or a range-for over a const reference) never
+    // copy.
+    // Raw data() pointers bypass the check, call detach() before writing through them (the library kernels do).
+    Tensor& setCopyOnWrite(bool enabled = true){
+        copyOnWrite = enabled;
+        return *this;
+    }
+
+    bool isCopyOnWrite(){
+        return copyOnWrite;
+    }
+
+    // gives the view its own contiguous storage if the buffer is shared, copying only the viewed elements
+    void detach();
+
+    // For kernels taking their output by value (matmul, conv1d/conv2d, attention, the normalization kernels): that
+    // parameter is a second handle on the caller's buffer, so the kernel writes through it in place (its
+    // copy-on-write mode is turned off). Part of those kernels' contract: a copy-on-write output sharing its buffer
+    // with tensors other than the caller's and the kernel's inputs throws std::logic_error, since detaching inside
+    // the call would lose the result. The caller has to detach() it first.
+    template <typename... Inputs>
+    void claimOutput(Inputs&... inputs);
+
+    // number of elements in the view
+    std::size_t elementCount(){
+        std::size_t n = 1;
+        for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+            n *= dimensions[i];
+        }
+        return n;
+    }
+
+    // true if the view covers one dense row-major block of its storage
+    bool isContiguous(){
+        std::size_t expected = 1;
+        for (std::size_t i = DIMENSION_COUNT; i-- > 0;) {
+            if (dimensions[i] != 1 && dimensionIncrementors[i] != expected) return false;
+            expected *= dimensions[i];
+        }
+        return true;
+    }
+
+    // pointer to the first element of the view, strides are given by dimensionIncrementors (no bounds checking)
+    T* data(){
+        return values.data() + offset;
+    }
+
     Tensor& operator+=(Tensor t);
     
     template<int O_DIM>
-    Tensor& operator+=(Tensor<O_DIM, T> t);
+    Tensor& operator+=(Tensor<O_DIM, T, INDEX> t);
 
     Tensor& operator-=(Tensor t);
     
     template<int O_DIM>
-    Tensor& operator-=(Tensor<O_DIM, T> t);
+    Tensor& operator-=(Tensor<O_DIM, T, INDEX> t);
+
+    class const_iterator;
 
     class iterator{
+        friend class const_iterator;
     PRIVATE:
         Tensor* parent=nullptr;
-        std::size_t iterators[DIMENSION_COUNT];
+        INDEX iterators[DIMENSION_COUNT];
     public:
         iterator();
         iterator(const std::size_t (&startIterators)[DIMENSION_COUNT], Tensor &parentTensor);
@@ -77,35 +149,108 @@ public:
         bool operator!=(iterator t);
     };
 
+    // iterator for reading, dereferencing never detaches a copy-on-write tensor
+    class const_iterator: public iterator{
+    public:
+        const_iterator(iterator it);
+
+        const T& operator*();
+
+        const_iterator operator++();
+        const_iterator operator++(int);
+    };
+
     //returns the begin iterator of the tensor
     iterator begin();
 
     //returns the end iterator of the tensor
     iterator end();
 
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    const_iterator cbegin() const{
+        return begin();
+    }
+
+    const_iterator cend() const{
+        return end();
+    }
+
     // acquires a slice of the tensor along a dimension
-    Tensor<DIMENSION_COUNT-1, T> slice(std::size_t x, std::size_t dim=0);
+    Tensor<DIMENSION_COUNT-1, T, INDEX> slice(std::size_t x, std::size_t dim=0);
 
 	// expands the tensor by 1 axis, uses the same memory, inserts the axis into dim
-	Tensor<DIMENSION_COUNT+1, T> expand(std::size_t dim=0){
-		Tensor<DIMENSION_COUNT+1, T> expTensor{};
-		expTensor.values=values;
+	Tensor<DIMENSION_COUNT+1, T, INDEX> expand(std::size_t dim=0){
+		std::size_t dims[DIMENSION_COUNT+1], incs[DIMENSION_COUNT+1];
 		std::size_t extra=0;
 		for(std::size_t i = 0; i < DIMENSION_COUNT; i++){
 			if(i==dim){
-				expTensor.dimensionIncrementors[i]=1;
-				expTensor.dimensions[i]=1;
+				incs[i]=1;
+				dims[i]=1;
 				extra=1;
 			}
-			expTensor.dimensionIncrementors[i + extra] = dimensionIncrementors[i];
-			expTensor.dimensions[i + extra] = dimensions[i];
+			incs[i + extra] = dimensionIncrementors[i];
+			dims[i + extra] = dimensions[i];
+		}
+		if(extra==0){
+			incs[DIMENSION_COUNT]=1;
+			dims[DIMENSION_COUNT]=1;
 		}
-		return expTensor;
+		return Tensor<DIMENSION_COUNT+1, T, INDEX>{dims, incs, values, offset, copyOnWrite};
 	}
 
     // swaps 2 axes dim1 and dim2, returns new tensor with swapped dimensions but shared memory
     Tensor swapaxes(const std::size_t dim1, const std::size_t dim2);
 
+    // restricts axis dim to length entries starting at start, returns a view with shared memory
+    Tensor narrow(const std::size_t dim, const std::size_t start, const std::size_t length);
+
+    // true if reshape(dims) can return a view over the same memory, false if it has to copy
+    template <int NEW_COUNT>
+    bool reshapeIsView(const std::size_t (&dims)[NEW_COUNT]);
+
+    // same elements in row-major order with new dimensions, a view with shared memory whenever the
+    // current strides allow it, otherwise a contiguous copy
+    template <int NEW_COUNT>
+    Tensor<NEW_COUNT, T, INDEX> reshape(const std::size_t (&dims)[NEW_COUNT]);
+
+    // merges axes FIRST..LAST (inclusive) into one, with the same view / copy rule as reshape
+    template <int FIRST, int LAST>
+    Tensor<DIMENSION_COUNT - (LAST - FIRST), T, INDEX> flatten();
+
+    // true if flatten<FIRST, LAST>() can return a view over the same memory
+    template <int FIRST, int LAST>
+    bool flattenIsView();
+
+    // the same view with its metadata stored as NEW_INDEX, throws if the storage does not fit that type
+    template <typename NEW_INDEX>
+    Tensor<DIMENSION_COUNT, T, NEW_INDEX> withIndexType();
+
+PRIVATE:
+    // view over existing storage with explicit strides, shares the buffer without allocating
+    Tensor(const std::size_t (&list)[DIMENSION_COUNT], const std::size_t (&incs)[DIMENSION_COUNT], Reference<T>& storage, std::size_t offset, bool copyOnWrite);
+
+    // position of an element in values, with bounds checking
+    template <typename I>
+    std::size_t storageIndex(const I (&list)[DIMENSION_COUNT]) const;
+
+    // v as INDEX, throws if it does not fit
+    static INDEX checkedIndex(std::size_t v){
+        if (v > std::numeric_limits<INDEX>::max()) throw std::length_error("Tensor is too large for its index type");
+        return (INDEX)v;
+    }
+
+    // computes the strides of a view with new dimensions, returns false if the layout does not allow one
+    template <int NEW_COUNT>
+    bool viewIncrementors(const std::size_t (&dims)[NEW_COUNT], std::size_t (&incs)[NEW_COUNT]);
+
+    // dimensions after merging axes FIRST..LAST
+    template <int FIRST, int LAST>
+    void flattenedDimensions(std::size_t (&dims)[DIMENSION_COUNT - (LAST - FIRST)]);
+
+public:
+
     // creates a seperate memory tensor and copies over all items
     Tensor clone();
 
@@ -116,22 +261,27 @@ public:
 
 };
 
+// tensor with 32-bit shape, stride and offset metadata, for buffers of fewer than 2^32 elements
+template <int DIMENSION_COUNT, typename T>
+using CompactTensor = Tensor<DIMENSION_COUNT, T, std::uint32_t>;
+
 
 
 
 // ------------------------------------------Constructors----------------------------------------
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::Tensor(const std::size_t (&list)[DIMENSION_COUNT])
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::Tensor(const std::size_t (&list)[DIMENSION_COUNT])
 {
     static_assert(DIMENSION_COUNT!=0, "Only Non-zero dimensional tensors are supported at this time.");
     std::size_t totalSize = 1;
     // Set up incrementors, dimensions
     for (int i = 0; i < DIMENSION_COUNT; i++) {
-        dimensions[i] = list[i];
-        totalSize *= dimensions[i];
+        dimensions[i] = checkedIndex(list[i]);
+        totalSize *= list[i];
         dimensionIncrementors[i] = 1;
     }
+    checkedIndex(totalSize);
 
     for (int i = 1; i < DIMENSION_COUNT; i++) {
         for (int i2 = 0; i2 < i; i2++) {
@@ -142,19 +292,34 @@ Tensor<DIMENSION_COUNT, T>::Tensor(const std::size_t (&list)[DIMENSION_COUNT])
     values = Reference<T> { totalSize };
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::Tensor(){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::Tensor(const std::size_t (&list)[DIMENSION_COUNT], Reference<T>& storage, std::size_t offset)
+    : values(storage)
+{
+    static_assert(DIMENSION_COUNT!=0, "Only Non-zero dimensional tensors are supported at this time.");
+    std::size_t totalSize = 1;
+    for (int i = DIMENSION_COUNT - 1; i >= 0; i--) {
+        dimensions[i] = checkedIndex(list[i]);
+        dimensionIncrementors[i] = checkedIndex(totalSize);
+        totalSize *= list[i];
+    }
+    if (offset + totalSize > storage.length()) throw std::out_of_range("Storage is too small for the tensor");
+    checkedIndex(offset + totalSize);
+    this->offset = (INDEX)offset;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::Tensor(){
     static_assert(DIMENSION_COUNT!=0, "Only Non-zero dimensional tensors are supported at this time.");
 	for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
         dimensions[i] = 1;
         dimensionIncrementors[i] = 1;
     }
 	offset = 0;
-	values = Reference<T>(1);
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::Tensor(Tensor& t)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::Tensor(Tensor& t) : values(t.values)
 {
     static_assert(DIMENSION_COUNT!=0, "Only Non-zero dimensional tensors are supported at this time.");
 	for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
@@ -162,13 +327,23 @@ Tensor<DIMENSION_COUNT, T>::Tensor(Tensor& t)
         dimensionIncrementors[i] = t.dimensionIncrementors[i];
     }
     offset = t.offset;
-    values = t.values;
+    copyOnWrite = t.copyOnWrite;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::Tensor(const std::size_t (&list)[DIMENSION_COUNT], const std::size_t (&incs)[DIMENSION_COUNT], Reference<T>& storage, std::size_t offset, bool copyOnWrite)
+    : offset(offset), copyOnWrite(copyOnWrite), values(storage)
+{
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        dimensions[i] = list[i];
+        dimensionIncrementors[i] = incs[i];
+    }
 }
 
 // --------------------------------------operators------------------------------------------------------
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T> Tensor<DIMENSION_COUNT, T>::operator=(Tensor<DIMENSION_COUNT, T> t)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::operator=(Tensor<DIMENSION_COUNT, T, INDEX> t)
 {
 
     for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
@@ -177,11 +352,32 @@ Tensor<DIMENSION_COUNT, T> Tensor<DIMENSION_COUNT, T>::operator=(Tensor<DIMENSIO
     }
     offset = t.offset;
     values = t.values;
+    copyOnWrite = t.copyOnWrite;
     return *this;
 }
 
-template <int DIMENSION_COUNT, typename T>
-T& Tensor<DIMENSION_COUNT, T>::operator[](const std::size_t (&list)[DIMENSION_COUNT])
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+T& Tensor<DIMENSION_COUNT, T, INDEX>::operator[](const std::size_t (&list)[DIMENSION_COUNT])
+{
+    if (copyOnWrite) detach();
+    return values[storageIndex(list)];
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+const T& Tensor<DIMENSION_COUNT, T, INDEX>::operator[](const std::size_t (&list)[DIMENSION_COUNT]) const
+{
+    return values[storageIndex(list)];
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+T Tensor<DIMENSION_COUNT, T, INDEX>::read(const std::size_t (&list)[DIMENSION_COUNT]) const
+{
+    return values[storageIndex(list)];
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <typename I>
+std::size_t Tensor<DIMENSION_COUNT, T, INDEX>::storageIndex(const I (&list)[DIMENSION_COUNT]) const
 {
     std::size_t index = offset;
     for (std::size_t  i = 0; i < DIMENSION_COUNT; i++) {
@@ -191,31 +387,63 @@ T& Tensor<DIMENSION_COUNT, T>::operator[](const std::size_t (&list)[DIMENSION_CO
             errmsg += " is out of range";
             throw std::out_of_range(errmsg);
         }
-        index += list[i] * dimensionIncrementors[i];
+        index += (std::size_t)list[i] * dimensionIncrementors[i];
     }
-    return values[index];
+    return index;
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator+=(Tensor t){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+void Tensor<DIMENSION_COUNT, T, INDEX>::detach()
+{
+    if (values.useCount() <= 1) return;
+    Tensor own = clone();
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        dimensionIncrementors[i] = own.dimensionIncrementors[i];
+    }
+    offset = 0;
+    values = own.values;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <typename... Inputs>
+void Tensor<DIMENSION_COUNT, T, INDEX>::claimOutput(Inputs&... inputs)
+{
+    if (!copyOnWrite) return;
+    // the caller's handle, this one and the inputs of the call viewing the same buffer (in-place use)
+    std::size_t handles = 2;
+    ((handles += (static_cast<const void*>(inputs.values.data()) == static_cast<const void*>(values.data()))), ...);
+    if (values.useCount() > handles) throw std::logic_error("Copy-on-write output shares its buffer, detach() it before the call");
+    copyOnWrite = false;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>& Tensor<DIMENSION_COUNT, T, INDEX>::operator+=(Tensor t){
+    TENSOR_PROFILE_OP(ADD_ASSIGN, elementCount(), elementCount());
 
     //check dimensions
     for(int i=0;i<DIMENSION_COUNT;i++){
         if(dimensions[i]!=t.dimensions[i])throw std::invalid_argument("Tensor dimensions don't match");
     }
     
-    auto tIter=t.begin();
+    // t is a by-value handle on the operand, only read: it must not detach (and copy) a copy-on-write operand
+    t.copyOnWrite = false;
+    // detach once up front instead of on every element
+    if(copyOnWrite) detach();
+    const bool mode = copyOnWrite;
+    copyOnWrite = false;
+    auto tIter=t.cbegin();
     for(T& x:*this){
         x+=*tIter;
         tIter++;
     }
+    copyOnWrite = mode;
 
     return *this;
 } 
 
-template <int DIMENSION_COUNT, typename T>
+template <int DIMENSION_COUNT, typename T, typename INDEX>
 template <int O_DIM>
-Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator+=(Tensor<O_DIM, T> t)
+Tensor<DIMENSION_COUNT, T, INDEX>& Tensor<DIMENSION_COUNT, T, INDEX>::operator+=(Tensor<O_DIM, T, INDEX> t)
 {
 
     //check dimensions
@@ -223,34 +451,46 @@ Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator+=(Tensor<O_DIM,
     
     const int DIM_DIFF = DIMENSION_COUNT - O_DIM;
 
+    // the slices share this storage, so detach here and let them write in place
+    if(copyOnWrite) detach();
     for(std::size_t i=0;i<dimensions[0];i++){
-        this->slice(i)+=t;
+        Tensor<DIMENSION_COUNT-1, T, INDEX> row = this->slice(i);
+        row.copyOnWrite = false;
+        row+=t;
     }
     
     
     return *this;
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator-=(Tensor t){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>& Tensor<DIMENSION_COUNT, T, INDEX>::operator-=(Tensor t){
+    TENSOR_PROFILE_OP(SUB_ASSIGN, elementCount(), elementCount());
 
     //check dimensions
     for(int i=0;i<DIMENSION_COUNT;i++){
         if(dimensions[i]!=t.dimensions[i])throw std::invalid_argument("Tensor dimensions don't match");
     }
     
-    auto tIter=t.begin();
+    // t is a by-value handle on the operand, only read: it must not detach (and copy) a copy-on-write operand
+    t.copyOnWrite = false;
+    // detach once up front instead of on every element
+    if(copyOnWrite) detach();
+    const bool mode = copyOnWrite;
+    copyOnWrite = false;
+    auto tIter=t.cbegin();
     for(T& x:*this){
         x-=*tIter;
         tIter++;
     }
+    copyOnWrite = mode;
 
     return *this;
 } 
 
-template <int DIMENSION_COUNT, typename T>
+template <int DIMENSION_COUNT, typename T, typename INDEX>
 template <int O_DIM>
-Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator-=(Tensor<O_DIM, T> t)
+Tensor<DIMENSION_COUNT, T, INDEX>& Tensor<DIMENSION_COUNT, T, INDEX>::operator-=(Tensor<O_DIM, T, INDEX> t)
 {
 
     //check dimensions
@@ -258,8 +498,12 @@ Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator-=(Tensor<O_DIM,
     
     const int DIM_DIFF = DIMENSION_COUNT - O_DIM;
 
+    // the slices share this storage, so detach here and let them write in place
+    if(copyOnWrite) detach();
     for(std::size_t i=0;i<dimensions[0];i++){
-        this->slice(i)-=t;
+        Tensor<DIMENSION_COUNT-1, T, INDEX> row = this->slice(i);
+        row.copyOnWrite = false;
+        row-=t;
     }
     
     
@@ -271,8 +515,8 @@ Tensor<DIMENSION_COUNT, T>& Tensor<DIMENSION_COUNT, T>::operator-=(Tensor<O_DIM,
 // ------------------------------------iterator methods------------------------------------
 
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::begin()
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::begin()
 {
     std::size_t it[DIMENSION_COUNT];
     for(int i=0;i<DIMENSION_COUNT;i++){
@@ -281,8 +525,8 @@ typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::begin(
     return iterator(it, *this);
 }
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::end()
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::end()
 {
     std::size_t it[DIMENSION_COUNT];
     for(int i=0;i<DIMENSION_COUNT-1;i++){
@@ -292,27 +536,39 @@ typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::end()
     return iterator(it, *this);
 }
 
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator Tensor<DIMENSION_COUNT, T, INDEX>::begin() const
+{
+    // the const_iterator only reads through parent
+    return const_cast<Tensor*>(this)->begin();
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator Tensor<DIMENSION_COUNT, T, INDEX>::end() const
+{
+    return const_cast<Tensor*>(this)->end();
+}
+
 // ----------------------------------Tensor manipulators-------------------------------------
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT-1, T> Tensor<DIMENSION_COUNT, T>::slice(std::size_t x, std::size_t dim)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT-1, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::slice(std::size_t x, std::size_t dim)
 {
     static_assert(DIMENSION_COUNT!=1, "Unable to slice one dimensional tensors");
-    Tensor<DIMENSION_COUNT-1, T> s{};
-    s.values=values;
-    s.offset=offset+dimensionIncrementors[dim]*x;
+    TENSOR_PROFILE_OP(SLICE, 0, 0);
+    std::size_t dims[DIMENSION_COUNT-1], incs[DIMENSION_COUNT-1];
     std::size_t ni=0;
     for(std::size_t i=0;i<DIMENSION_COUNT;i++){
         if(i==dim)continue;
-        s.dimensions[ni]=dimensions[i];
-        s.dimensionIncrementors[ni]=dimensionIncrementors[i];
+        dims[ni]=dimensions[i];
+        incs[ni]=dimensionIncrementors[i];
         ni++;
     }
-    return s;
+    return Tensor<DIMENSION_COUNT-1, T, INDEX>{dims, incs, values, offset+dimensionIncrementors[dim]*x, copyOnWrite};
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T> Tensor<DIMENSION_COUNT, T>::swapaxes(const std::size_t dim1, const std::size_t dim2)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::swapaxes(const std::size_t dim1, const std::size_t dim2)
 {
     if(dim1 >= DIMENSION_COUNT) throw std::out_of_range("dim1 out of range");
     if(dim2 >= DIMENSION_COUNT) throw std::out_of_range("dim2 out of range");
@@ -331,21 +587,164 @@ Tensor<DIMENSION_COUNT, T> Tensor<DIMENSION_COUNT, T>::swapaxes(const std::size_
     return cpy;
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T> Tensor<DIMENSION_COUNT, T>::clone()
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::narrow(const std::size_t dim, const std::size_t start, const std::size_t length)
 {
-    Tensor cpy{dimensions};
-    iterator newIter=cpy.begin();
-    for(T& val: *this){
-        *newIter = val;
-        newIter++;
+    if(dim >= DIMENSION_COUNT) throw std::out_of_range("dim out of range");
+    if(start + length > dimensions[dim]) throw std::out_of_range("Range exceeds the dimension");
+    TENSOR_PROFILE_OP(SLICE, 0, 0);
+    Tensor cpy{*this};
+    cpy.offset += start * dimensionIncrementors[dim];
+    cpy.dimensions[dim] = length;
+    return cpy;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int NEW_COUNT>
+bool Tensor<DIMENSION_COUNT, T, INDEX>::viewIncrementors(const std::size_t (&dims)[NEW_COUNT], std::size_t (&incs)[NEW_COUNT])
+{
+    std::size_t newTotal = 1;
+    for (std::size_t i = 0; i < NEW_COUNT; i++) {
+        newTotal *= dims[i];
+        incs[i] = 1;
+    }
+    if (newTotal != elementCount()) throw std::invalid_argument("Reshape has to keep the element count");
+    if (newTotal == 0) return true;
+    // axes of size 1 carry no layout information
+    std::size_t oldDims[DIMENSION_COUNT];
+    std::size_t oldIncs[DIMENSION_COUNT];
+    std::size_t oldCount = 0;
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        if (dimensions[i] == 1) continue;
+        oldDims[oldCount] = dimensions[i];
+        oldIncs[oldCount] = dimensionIncrementors[i];
+        oldCount++;
+    }
+    // match runs of old and new axes with equal products, each old run has to be one strided block
+    std::size_t oi = 0, oj = 1, ni = 0, nj = 1;
+    while (ni < NEW_COUNT && oi < oldCount) {
+        std::size_t np = dims[ni];
+        std::size_t op = oldDims[oi];
+        while (np != op) {
+            if (np < op) {
+                np *= dims[nj++];
+            } else {
+                op *= oldDims[oj++];
+            }
+        }
+        for (std::size_t k = oi; k + 1 < oj; k++) {
+            if (oldIncs[k] != oldDims[k + 1] * oldIncs[k + 1]) return false;
+        }
+        incs[nj - 1] = oldIncs[oj - 1];
+        for (std::size_t k = nj - 1; k > ni; k--) {
+            incs[k - 1] = incs[k] * dims[k];
+        }
+        ni = nj++;
+        oi = oj++;
+    }
+    return true;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int NEW_COUNT>
+bool Tensor<DIMENSION_COUNT, T, INDEX>::reshapeIsView(const std::size_t (&dims)[NEW_COUNT])
+{
+    std::size_t incs[NEW_COUNT];
+    return viewIncrementors(dims, incs);
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int NEW_COUNT>
+Tensor<NEW_COUNT, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::reshape(const std::size_t (&dims)[NEW_COUNT])
+{
+    static_assert(NEW_COUNT != 0, "Only Non-zero dimensional tensors are supported at this time.");
+    std::size_t incs[NEW_COUNT];
+    if (!viewIncrementors(dims, incs)) {
+        Tensor contiguous = clone();
+        contiguous.copyOnWrite = copyOnWrite;
+        return contiguous.reshape(dims);
+    }
+    return Tensor<NEW_COUNT, T, INDEX>{dims, incs, values, offset, copyOnWrite};
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int FIRST, int LAST>
+void Tensor<DIMENSION_COUNT, T, INDEX>::flattenedDimensions(std::size_t (&dims)[DIMENSION_COUNT - (LAST - FIRST)])
+{
+    static_assert(0 <= FIRST && FIRST <= LAST && LAST < DIMENSION_COUNT, "Flattened axes out of range");
+    std::size_t ni = 0;
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        if (i > (std::size_t)FIRST && i <= (std::size_t)LAST) {
+            dims[ni - 1] *= dimensions[i];
+        } else {
+            dims[ni++] = dimensions[i];
+        }
+    }
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int FIRST, int LAST>
+bool Tensor<DIMENSION_COUNT, T, INDEX>::flattenIsView()
+{
+    std::size_t dims[DIMENSION_COUNT - (LAST - FIRST)];
+    flattenedDimensions<FIRST, LAST>(dims);
+    return reshapeIsView(dims);
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <int FIRST, int LAST>
+Tensor<DIMENSION_COUNT - (LAST - FIRST), T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::flatten()
+{
+    std::size_t dims[DIMENSION_COUNT - (LAST - FIRST)];
+    flattenedDimensions<FIRST, LAST>(dims);
+    return reshape(dims);
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+template <typename NEW_INDEX>
+Tensor<DIMENSION_COUNT, T, NEW_INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::withIndexType()
+{
+    // every view of a buffer fits the index type the whole buffer fits
+    if (values.length() > std::numeric_limits<NEW_INDEX>::max()) throw std::length_error("Tensor is too large for its index type");
+    std::size_t dims[DIMENSION_COUNT], incs[DIMENSION_COUNT];
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        dims[i] = dimensions[i];
+        incs[i] = dimensionIncrementors[i];
+    }
+    return Tensor<DIMENSION_COUNT, T, NEW_INDEX>{dims, incs, values, offset, copyOnWrite};
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX> Tensor<DIMENSION_COUNT, T, INDEX>::clone()
+{
+    TENSOR_PROFILE_OP(CLONE, elementCount(), 0);
+    std::size_t dims[DIMENSION_COUNT];
+    for (std::size_t i = 0; i < DIMENSION_COUNT; i++) {
+        dims[i] = dimensions[i];
+    }
+    Tensor cpy{dims};
+    // reads go to the storage directly, so cloning neither detaches a copy-on-write source nor writes to this
+    // tensor at all, and any number of threads can clone the same shared tensor at once
+    const std::size_t n = elementCount();
+    T* dst = cpy.data();
+    const T* src = values.data();
+    std::size_t index[DIMENSION_COUNT] = {};
+    std::size_t at = offset;
+    for (std::size_t k = 0; k < n; k++) {
+        dst[k] = src[at];
+        for (std::size_t i = DIMENSION_COUNT; i-- > 0;) {
+            at += dimensionIncrementors[i];
+            if (++index[i] < dimensions[i]) break;
+            at -= dimensions[i] * dimensionIncrementors[i];
+            index[i] = 0;
+        }
     }
     return cpy;
 }
 
-template <int DIMENSION_COUNT, typename T>
+template <int DIMENSION_COUNT, typename T, typename INDEX>
 template <int T_COUNT>
-void Tensor<DIMENSION_COUNT, T>::foreach( std::array<Tensor<DIMENSION_COUNT, T>, T_COUNT> tensors, //Tensor* (tensors)[T_COUNT], /*std::initializer_list<Tensor<DIMENSION_COUNT, T>>,*/
+void Tensor<DIMENSION_COUNT, T, INDEX>::foreach( std::array<Tensor<DIMENSION_COUNT, T, INDEX>, T_COUNT> tensors, //Tensor* (tensors)[T_COUNT], /*std::initializer_list<Tensor<DIMENSION_COUNT, T>>,*/
 		void(*func)(T*(&values)[T_COUNT])){
 			Tensor ts[T_COUNT];
 			//auto iter=tens.begin();
@@ -354,6 +753,7 @@ void Tensor<DIMENSION_COUNT, T>::foreach( std::array<Tensor<DIMENSION_COUNT, T>,
 				//iter++;
 			}
 			static_assert(T_COUNT > 0, "Tensor count has to be greater than 0");
+			TENSOR_PROFILE_OP(FOREACH, ts[0].elementCount(), ts[0].elementCount());
 			//check if all sizes match
 			for(std::size_t x=0;x<DIMENSION_COUNT;x++){
 				std::size_t zeroSize=ts[0].dimensions[x];
@@ -383,14 +783,14 @@ void Tensor<DIMENSION_COUNT, T>::foreach( std::array<Tensor<DIMENSION_COUNT, T>,
 
 // ----------------constructors----------------------
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::iterator::iterator()
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::iterator::iterator()
 {
 
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::iterator::iterator(const std::size_t (&startIterators)[DIMENSION_COUNT], Tensor<DIMENSION_COUNT, T> &parentTensor): parent(&parentTensor)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::iterator::iterator(const std::size_t (&startIterators)[DIMENSION_COUNT], Tensor<DIMENSION_COUNT, T, INDEX> &parentTensor): parent(&parentTensor)
 {
     static_assert(DIMENSION_COUNT>0, "0-dimensional tensors are not supported.");
     //iterator bounds check (end iterator needs an extra if statement)
@@ -409,8 +809,8 @@ Tensor<DIMENSION_COUNT, T>::iterator::iterator(const std::size_t (&startIterator
     }
 }
 
-template <int DIMENSION_COUNT, typename T>
-Tensor<DIMENSION_COUNT, T>::iterator::iterator(iterator& it): parent(it.parent)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::iterator::iterator(iterator& it): parent(it.parent)
 {
     for(int i=0;i<DIMENSION_COUNT;i++){
         iterators[i]=it.iterators[i];
@@ -419,8 +819,8 @@ Tensor<DIMENSION_COUNT, T>::iterator::iterator(iterator& it): parent(it.parent)
 
 // -----------------------------------------operators---------------------------------------
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator& Tensor<DIMENSION_COUNT, T>::iterator::operator=(iterator iter)
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator& Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator=(iterator iter)
 {
     parent=iter.parent;
     for(int i=0;i<DIMENSION_COUNT;i++){
@@ -429,17 +829,18 @@ typename Tensor<DIMENSION_COUNT, T>::iterator& Tensor<DIMENSION_COUNT, T>::itera
     return *this;
 }
 
-template <int DIMENSION_COUNT, typename T>
-T& Tensor<DIMENSION_COUNT, T>::iterator::operator*()
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+T& Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator*()
 {
     for(int i=0;i<DIMENSION_COUNT;i++){
         if(iterators[i]>=parent->dimensions[i])throw std::out_of_range("Iterator is attempting to access an invalid location");
     }
-    return (*parent)[iterators];
+    if(parent->copyOnWrite) parent->detach();
+    return parent->values[parent->storageIndex(iterators)];
 }
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterator::operator++(){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator++(){
     iterators[0]++;
 
     for(int i=0;i<DIMENSION_COUNT-1;i++){
@@ -460,15 +861,15 @@ typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterat
     return *this;
 }
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterator::operator++(int){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator++(int){
     iterator copy{*this};
     ++(*this);
     return copy;
 }
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterator::operator--(){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator--(){
     bool carry = true;
     for(int i=0; i<DIMENSION_COUNT;i++){
         if(iterators[i]!=0){
@@ -485,16 +886,16 @@ typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterat
     return *this;
 }
 
-template <int DIMENSION_COUNT, typename T>
-typename Tensor<DIMENSION_COUNT, T>::iterator Tensor<DIMENSION_COUNT, T>::iterator::operator--(int){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::iterator Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator--(int){
     iterator copy{*this};
     --(*this);
     return copy;
 }
 
 
-template <int DIMENSION_COUNT, typename T>
-bool Tensor<DIMENSION_COUNT, T>::iterator::operator==(iterator t){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+bool Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator==(iterator t){
     bool eq=true;
     // same origin
     eq = eq && t.parent->values.val==parent->values.val;
@@ -509,7 +910,38 @@ bool Tensor<DIMENSION_COUNT, T>::iterator::operator==(iterator t){
     return eq;
 }
 
-template <int DIMENSION_COUNT, typename T>
-bool Tensor<DIMENSION_COUNT, T>::iterator::operator!=(iterator t){
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+bool Tensor<DIMENSION_COUNT, T, INDEX>::iterator::operator!=(iterator t){
     return !(*this==t);
 }
+
+// --------------------------Tensor const_iterator-----------------------------
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator::const_iterator(iterator it): iterator(it)
+{
+
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+const T& Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator::operator*()
+{
+    for(int i=0;i<DIMENSION_COUNT;i++){
+        if(this->iterators[i]>=this->parent->dimensions[i])throw std::out_of_range("Iterator is attempting to access an invalid location");
+    }
+    const Tensor& parent = *this->parent;
+    return parent.values[parent.storageIndex(this->iterators)];
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator::operator++(){
+    iterator::operator++();
+    return *this;
+}
+
+template <int DIMENSION_COUNT, typename T, typename INDEX>
+typename Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator Tensor<DIMENSION_COUNT, T, INDEX>::const_iterator::operator++(int){
+    const_iterator copy{*this};
+    iterator::operator++();
+    return copy;
+}
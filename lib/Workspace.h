@@ -0,0 +1,92 @@
+#include <vector>
+#include <stdexcept>
+
+#pragma once
+
+#ifdef TESTING
+#define PRIVATE public
+#define PROTECTED public
+#else
+#define PRIVATE private
+#define PROTECTED protected
+#endif
+
+// Per-thread scratch memory for kernels that need temporaries.
+// Buffers are handed out stack-wise (release in reverse order of acquire) and the memory is kept between calls,
+// so a warm pool does not allocate.
+template <typename T>
+class WorkspacePool {
+PRIVATE:
+    std::vector<T> buffer;
+    std::size_t top = 0;
+
+public:
+    // pool of the calling thread
+    static WorkspacePool& local()
+    {
+        static thread_local WorkspacePool pool {};
+        return pool;
+    }
+
+    // makes sure n more elements can be acquired without moving the buffers handed out so far
+    void reserve(std::size_t n)
+    {
+        if (top + n <= buffer.size()) return;
+        if (top != 0) throw std::logic_error("Workspace cannot grow while buffers are in use");
+        buffer.resize(n);
+    }
+
+    T* acquire(std::size_t n)
+    {
+        reserve(n);
+        T* p = buffer.data() + top;
+        top += n;
+        return p;
+    }
+
+    void release(std::size_t n)
+    {
+        if (n > top) throw std::logic_error("Workspace released more than was acquired");
+        top -= n;
+    }
+
+    // number of elements currently held by the pool
+    std::size_t capacity()
+    {
+        return buffer.size();
+    }
+};
+
+// Scratch of n elements from the calling thread's pool, released when the lease goes out of scope so an exception
+// between acquire and release cannot leave the pool in use
+template <typename T>
+class WorkspaceLease {
+PRIVATE:
+    WorkspacePool<T>& pool;
+    std::size_t n;
+    T* p;
+
+public:
+    WorkspaceLease(std::size_t n)
+        : pool(WorkspacePool<T>::local()), n(n), p(pool.acquire(n))
+    {
+    }
+
+    // scratch from a kernel's own pool
+    WorkspaceLease(WorkspacePool<T>& from, std::size_t n)
+        : pool(from), n(n), p(pool.acquire(n))
+    {
+    }
+
+    WorkspaceLease(WorkspaceLease&) = delete;
+
+    ~WorkspaceLease()
+    {
+        pool.release(n);
+    }
+
+    T* data()
+    {
+        return p;
+    }
+};
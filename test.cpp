@@ -1,22 +1,59 @@
 #include <iostream>
+#include <sstream>
 #include "../testing/test.h"
 
 //define that disables access protection for unit-testing private/protected variables
 #define TESTING
+// compiles the instrumentation hooks in so they are covered by the tests, the test_noprofiling target builds the
+// suite with them compiled out
+#ifndef TENSOR_NO_PROFILING
+#define TENSOR_PROFILING
+#endif
 #include "./lib/Tensor.h"
 #include "./lib/Matmul.h"
+#include "./lib/Conv.h"
+#include "./lib/Normalization.h"
+#include "./lib/Attention.h"
+#include "./lib/Autograd.h"
+#include "./lib/Streaming.h"
+#include "./lib/Numa.h"
+#include "./lib/FastMath.h"
+#include "./lib/Indexing.h"
+#include "./lib/Concat.h"
+#include "./lib/Frozen.h"
+#include "./lib/Init.h"
+#include "./lib/Mask.h"
+#include "./lib/Sort.h"
+#include "./lib/Linalg.h"
+#include "./lib/Npy.h"
+#include "./lib/Graph.h"
+
+// counts heap allocations of the whole binary so tests can check that warm hot paths do not allocate
+std::atomic<std::size_t> heapAllocations {0};
+void* operator new(std::size_t n){
+	heapAllocations++;
+	if(void* p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
 
 int main(){
     SECTION("Reference counting"){
         TEST("Copy counter"){
+            const std::size_t live = MemoryTracker::liveBuffers();
+            void* buffer = nullptr;
             {
                 Tensor<5, float> t{{5,6,7,2,3}};
                 Tensor<5, float> tCopy{t};
                 Tensor<5, float> tCopy2 = t;
+                buffer = t.data();
+                test::equal(t.values.useCount(), 3);
+                test::equal(MemoryTracker::liveBuffers(), live + 1);
             }
-            for(std::pair<void*, std::size_t> x: RefCounter::refCounter){
-                test::equal(x.second, 0, "Reference not cleared.");
-            }
+            // the last release frees the buffer and drops its record
+            test::equal(MemoryTracker::liveBuffers(), live);
+            test::equal(RefCounter::refCounter.count(buffer), 0, "Reference not cleared.");
         };
     }
     
@@ -771,6 +808,1970 @@ int main(){
 			test::equal(x3[{1}], expected[{1}]);
 		};
 	}
+	SECTION("Matmul epilogue"){
+		TEST("bias and relu"){
+			Tensor<2, int> x1{{2,2}};
+			x1[{0,0}] = 4;
+			x1[{0,1}] = 1;
+			x1[{1,0}] = -6;
+			x1[{1,1}] = 8;
+			Tensor<2, int> x2{{2,2}};
+			x2[{0,0}] = 4;
+			x2[{0,1}] = -18;
+			x2[{1,0}] = 2;
+			x2[{1,1}] = -3;
+			Tensor<1, int> bias{{2}};
+			bias[{0}] = 10;
+			bias[{1}] = 5;
+			Tensor<2, int> x3{{2,2}};
+			Epilogue<int> ep{};
+			ep.bias = &bias;
+			ep.activation = Activation::RELU;
+			matmul(x1,x2,x3,ep);
+			test::equal(x3[{0,0}], 28);
+			test::equal(x3[{0,1}], 0);
+			test::equal(x3[{1,0}], 2);
+			test::equal(x3[{1,1}], 89);
+		};
+		TEST("alpha and residual"){
+			Tensor<2, int> x1{{2,2}};
+			x1[{0,0}] = 4;
+			x1[{0,1}] = 1;
+			x1[{1,0}] = -6;
+			x1[{1,1}] = 8;
+			Tensor<3, int> x2{{2,2,2}};
+			for(std::size_t i=0;i<2;i++){
+				x2[{i,0,0}] = 4;
+				x2[{i,0,1}] = -18;
+				x2[{i,1,0}] = 2;
+				x2[{i,1,1}] = -3;
+			}
+			Tensor<3, int> x3{{2,2,2}};
+			for(int& x:x3){
+				x = 1;
+			}
+			Epilogue<int> ep{2, 1};
+			matmul(x1,x2,x3,ep);
+			for(std::size_t i=0;i<2;i++){
+				test::equal(x3[{i,0,0}], 37);
+				test::equal(x3[{i,0,1}], -149);
+				test::equal(x3[{i,1,0}], -15);
+				test::equal(x3[{i,1,1}], 169);
+			}
+		};
+		TEST("sigmoid"){
+			Tensor<2, float> x1{{1,2}};
+			x1[{0,0}] = 1;
+			x1[{0,1}] = -1;
+			Tensor<2, float> x2{{2,1}};
+			x2[{0,0}] = 0.5;
+			x2[{1,0}] = 0.5;
+			Tensor<2, float> x3{{1,1}};
+			Epilogue<float> ep{};
+			ep.activation = Activation::SIGMOID;
+			matmul(x1,x2,x3,ep);
+			test::near(x3[{0,0}], 0.5);
+		};
+	}
+	SECTION("Matmul vector kernels"){
+		TEST("matrix @ vector"){
+			Tensor<2, int> x1{{3,2}};
+			x1[{0,0}] = 4;
+			x1[{0,1}] = 1;
+			x1[{1,0}] = -6;
+			x1[{1,1}] = 8;
+			x1[{2,0}] = 2;
+			x1[{2,1}] = 0;
+			Tensor<1, int> x2{{2}};
+			x2[{0}] = 4;
+			x2[{1}] = -18;
+			Tensor<1, int> x3{{3}};
+			matmul(x1,x2,x3);
+			test::equal(x3[{0}], -2);
+			test::equal(x3[{1}], -168);
+			test::equal(x3[{2}], 8);
+		};
+		TEST("vector @ matrix"){
+			Tensor<2, int> x2{{2,3}};
+			x2[{0,0}] = 4;
+			x2[{0,1}] = -6;
+			x2[{0,2}] = 2;
+			x2[{1,0}] = 1;
+			x2[{1,1}] = 8;
+			x2[{1,2}] = 0;
+			Tensor<1, int> x1{{2}};
+			x1[{0}] = 4;
+			x1[{1}] = -18;
+			Tensor<1, int> x3{{3}};
+			matmul(x1,x2,x3);
+			test::equal(x3[{0}], -2);
+			test::equal(x3[{1}], -168);
+			test::equal(x3[{2}], 8);
+		};
+		TEST("large matrix @ vector (threaded, both layouts)"){
+			Tensor<2, double> x1{{300,500}};
+			Tensor<1, double> x2{{500}};
+			for(std::size_t i=0;i<300;i++){
+				for(std::size_t k=0;k<500;k++){
+					x1[{i,k}] = (double)((i*7+k*3)%11)-5;
+				}
+			}
+			for(std::size_t k=0;k<500;k++){
+				x2[{k}] = (double)(k%5)-2;
+			}
+			Tensor<1, double> x3{{300}};
+			Tensor<1, double> x3t{{300}};
+			matmul(x1,x2,x3);
+			Tensor<2, double> x1t = x1.swapaxes(0,1).clone();
+			matmul(x2,x1t,x3t);
+			for(std::size_t i=0;i<300;i++){
+				double expected = 0;
+				for(std::size_t k=0;k<500;k++){
+					expected += x1[{i,k}]*x2[{k}];
+				}
+				test::near(x3[{i}], expected);
+				test::near(x3t[{i}], expected);
+			}
+			// warm GEMV, GEVM (column-major walk of the transposed view) and dot calls don't allocate
+			Tensor<1, double> x4{{1}};
+			matmul(x2,x2,x4);
+			const std::size_t allocations = heapAllocations.load();
+			for(int r=0;r<3;r++){
+				matmul(x1,x2,x3);
+				matmul(x2,x1t,x3t);
+				matmul(x1.swapaxes(0,1).swapaxes(0,1),x2,x3);
+				matmul(x2,x2,x4);
+			}
+			test::equal(heapAllocations.load(), allocations);
+		};
+		TEST("dot"){
+			Tensor<1, float> x1{{100000}};
+			Tensor<1, float> x2{{100000}};
+			for(std::size_t k=0;k<100000;k++){
+				x1[{k}] = (k%2 ? 1 : -1);
+				x2[{k}] = (k%4 ? 0.5 : 1);
+			}
+			Tensor<1, float> x3{{1}};
+			matmul(x1,x2,x3);
+			test::near(x3[{0}], -12500);
+		};
+		TEST("outer"){
+			Tensor<1, int> x1{{2}};
+			x1[{0}] = 2;
+			x1[{1}] = -3;
+			Tensor<1, int> x2{{3}};
+			x2[{0}] = 1;
+			x2[{1}] = 0;
+			x2[{2}] = 5;
+			Tensor<2, int> x3{{2,3}};
+			matmul(x1,x2,x3);
+			test::equal(x3[{0,0}], 2);
+			test::equal(x3[{0,1}], 0);
+			test::equal(x3[{0,2}], 10);
+			test::equal(x3[{1,0}], -3);
+			test::equal(x3[{1,1}], 0);
+			test::equal(x3[{1,2}], -15);
+		};
+		TEST("pool dispatch does not allocate"){
+			ThreadPool pool(4);
+			std::vector<std::size_t> hits(64, 0);
+			std::size_t a = 1, b = 2, c = 3, d = 4;
+			auto task = [&](std::size_t i){ hits[i] += a + b + c + d - 9; };
+			pool.run(64, task);
+			const std::size_t before = heapAllocations.load();
+			for(std::size_t r=0;r<10;r++){
+				pool.run(64, task);
+				pool.run(64, [&](std::size_t i){ hits[i] += a + b + c + d - 10; });
+			}
+			test::equal(heapAllocations.load(), before);
+			for(std::size_t i=0;i<64;i++){
+				test::equal(hits[i], 11);
+			}
+		};
+	}
+	SECTION("Strassen matmul"){
+		TEST("matches classical result"){
+			for(std::size_t n: {std::size_t(64), std::size_t(37)}){
+				Tensor<2, double> x1{{n,n}};
+				Tensor<2, double> x2{{n,n}};
+				for(std::size_t i=0;i<n;i++){
+					for(std::size_t j=0;j<n;j++){
+						x1[{i,j}] = (double)((i*13+j*7)%17)-8;
+						x2[{i,j}] = (double)((i*5+j*11)%19)-9;
+					}
+				}
+				Tensor<2, double> classical{{n,n}};
+				matmul(x1,x2,classical);
+				FastMatmul::enabled = true;
+				FastMatmul::threshold = 8;
+				Tensor<2, double> fast{{n,n}};
+				matmul(x1,x2.swapaxes(0,1).clone().swapaxes(0,1),fast);
+				Tensor<2, double> residual{{n,n}};
+				for(double& x:residual){
+					x = 1;
+				}
+				matmul(x1,x2,residual,Epilogue<double>{1, 1});
+				FastMatmul::enabled = false;
+				FastMatmul::threshold = 512;
+				for(std::size_t i=0;i<n;i++){
+					for(std::size_t j=0;j<n;j++){
+						test::near(fast[{i,j}], classical[{i,j}]);
+						test::near(residual[{i,j}], classical[{i,j}]+1);
+					}
+				}
+			}
+		};
+		TEST("top levels as pool tasks"){
+			FastMatmul::threshold = 8;
+			for(std::size_t n: {std::size_t(64), std::size_t(39)}){
+				Tensor<2, double> x1{{n,n}};
+				Tensor<2, double> x2{{n,n}};
+				uniform(x1, -1.0, 1.0, 21);
+				uniform(x2, -1.0, 1.0, 22);
+				Tensor<2, double> classical{{n,n}};
+				matmul(x1,x2,classical);
+				// column-major copy of x2
+				Tensor<2, double> x2t = x2.swapaxes(0,1).clone();
+				for(std::size_t levels: {std::size_t(1), std::size_t(2)}){
+					Tensor<2, double> fast{{n,n}};
+					fill(fast, 1.0);
+					_strassenMatmul(n, x1.data(), n, std::size_t(1), x2t.data(), std::size_t(1), n, fast.data(), n, std::size_t(1),
+						(const double*)nullptr, 0, Epilogue<double>{1, 1}, levels);
+					double err = 0;
+					for(std::size_t i=0;i<n;i++){
+						for(std::size_t j=0;j<n;j++){
+							err = std::max(err, std::abs(fast[{i,j}] - classical[{i,j}] - 1));
+						}
+					}
+					test::near(err + 1, 1.0);
+				}
+			}
+			FastMatmul::threshold = 512;
+			test::equal(_strassenWorkspace(100), 0);
+		};
+		TEST("non-square falls back"){
+			test::equal(_useStrassen(1024, 1024, 512), false);
+			FastMatmul::enabled = true;
+			test::equal(_useStrassen(1024, 1024, 512), false);
+			test::equal(_useStrassen(100, 100, 100), false);
+			test::equal(_useStrassen(1024, 1024, 1024), true);
+			FastMatmul::enabled = false;
+		};
+	}
+	SECTION("Convolution"){
+		// direct NCHW reference convolution
+		auto reference = [](Tensor<4, double> x, Tensor<4, double> w, Conv2dParams p, std::size_t n, std::size_t o, std::size_t oh, std::size_t ow){
+			double acc = 0;
+			const std::size_t cg = w.dimensions[1];
+			const std::size_t g = o / (w.dimensions[0] / p.groups);
+			for(std::size_t c=0;c<cg;c++){
+				for(std::size_t kh=0;kh<w.dimensions[2];kh++){
+					for(std::size_t kw=0;kw<w.dimensions[3];kw++){
+						long ih = (long)(oh*p.strideH + kh*p.dilationH) - (long)p.paddingH;
+						long iw = (long)(ow*p.strideW + kw*p.dilationW) - (long)p.paddingW;
+						if(ih<0 || iw<0 || ih>=(long)x.dimensions[2] || iw>=(long)x.dimensions[3])continue;
+						acc += x[{n, g*cg+c, (std::size_t)ih, (std::size_t)iw}]*w[{o,c,kh,kw}];
+					}
+				}
+			}
+			return acc;
+		};
+		TEST("conv2d NCHW and NHWC, stride/padding/dilation"){
+			Tensor<4, double> x{{2,3,9,8}};
+			Tensor<4, double> w{{4,3,3,2}};
+			std::size_t i=0;
+			for(double& v:x){
+				v = (double)(i++%13)-6;
+			}
+			for(double& v:w){
+				v = (double)(i++%7)-3;
+			}
+			Conv2dParams p{};
+			p.strideH = 2;
+			p.paddingH = 1;
+			p.paddingW = 2;
+			p.dilationW = 2;
+			Tensor<4, double> y{{2,4,5,10}};
+			conv2d(x,w,y,p);
+			// NHWC through an axis-permuted copy of the input and a permuted view of the output
+			Tensor<4, double> xNhwc = x.swapaxes(1,2).swapaxes(2,3).clone();
+			Tensor<4, double> yNhwc{{2,5,10,4}};
+			p.layout = ConvLayout::NHWC;
+			conv2d(xNhwc,w,yNhwc,p);
+			p.layout = ConvLayout::NCHW;
+			for(std::size_t n=0;n<2;n++){
+				for(std::size_t o=0;o<4;o++){
+					for(std::size_t oh=0;oh<5;oh++){
+						for(std::size_t ow=0;ow<10;ow++){
+							test::near(y[{n,o,oh,ow}], reference(x,w,p,n,o,oh,ow));
+							test::near(yNhwc[{n,oh,ow,o}], y[{n,o,oh,ow}]);
+						}
+					}
+				}
+			}
+		};
+		TEST("grouped and depthwise conv2d"){
+			Tensor<4, double> x{{1,4,6,6}};
+			std::size_t i=0;
+			for(double& v:x){
+				v = (double)(i++%11)-5;
+			}
+			for(std::size_t groups: {std::size_t(2), std::size_t(4)}){
+				Tensor<4, double> w{{8,4/groups,3,3}};
+				for(double& v:w){
+					v = (double)(i++%5)-2;
+				}
+				Conv2dParams p{};
+				p.paddingH = 1;
+				p.paddingW = 1;
+				p.groups = groups;
+				Tensor<4, double> y{{1,8,6,6}};
+				conv2d(x,w,y,p);
+				for(std::size_t o=0;o<8;o++){
+					for(std::size_t oh=0;oh<6;oh++){
+						for(std::size_t ow=0;ow<6;ow++){
+							test::near(y[{0,o,oh,ow}], reference(x,w,p,0,o,oh,ow));
+						}
+					}
+				}
+			}
+		};
+		TEST("conv1d with bias"){
+			Tensor<3, int> x{{1,1,5}};
+			for(std::size_t i=0;i<5;i++){
+				x[{0,0,i}] = i+1;
+			}
+			Tensor<3, int> w{{2,1,2}};
+			w[{0,0,0}] = 1;
+			w[{0,0,1}] = 1;
+			w[{1,0,0}] = 1;
+			w[{1,0,1}] = -1;
+			Tensor<1, int> bias{{2}};
+			bias[{0}] = 100;
+			bias[{1}] = 0;
+			Epilogue<int> ep{};
+			ep.bias = &bias;
+			Conv1dParams p{};
+			p.stride = 2;
+			Tensor<3, int> y{{1,2,2}};
+			conv1d(x,w,y,p,ep);
+			test::equal(y[{0,0,0}], 103);
+			test::equal(y[{0,0,1}], 107);
+			test::equal(y[{0,1,0}], -1);
+			test::equal(y[{0,1,1}], -1);
+		};
+	}
+	SECTION("Normalization"){
+		TEST("softmax / log_softmax on a swapped view"){
+			Tensor<2, double> x{{3,4}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<4;j++){
+					x[{i,j}] = (double)(i*j) + 1000*(i==2);
+				}
+			}
+			Tensor<2, double> t = x.swapaxes(0,1);
+			Tensor<2, double> out{{4,3}};
+			Tensor<2, double> logOut{{4,3}};
+			softmax(t, out, 1);
+			log_softmax(t, logOut, 1);
+			for(std::size_t j=0;j<4;j++){
+				double sum = 0;
+				for(std::size_t i=0;i<3;i++){
+					sum += out[{j,i}];
+					test::near(std::exp(logOut[{j,i}]), out[{j,i}]);
+				}
+				test::near(sum, 1);
+			}
+			test::near(out[{1,0}], std::exp(0.0-1000-2)/(std::exp(-1002.0)+std::exp(1.0-1002)+1));
+		};
+		TEST("fully masked rows"){
+			const float inf = std::numeric_limits<float>::infinity();
+			Tensor<2, float> x{{2,3}};
+			for(std::size_t j=0;j<3;j++){
+				x[{0,j}] = -inf;
+				x[{1,j}] = j;
+			}
+			x[{1,1}] = -inf;
+			Tensor<2, float> out{{2,3}};
+			Tensor<2, float> logOut{{2,3}};
+			softmax(x, out);
+			log_softmax(x, logOut);
+			for(std::size_t j=0;j<3;j++){
+				test::equal(out[{0,j}], 0);
+				test::equal(logOut[{0,j}], -inf);
+			}
+			test::equal(out[{1,1}], 0);
+			test::near(out[{1,2}], 1/(1+std::exp(-2.0)));
+			test::near(logOut[{1,0}], -2-std::log(1+std::exp(-2.0)));
+		};
+		TEST("layer_norm / rms_norm in place"){
+			Tensor<2, float> x{{2,4}};
+			float values[4] = {1,2,3,6};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<4;j++){
+					x[{i,j}] = values[j];
+				}
+			}
+			Tensor<1, float> gamma{{4}};
+			Tensor<1, float> beta{{4}};
+			for(std::size_t j=0;j<4;j++){
+				gamma[{j}] = 2;
+				beta[{j}] = 1;
+			}
+			Tensor<2, float> y = x.clone();
+			layer_norm(x.slice(0), x.slice(0), 0, &gamma, &beta, 0.0f);
+			rms_norm(y, y, 1, (Tensor<1, float>*)nullptr, 0.0f);
+			const float sd = std::sqrt(3.5f);
+			const float rms = std::sqrt(12.5f);
+			for(std::size_t j=0;j<4;j++){
+				test::near(x[{0,j}], (values[j]-3)/sd*2+1);
+				test::near(x[{1,j}], values[j]);
+				test::near(y[{1,j}], values[j]/rms);
+			}
+		};
+	}
+	SECTION("Attention"){
+		TEST("matches unfused attention"){
+			for(bool causal: {false, true}){
+				const std::size_t S = 70, D = 8;
+				Tensor<4, double> q{{2,2,S,D}};
+				Tensor<4, double> k{{2,2,S,D}};
+				Tensor<4, double> v{{2,2,S,D}};
+				std::size_t i=0;
+				for(double& x:q){
+					x = ((double)(i++%17)-8)/8;
+				}
+				for(double& x:k){
+					x = ((double)(i++%13)-6)/6;
+				}
+				for(double& x:v){
+					x = (double)(i++%9)-4;
+				}
+				Tensor<4, double> out{{2,2,S,D}};
+				AttentionOptions<double> opts{};
+				opts.causal = causal;
+				attention(q,k,v,out,opts);
+
+				Tensor<4, double> scores{{2,2,S,S}};
+				matmul(q,k.swapaxes(2,3),scores,Epilogue<double>{1/std::sqrt(8.0)});
+				if(causal){
+					for(std::size_t b=0;b<2;b++){
+						for(std::size_t h=0;h<2;h++){
+							for(std::size_t r=0;r<S;r++){
+								for(std::size_t c=r+1;c<S;c++){
+									scores[{b,h,r,c}] = -1e300;
+								}
+							}
+						}
+					}
+				}
+				softmax(scores, scores, 3);
+				Tensor<4, double> expected{{2,2,S,D}};
+				matmul(scores,v,expected);
+				for(std::size_t b=0;b<2;b++){
+					for(std::size_t h=0;h<2;h++){
+						for(std::size_t r=0;r<S;r++){
+							for(std::size_t d=0;d<D;d++){
+								test::near(out[{b,h,r,d}], expected[{b,h,r,d}]);
+							}
+						}
+					}
+				}
+			}
+		};
+		TEST("additive mask"){
+			const std::size_t SQ = 40, SK = 90, D = 4;
+			const double inf = std::numeric_limits<double>::infinity();
+			Tensor<4, double> q{{1,2,SQ,D}};
+			Tensor<4, double> k{{1,2,SK,D}};
+			Tensor<4, double> v{{1,2,SK,D}};
+			std::size_t i=0;
+			for(double& x:q){
+				x = ((double)(i++%11)-5)/5;
+			}
+			for(double& x:k){
+				x = ((double)(i++%7)-3)/3;
+			}
+			for(double& x:v){
+				x = (double)(i++%5)-2;
+			}
+			Tensor<2, double> mask{{SQ,SK}};
+			for(std::size_t r=0;r<SQ;r++){
+				for(std::size_t c=0;c<SK;c++){
+					mask[{r,c}] = ((r+c)%3 == 0 ? -inf : (double)(c%4)/4);
+				}
+			}
+			// row 5 is fully masked
+			for(std::size_t c=0;c<SK;c++){
+				mask[{5,c}] = -inf;
+			}
+			Tensor<4, double> out{{1,2,SQ,D}};
+			AttentionOptions<double> opts{};
+			opts.mask = &mask;
+			attention(q,k,v,out,opts);
+			test::equal(WorkspacePool<double>::local().top, 0);
+
+			Tensor<4, double> scores{{1,2,SQ,SK}};
+			matmul(q,k.swapaxes(2,3),scores,Epilogue<double>{1/std::sqrt((double)D)});
+			for(std::size_t h=0;h<2;h++){
+				for(std::size_t r=0;r<SQ;r++){
+					for(std::size_t c=0;c<SK;c++){
+						scores[{0,h,r,c}] += mask[{r,c}];
+					}
+				}
+			}
+			softmax(scores, scores, 3);
+			Tensor<4, double> expected{{1,2,SQ,D}};
+			matmul(scores,v,expected);
+			for(std::size_t h=0;h<2;h++){
+				for(std::size_t r=0;r<SQ;r++){
+					for(std::size_t d=0;d<D;d++){
+						test::near(out[{0,h,r,d}], expected[{0,h,r,d}]);
+					}
+				}
+				for(std::size_t d=0;d<D;d++){
+					test::equal(out[{0,h,5,d}], 0);
+				}
+			}
+		};
+	}
+	SECTION("Autograd"){
+		TEST("gradients match finite differences"){
+			Tensor<2, double> x{{4,3}};
+			Tensor<2, double> w{{3,2}};
+			Tensor<1, double> b{{2}};
+			std::size_t i=0;
+			for(double& v:x){
+				v = ((double)(i++%7)-3)/4;
+			}
+			for(double& v:w){
+				v = ((double)(i++%5)-2)/3;
+			}
+			b[{0}] = 0.1;
+			b[{1}] = -0.2;
+			Tape<double> tape;
+			Variable<2, double> W = tape.parameter(w);
+			Variable<1, double> B = tape.parameter(b);
+			auto forward = [&](){
+				Variable<2, double> h = matmul(tape.input(x), W);
+				h += B;
+				Variable<2, double> y = tanh(h);
+				y -= scale(sigmoid(h), 0.5);
+				return sum(mul(y, relu(h)));
+			};
+			tape.backward(forward());
+			tape.reset();
+			tape.zeroGrad();
+			const std::size_t warmBuffers = tape.buffers.size();
+			const std::size_t warmNodes = tape.transient.size();
+			Variable<1, double> loss = forward();
+			const double base = loss.value()[{0}];
+			tape.backward(loss);
+			test::equal(tape.buffers.size(), warmBuffers);
+			test::equal(tape.transient.size(), warmNodes);
+			test::equal(tape.freeBuffers.size(), tape.buffers.size());
+			// a warm tape does not touch the heap
+			const std::size_t allocations = heapAllocations.load();
+			for(std::size_t r=0;r<3;r++){
+				tape.reset();
+				tape.zeroGrad();
+				tape.backward(forward());
+			}
+			test::equal(heapAllocations.load(), allocations);
+			const double eps = 1e-6;
+			for(std::size_t r=0;r<3;r++){
+				for(std::size_t c=0;c<2;c++){
+					tape.reset();
+					w[{r,c}] += eps;
+					const double shifted = forward().value()[{0}];
+					w[{r,c}] -= eps;
+					test::near(W.grad()[{r,c}], (shifted-base)/eps);
+				}
+			}
+			for(std::size_t c=0;c<2;c++){
+				tape.reset();
+				b[{c}] += eps;
+				const double shifted = forward().value()[{0}];
+				b[{c}] -= eps;
+				test::near(B.grad()[{c}], (shifted-base)/eps);
+			}
+		};
+	}
+	SECTION("Streaming"){
+		TEST("foreach, reduce and matmul over chunks"){
+			const std::string pathA = "/tmp/tensor_stream_a.bin";
+			const std::string pathC = "/tmp/tensor_stream_c.bin";
+			{
+				ChunkedTensor<2, double> a{pathA, {10,3}, 4, true};
+				ChunkedTensor<2, double> c{pathC, {10,2}, 4, true};
+				test::equal(a.chunkCount(), 3);
+				test::equal(a.rowsIn(2), 2);
+				// fill row r with r, then add 1 in a second pass
+				for(std::size_t chunk=0;chunk<a.chunkCount();chunk++){
+					Tensor<2, double> t = a.load(chunk);
+					for(std::size_t r=0;r<a.rowsIn(chunk);r++){
+						for(std::size_t k=0;k<3;k++){
+							t[{r,k}] = chunk*4+r;
+						}
+					}
+					a.write(chunk, t.data());
+				}
+				stream_foreach<2, double, 1>({&a}, [](double*(&v)[1]){
+					*v[0] += 1;
+				});
+				test::near(stream_reduce(a, 0.0, [](double acc, double x){ return acc + x; }), 3*55.0);
+				Tensor<2, double> b{{3,2}};
+				for(std::size_t k=0;k<3;k++){
+					b[{k,0}] = 1;
+					b[{k,1}] = k;
+				}
+				stream_matmul(a, b, c);
+				Tensor<2, double> last = c.load(2);
+				test::near(last[{1,0}], 30);
+				test::near(last[{1,1}], 30);
+				Tensor<2, double> first = c.load(0);
+				test::near(first[{0,0}], 3);
+				test::near(first[{0,1}], 3);
+			}
+			std::remove(pathA.c_str());
+			std::remove(pathC.c_str());
+		};
+		TEST("matmul with an empty output"){
+			const std::string pathA = "/tmp/tensor_stream_empty_a.bin";
+			const std::string pathC = "/tmp/tensor_stream_empty_c.bin";
+			{
+				ChunkedTensor<2, float> a{pathA, {6,3}, 4, true};
+				ChunkedTensor<2, float> c{pathC, {6,0}, 4, true};
+				Tensor<2, float> b{{3,0}};
+				stream_matmul(a, b, c);
+				test::equal(c.chunkSize(), 0);
+			}
+			std::remove(pathA.c_str());
+			std::remove(pathC.c_str());
+		};
+		TEST("matmul with an empty inner dimension"){
+			const std::string pathA = "/tmp/tensor_stream_k0_a.bin";
+			const std::string pathC = "/tmp/tensor_stream_k0_c.bin";
+			{
+				ChunkedTensor<2, float> a{pathA, {5,0}, 2, true};
+				ChunkedTensor<2, float> c{pathC, {5,3}, 2, true};
+				for(std::size_t chunk=0;chunk<c.chunkCount();chunk++){
+					Tensor<2, float> t = c.load(chunk);
+					fill(t, 7.0f);
+					c.write(chunk, t.data());
+				}
+				Tensor<2, float> b{{0,3}};
+				Tensor<1, float> bias{{3}};
+				for(std::size_t j=0;j<3;j++){
+					bias[{j}] = j;
+				}
+				// the product is zero, c = beta * c + bias
+				stream_matmul(a, b, c, Epilogue<float>{1, 1, &bias, Activation::NONE});
+				Tensor<2, float> last = c.load(2);
+				test::equal(last[{0,2}], 9);
+				stream_matmul(a, b, c);
+				Tensor<2, float> first = c.load(0);
+				test::equal(first[{1,1}], 0);
+			}
+			std::remove(pathA.c_str());
+			std::remove(pathC.c_str());
+		};
+	}
+	SECTION("Profiling"){
+#ifdef TENSOR_PROFILING
+		TEST("op counters and trace"){
+			Profiler::reset();
+			Profiler::setTracing(true);
+			{
+				Tensor<2, float> x1{{4,3}};
+				Tensor<2, float> x2{{3,5}};
+				Tensor<2, float> x3{{4,5}};
+				{
+					TENSOR_PROFILE_SCOPE("user region");
+					matmul(x1,x2,x3);
+				}
+				Tensor<2, float> c = x3.clone();
+				c += x3;
+				x3.slice(1);
+			}
+			Profiler::setTracing(false);
+			OpStats m = Profiler::stats(ProfiledOp::MATMUL);
+			test::equal(m.calls, 1);
+			test::equal(m.elements, 20);
+			test::equal(m.flops, 120);
+			test::equal(Profiler::stats(ProfiledOp::CLONE).calls, 1);
+			test::equal(Profiler::stats(ProfiledOp::ADD_ASSIGN).elements, 20);
+			test::equal(Profiler::stats(ProfiledOp::SLICE).calls, 1);
+			test::equal(Profiler::allocatedBytes() >= (12+15+20+20)*sizeof(float), true);
+			test::equal(Profiler::refcountOps() > 0, true);
+			std::ostringstream trace;
+			Profiler::dumpChromeTrace(trace);
+			test::equal(trace.str().find("\"name\":\"user region\"") != std::string::npos, true);
+			test::equal(trace.str().find("\"name\":\"matmul\"") != std::string::npos, true);
+		};
+		TEST("trace names are escaped"){
+			Profiler::reset();
+			Profiler::setTracing(true);
+			{
+				TENSOR_PROFILE_SCOPE("say \"hi\"\\\n");
+			}
+			Profiler::setTracing(false);
+			std::ostringstream trace;
+			Profiler::dumpChromeTrace(trace);
+			test::equal(trace.str().find("\"name\":\"say \\\"hi\\\"\\\\\\u000a\"") != std::string::npos, true);
+		};
+#else
+		TEST("hooks compiled out"){
+			Tensor<2, float> x1{{2,2}};
+			Tensor<2, float> x3{{2,2}};
+			for(float& v:x1){
+				v = 1;
+			}
+			{
+				TENSOR_PROFILE_SCOPE("user region");
+				matmul(x1,x1,x3);
+			}
+			test::equal(x3[{1,1}], 2);
+		};
+#endif
+	}
+	SECTION("Matmul autotuning"){
+		TEST("tuned and blocked kernels match"){
+			const std::string cachePath = "/tmp/tensor_tuning_test.cache";
+			std::remove(cachePath.c_str());
+			const std::size_t M = 70, N = 90, K = 300;
+			Tensor<2, double> x1{{M,K}};
+			Tensor<2, double> x2{{K,N}};
+			std::size_t i=0;
+			for(double& v:x1){
+				v = (double)(i++%7)-3;
+			}
+			for(double& v:x2){
+				v = (double)(i++%5)-2;
+			}
+			Tensor<2, double> expected{{M,N}};
+			GemmConfig serial{};
+			serial.blockM = M;
+			serial.blockN = N;
+			serial.blockK = K;
+			_gemmBlocked(M, N, K, x1.data(), K, std::size_t(1), x2.data(), N, std::size_t(1), expected.data(), N, std::size_t(1), (const double*)nullptr, 0, Epilogue<double>{}, serial);
+			GemmConfig blocked{};
+			blocked.blockM = 32;
+			blocked.blockN = 64;
+			blocked.blockK = 128;
+			blocked.packA = true;
+			blocked.packB = true;
+			blocked.threads = 4;
+			Tensor<1, double> bias{{N}};
+			for(double& v:bias){
+				v = -1;
+			}
+			Epilogue<double> ep{2, 0, &bias, Activation::RELU};
+			Tensor<2, double> out{{M,N}};
+			_gemmBlocked(M, N, K, x1.data(), K, std::size_t(1), x2.data(), N, std::size_t(1), out.data(), N, std::size_t(1), bias.data(), 1, ep, blocked);
+
+			GemmTuner tuner{cachePath};
+			const std::string key = GemmTuner::signature(M, N, K, "d", "rrr");
+			int runs = 0;
+			GemmConfig tuned = tuner.lookup(key, GemmTuner::candidates(M, N, K), [&](const GemmConfig&){ runs++; });
+			test::equal(runs > 1, true);
+			GemmTuner reloaded{cachePath};
+			test::equal(reloaded.contains(key), true);
+			GemmConfig cached = reloaded.lookup(key, GemmTuner::candidates(M, N, K), [&](const GemmConfig&){ runs = -1000; });
+			test::equal(runs > 1, true);
+			test::equal(cached.blockM, tuned.blockM);
+			test::equal(cached.threads, tuned.threads);
+			std::remove(cachePath.c_str());
+
+			// the library-wide tuner writes to a scratch file instead of the working directory
+			GemmTuner::instance().setCachePath(cachePath);
+			GemmTuner::enabled = true;
+			Tensor<2, double> viaMatmul{{M,N}};
+			matmul(x1, x2, viaMatmul);
+			GemmTuner::enabled = false;
+			GemmTuner reread{cachePath};
+			test::equal(reread.cache.size(), 1);
+			std::remove(cachePath.c_str());
+			for(std::size_t r=0;r<M;r++){
+				for(std::size_t c=0;c<N;c++){
+					const double v = 2*expected[{r,c}]-1;
+					test::near(out[{r,c}], v > 0 ? v : 0);
+					test::near(viaMatmul[{r,c}], expected[{r,c}]);
+				}
+			}
+		};
+	}
+	SECTION("NUMA placement"){
+		TEST("topology and node partitioned loops"){
+			std::vector<std::size_t> cpus = Numa::parseList("0-3,8,10-11");
+			test::equal(cpus.size(), 7);
+			test::equal(cpus[4], 8);
+			test::equal(cpus[6], 11);
+			test::equal(Numa::nodeCount() >= 1, true);
+			test::equal(Numa::currentNode() < Numa::nodeCount(), true);
+			std::size_t covered = 0;
+			for(std::size_t n=0;n<Numa::nodeCount();n++){
+				std::size_t b, e;
+				Numa::partitionRows(1000, n, b, e);
+				test::equal(b, covered);
+				covered = e;
+			}
+			test::equal(covered, 1000);
+
+			Tensor<2, double> t{{1000,64}};
+			const bool placed = numa_place(t, NumaPolicy::PARTITIONED);
+			test::equal(placed, Numa::enabled());
+			std::vector<std::atomic<int>> visits(1000);
+			parallel_for_nodes(1000, 16, [&](std::size_t b, std::size_t e){
+				for(std::size_t r=b;r<e;r++){
+					visits[r]++;
+					for(std::size_t c=0;c<64;c++){
+						t[{r,c}] = r;
+					}
+				}
+			});
+			for(std::size_t r=0;r<1000;r++){
+				test::equal(visits[r].load(), 1);
+			}
+			test::near(t[{999,63}], 999);
+			Tensor<2, double> empty{{0,64}};
+			test::equal(numa_place(empty, NumaPolicy::PARTITIONED), false);
+			test::equal(numa_place(empty, NumaPolicy::INTERLEAVE), false);
+		};
+		TEST("sparse node ids"){
+			Numa::Topology topo = Numa::buildTopology("0,2-3", [](std::size_t id){
+				return std::string(id == 0 ? "0-1" : (id == 2 ? "2,5" : ""));
+			});
+			// node 1 is not online and node 3 has no cpus
+			test::equal(topo.nodeCpus.size(), 2);
+			test::equal(topo.nodeIds[1], 2);
+			test::equal(topo.cpuNode[5], 1);
+			test::equal(Numa::buildTopology("", [](std::size_t){ return std::string(); }).nodeCpus.size(), 1);
+		};
+		TEST("kernels schedule rows by node"){
+			// two fake nodes send the row-parallel kernels through parallel_for_nodes
+			Numa::Topology saved = Numa::topology();
+			Numa::topology() = Numa::buildTopology("0-1", [](std::size_t id){ return std::to_string(id); });
+			const bool enabled = Numa::enabled();
+			Tensor<2, double> a{{100,40}}, b{{40,30}}, c{{100,30}}, expected{{100,30}};
+			uniform(a, -1.0, 1.0, 31);
+			uniform(b, -1.0, 1.0, 32);
+			GemmConfig cfg;
+			cfg.blockM = 16;
+			cfg.blockN = 8;
+			cfg.threads = 4;
+			_gemmBlocked(100, 30, 40, a.data(), 40, 1, b.data(), 30, 1, c.data(), 30, 1, (const double*)nullptr, 0, Epilogue<double>{}, cfg);
+			Tensor<2, double> x{{100,30}};
+			fill(x, 0.5);
+			exp(x, x);
+			Tensor<1, double> v{{40}}, y{{100}};
+			fill(v, 1.0);
+			matmul(a, v, y);
+			Numa::topology() = saved;
+			test::equal(enabled, true);
+			_gemmKernel(100, 30, 40, a.data(), 40, 1, b.data(), 30, 1, expected.data(), 30, 1, (const double*)nullptr, 0, Epilogue<double>{});
+			for(std::size_t i=0;i<100;i++){
+				double row = 0;
+				for(std::size_t k=0;k<40;k++){
+					row += a[{i,k}];
+				}
+				test::near(y[{i}], row);
+				for(std::size_t j=0;j<30;j++){
+					test::near(c[{i,j}], expected[{i,j}]);
+					test::near(x[{i,j}], std::exp(0.5));
+				}
+			}
+		};
+	}
+	SECTION("Math kernels"){
+		TEST("vectorized transcendental ops"){
+			Tensor<2, double> x{{40,50}};
+			std::size_t i = 0;
+			for(double& v:x){
+				v = -9.5 + 0.01 * (i++);
+			}
+			Tensor<2, double> out{{40,50}};
+			const auto close = [](double a, double b){ return std::fabs(a - b) <= 1e-14 * (1 + std::fabs(b)); };
+			exp(x, out);
+			for(std::size_t r=0;r<40;r++){
+				for(std::size_t c=0;c<50;c++){
+					test::equal(close(out[{r,c}], std::exp(x[{r,c}])), true);
+				}
+			}
+			gelu(x, out);
+			test::equal(close(out[{0,0}], -9.5 * 0.5 * std::erfc(9.5 / std::sqrt(2.0))), true);
+			test::equal(close(out[{39,49}], 10.49 * 0.5 * std::erfc(-10.49 / std::sqrt(2.0))), true);
+			// strided view in place
+			Tensor<2, double> t = x.clone().swapaxes(0,1);
+			tanh(t);
+			sin(x, out);
+			for(std::size_t r=0;r<40;r++){
+				for(std::size_t c=0;c<50;c++){
+					test::equal(close(t[{c,r}], std::tanh(x[{r,c}])), true);
+					test::equal(close(out[{r,c}], std::sin(x[{r,c}])), true);
+				}
+			}
+			Tensor<1, float> f{{8}};
+			float values[8] = {0.0f, -1.0f, 1e-40f, 1.0f, 2.0f, 1e30f, -0.5f, 100.0f};
+			for(std::size_t k=0;k<8;k++){
+				f[{k}] = values[k];
+			}
+			Tensor<1, float> logs{{8}};
+			log(f, logs);
+			test::equal(std::isinf(logs[{0}]) && logs[{0}] < 0, true);
+			test::equal(std::isnan(logs[{1}]), true);
+			test::near(logs[{2}], std::log(1e-40f));
+			test::near(logs[{5}], std::log(1e30f));
+			sigmoid(f);
+			test::near(f[{6}], 1 / (1 + std::exp(0.5)));
+			test::near(f[{7}], 1);
+			test::near(_fastCos(1e9), std::cos(1e9));
+			test::near(_fastErf(-0.3f), std::erf(-0.3f));
+			test::near(_fastRsqrt(4.0), 0.5);
+		};
+	}
+	SECTION("Indexing"){
+		TEST("index_select along both axes"){
+			Tensor<2, float> x{{5,3}};
+			for(std::size_t i=0;i<5;i++){
+				for(std::size_t j=0;j<3;j++){
+					x[{i,j}] = i*10+j;
+				}
+			}
+			Tensor<1, std::int64_t> rows{{4}};
+			std::int64_t picks[4] = {4, 0, 4, 2};
+			for(std::size_t k=0;k<4;k++){
+				rows[{k}] = picks[k];
+			}
+			Tensor<2, float> out{{4,3}};
+			index_select(x, 0, rows, out);
+			test::equal(out[{0,2}], 42);
+			test::equal(out[{2,1}], 41);
+			test::equal(out[{3,0}], 20);
+			Tensor<1, std::int64_t> cols{{2}};
+			cols[{0}] = 2;
+			cols[{1}] = 0;
+			Tensor<2, float> t = x.swapaxes(0,1);
+			Tensor<2, float> picked{{2,5}};
+			index_select(t, 0, cols, picked);
+			test::equal(picked[{0,3}], 32);
+			test::equal(picked[{1,4}], 40);
+		};
+		THROW_TEST("index_select out of range"){
+			Tensor<2, float> x{{5,3}};
+			Tensor<1, std::int64_t> rows{{2}};
+			rows[{0}] = 0;
+			rows[{1}] = 5;
+			Tensor<2, float> out{{2,3}};
+			index_select(x, 0, rows, out);
+		};
+		TEST("gather / scatter_add"){
+			Tensor<2, double> x{{2,4}};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<4;j++){
+					x[{i,j}] = i*4+j;
+				}
+			}
+			Tensor<2, int> idx{{2,3}};
+			int values[2][3] = {{3,3,0},{1,2,1}};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<3;j++){
+					idx[{i,j}] = values[i][j];
+				}
+			}
+			Tensor<2, double> g{{2,3}};
+			gather(x, 1, idx, g);
+			test::equal(g[{0,1}], 3);
+			test::equal(g[{0,2}], 0);
+			test::equal(g[{1,2}], 5);
+			Tensor<2, double> acc{{2,4}};
+			for(double& v:acc){
+				v = 0;
+			}
+			scatter_add(acc, 1, idx, g);
+			test::equal(acc[{0,3}], 6);
+			test::equal(acc[{0,0}], 0);
+			test::equal(acc[{1,1}], 10);
+			test::equal(acc[{1,2}], 6);
+		};
+		TEST("embedding_bag"){
+			Tensor<2, float> w{{6,2}};
+			for(std::size_t i=0;i<6;i++){
+				w[{i,0}] = i;
+				w[{i,1}] = 1;
+			}
+			Tensor<1, std::int64_t> indices{{5}};
+			std::int64_t ids[5] = {1, 5, 5, 0, 3};
+			for(std::size_t k=0;k<5;k++){
+				indices[{k}] = ids[k];
+			}
+			Tensor<1, std::int64_t> offsets{{3}};
+			offsets[{0}] = 0;
+			offsets[{1}] = 3;
+			offsets[{2}] = 3;
+			Tensor<2, float> out{{3,2}};
+			embedding_bag(w, indices, offsets, out, BagMode::SUM);
+			test::equal(out[{0,0}], 11);
+			test::equal(out[{0,1}], 3);
+			test::equal(out[{1,1}], 0);
+			test::equal(out[{2,0}], 3);
+			embedding_bag(w, indices, offsets, out, BagMode::MEAN);
+			test::near(out[{0,0}], 11.0/3);
+			test::equal(out[{2,1}], 1);
+			Tensor<1, float> scale{{5}};
+			for(std::size_t k=0;k<5;k++){
+				scale[{k}] = k;
+			}
+			embedding_bag(w, indices, offsets, out, BagMode::SUM, &scale);
+			test::equal(out[{0,0}], 15);
+			test::equal(out[{2,0}], 12);
+		};
+	}
+	SECTION("Concat / split"){
+		TEST("concat and stack"){
+			Tensor<2, int> a{{2,3}};
+			Tensor<2, int> b{{3,2}};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<3;j++){
+					a[{i,j}] = i*3+j;
+					b[{j,i}] = 10+i*3+j;
+				}
+			}
+			// b swapped is a strided [2,3] view
+			Tensor<2, int> bt = b.swapaxes(0,1);
+			Tensor<2, int> rows = concat(0, a, bt, a);
+			test::equal(rows.dimensions[0], 6);
+			test::equal(rows[{1,2}], 5);
+			test::equal(rows[{3,1}], 14);
+			test::equal(rows[{4,0}], 0);
+			Tensor<2, int> cols = concat(1, a, bt);
+			test::equal(cols.dimensions[1], 6);
+			test::equal(cols[{1,4}], 14);
+			Tensor<3, int> st = stack(1, a, bt);
+			test::equal(st.dimensions[1], 2);
+			test::equal(st[{1,1,2}], 15);
+			test::equal(st[{0,0,2}], 2);
+		};
+		TEST("split views and preallocated output"){
+			Tensor<2, int> out{{5,2}};
+			std::array<Tensor<2, int>, 2> parts = split(out, 0, {2,3});
+			test::equal(parts[1].dimensions[0], 3);
+			// producers write straight into their region of the final tensor
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<2;j++){
+					parts[0][{i,j}] = 1;
+				}
+			}
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<2;j++){
+					parts[1][{i,j}] = 2;
+				}
+			}
+			test::equal(out[{1,1}], 1);
+			test::equal(out[{2,0}], 2);
+			std::array<Tensor<2, int>, 3> cs = chunk<3>(out, 0);
+			test::equal(cs[0].dimensions[0], 1);
+			test::equal(cs[2].dimensions[0], 2);
+			cs[2][{1,1}] = 7;
+			test::equal(out[{4,1}], 7);
+			Tensor<2, int> joined{{5,2}};
+			concat_into(joined, 0, cs[0], cs[1], cs[2]);
+			test::equal(joined[{4,1}], 7);
+			test::equal(joined[{0,0}], 1);
+		};
+	}
+	SECTION("Reshape"){
+		TEST("views where strides allow, copies otherwise"){
+			Tensor<3, int> x{{2,3,4}};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<3;j++){
+					for(std::size_t k=0;k<4;k++){
+						x[{i,j,k}] = i*12+j*4+k;
+					}
+				}
+			}
+			test::equal(x.flattenIsView<0,1>(), true);
+			Tensor<2, int> rows = x.flatten<0,1>();
+			test::equal(rows.dimensions[0], 6);
+			test::equal(rows[{4,3}], 19);
+			rows[{5,0}] = -1;
+			test::equal(x[{1,2,0}], -1);
+			Tensor<4, int> split = x.reshape<4>({2,3,2,2});
+			test::equal(split[{1,0,1,1}], 15);
+			// [2,4,3] view: merging the swapped axes needs a copy, splitting one does not
+			Tensor<3, int> t = x.swapaxes(1,2);
+			test::equal(t.flattenIsView<1,2>(), false);
+			test::equal(t.flattenIsView<0,1>(), false);
+			test::equal(t.reshapeIsView<4>({2,2,2,3}), true);
+			Tensor<4, int> tv = t.reshape<4>({2,2,2,3});
+			test::equal(tv[{1,1,0,2}], x[{1,2,2}]);
+			Tensor<2, int> copy = t.flatten<1,2>();
+			test::equal(copy[{1,3}], t[{1,1,0}]);
+			copy[{0,0}] = 100;
+			test::equal(x[{0,0,0}], 0);
+			// unit axes are free to move
+			Tensor<3, int> sliced = x.narrow(1, 1, 1);
+			test::equal(sliced.reshapeIsView<2>({2,4}), true);
+			Tensor<2, int> sv = sliced.reshape<2>({2,4});
+			test::equal(sv[{1,2}], x[{1,1,2}]);
+		};
+		THROW_TEST("element count must match"){
+			Tensor<2, int> x{{2,3}};
+			x.reshape<2>({4,2});
+		};
+	}
+	SECTION("Copy on write"){
+		TEST("writes detach only shared buffers"){
+			Tensor<2, int> a{{3,4}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<4;j++){
+					a[{i,j}] = i*4+j;
+				}
+			}
+			a.setCopyOnWrite();
+			int* storage = a.values.data();
+			// sole owner: no copy
+			a[{0,0}] = 100;
+			test::equal(a.values.data(), storage);
+			Tensor<2, int> b = a;
+			Tensor<1, int> row = a.slice(1);
+			test::equal(row.isCopyOnWrite(), true);
+			// reads stay zero-copy
+			test::equal(b.read({2,3}), 11);
+			test::equal(a.values.data(), storage);
+			b[{2,3}] = -1;
+			// operator[] counts as a write, read() does not
+			test::equal(a.read({2,3}), 11);
+			test::equal(b.values.data() != storage, true);
+			test::equal(b.values.length(), 12);
+			// the row view copies only its 4 elements
+			row[{2}] = -2;
+			test::equal(row.values.length(), 4);
+			test::equal(a.read({1,2}), 6);
+			test::equal(row[{3}], 7);
+			// a is the last holder of the original buffer now
+			a += b;
+			test::equal(a.values.data(), storage);
+			test::equal(a[{2,3}], 10);
+			test::equal(a[{0,0}], 200);
+		};
+		TEST("reads never detach"){
+			Tensor<2, int> a{{2,3}};
+			for(int& v:a){
+				v = 1;
+			}
+			a.setCopyOnWrite();
+			int* storage = a.values.data();
+			Tensor<2, int> b = a;
+			Tensor<1, int> row = a.slice(1);
+			const Tensor<1, int>& constRow = row;
+			test::equal(constRow[{2}], 1);
+			const Tensor<2, int>& constB = b;
+			int sum = 0;
+			for(const int& v:constB){
+				sum += v;
+			}
+			test::equal(sum, 6);
+			test::equal(row.values.data(), storage);
+			test::equal(b.values.data(), storage);
+			// the operand of += is only read
+			Tensor<2, int> c{{2,3}};
+			for(int& v:c){
+				v = 2;
+			}
+			c += b;
+			c -= a;
+			test::equal(b.values.data(), storage);
+			test::equal(a.values.data(), storage);
+			test::equal(c.read({1,2}), 2);
+		};
+		TEST("views of a copy-on-write tensor"){
+			Tensor<2, float> a{{2,3}};
+			for(float& v:a){
+				v = 1;
+			}
+			a.setCopyOnWrite();
+			Tensor<2, float> t = a.swapaxes(0,1);
+			Tensor<1, float> bias{{3}};
+			for(float& v:bias){
+				v = 2;
+			}
+			// broadcasting add detaches once and then writes the rows in place
+			a += bias;
+			test::equal(a[{1,2}], 3);
+			test::equal(t[{2,1}], 1);
+			Tensor<2, float> c = a.clone();
+			test::equal(c.isCopyOnWrite(), false);
+		};
+		TEST("library kernels detach before writing"){
+			Tensor<2, double> a{{2,2}};
+			a[{0,0}] = 4;
+			a[{0,1}] = 2;
+			a[{1,0}] = 2;
+			a[{1,1}] = 3;
+			a.setCopyOnWrite();
+			Tensor<2, double> filled = a;
+			fill(filled, 7.0);
+			Tensor<2, double> sorted = a;
+			sort(sorted, 1);
+			Tensor<2, double> factor = a;
+			cholesky(factor);
+			test::equal(a.read({0,0}), 4);
+			test::equal(a.read({0,1}), 2);
+			test::equal(filled.read({1,1}), 7);
+			test::equal(sorted.read({0,0}), 2);
+			test::near(factor.read({0,0}), 2);
+			// outputs taken by value are written in place for their caller
+			Tensor<2, double> out{{2,2}};
+			out.setCopyOnWrite();
+			matmul(a, a, out);
+			test::equal(out.read({0,0}), 20);
+			softmax(out, out);
+			test::near(out.read({0,0}) + out.read({0,1}), 1);
+			// unless the buffer is shared with another tensor
+			Tensor<2, double> other = out;
+			bool refused = false;
+			try{
+				matmul(a, a, out);
+			}catch(std::logic_error&){
+				refused = true;
+			}
+			test::equal(refused, true);
+			out.detach();
+			matmul(a, a, out);
+			test::equal(out.read({1,1}), 13);
+			test::near(other.read({0,0}) + other.read({0,1}), 1);
+		};
+		TEST("shared outputs of by-value kernels throw"){
+			Tensor<4, float> x{{1,2,4,4}}, w{{3,2,3,3}}, y{{1,3,2,2}}, out{{1,2,4,4}};
+			fill(x, 1.0f);
+			fill(w, 0.5f);
+			fill(y, 0.0f);
+			y.setCopyOnWrite();
+			out.setCopyOnWrite();
+			Tensor<4, float> ySnapshot = y;
+			Tensor<4, float> outSnapshot = out;
+			std::size_t refused = 0;
+			auto expectRefused = [&](auto call){
+				try{
+					call();
+				}catch(std::logic_error&){
+					refused++;
+				}
+			};
+			expectRefused([&]{ conv2d(x, w, y); });
+			expectRefused([&]{ attention(x, x, x, out); });
+			expectRefused([&]{ softmax(x, out); });
+			test::equal(refused, 3);
+			y.detach();
+			out.detach();
+			conv2d(x, w, y);
+			softmax(x, out);
+			test::near(y.read({0,2,1,1}), 9);
+			test::near(out.read({0,1,2,3}), 0.25f);
+			test::equal(ySnapshot.read({0,2,1,1}), 0);
+		};
+	}
+	SECTION("Thread safety"){
+		TEST("concurrent views of a shared tensor"){
+			Tensor<2, float> w{{64,32}};
+			for(std::size_t i=0;i<64;i++){
+				for(std::size_t j=0;j<32;j++){
+					w[{i,j}] = i*32+j;
+				}
+			}
+			std::vector<std::thread> threads;
+			std::atomic<std::size_t> wrong{0};
+			for(std::size_t t=0;t<8;t++){
+				threads.emplace_back([&, t](){
+					for(std::size_t r=0;r<2000;r++){
+						const std::size_t i = (r + t) % 64;
+						Tensor<1, float> row = w.slice(i);
+						Tensor<2, float> wt = w.swapaxes(0,1);
+						Tensor<2, float> copy = wt.narrow(0, 1, 2).clone();
+						if(row.read({3}) != i*32+3 || wt.read({5,i}) != i*32+5 || copy.read({0,i}) != i*32+1) wrong++;
+					}
+				});
+			}
+			for(std::thread& th: threads) th.join();
+			test::equal(wrong.load(), 0);
+			test::equal(w.values.useCount(), 1);
+		};
+		TEST("frozen handles"){
+			Tensor<2, float> w{{3,4}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<4;j++){
+					w[{i,j}] = i*4+j;
+				}
+			}
+			FrozenTensor<2, float> f = freeze(w);
+			FrozenTensor<1, float> col = f.swapaxes(0,1).slice(2);
+			test::equal(w.values.useCount(), 1);
+			test::equal(col.dimension(0), 3);
+			test::equal(col[{1}], 6);
+			test::equal(f.narrow(1, 1, 2)[{2,1}], 10);
+			Tensor<2, float> c = f.swapaxes(0,1).clone();
+			test::equal(c[{3,2}], 11);
+			Tensor<2, float> x{{2,3}};
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<3;j++){
+					x[{i,j}] = i+j;
+				}
+			}
+			Tensor<2, float> y1{{2,4}}, y2{{2,4}};
+			matmul(x, w, y1);
+			matmul(x, f, y2);
+			for(std::size_t i=0;i<2;i++){
+				for(std::size_t j=0;j<4;j++){
+					test::near(y2[{i,j}], y1[{i,j}]);
+				}
+			}
+		};
+		TEST("per-thread replicas"){
+			Tensor<1, int> bias{{16}};
+			for(std::size_t i=0;i<16;i++){
+				bias[{i}] = i;
+			}
+			ReplicatedTensor<1, int> r{bias};
+			const int* mine = r.local().data();
+			test::equal(r.local().data(), mine);
+			test::equal(mine != bias.data(), true);
+			const int* other = nullptr;
+			int sum = 0;
+			std::thread th([&](){
+				FrozenTensor<1, int> b = r.local();
+				other = b.data();
+				for(std::size_t i=0;i<16;i++){
+					sum += b[{i}];
+				}
+			});
+			th.join();
+			test::equal(other != mine, true);
+			test::equal(sum, 120);
+			test::equal(r.replicaCount(), 2);
+		};
+	}
+	SECTION("Index types"){
+		TEST("32-bit metadata"){
+			test::equal(sizeof(CompactTensor<2, float>) < sizeof(Tensor<2, float>), true);
+			CompactTensor<2, int> a{{3,4}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<4;j++){
+					a[{i,j}] = i*4+j;
+				}
+			}
+			CompactTensor<1, int> col = a.swapaxes(0,1).slice(2);
+			test::equal(col[{1}], 6);
+			CompactTensor<1, int> flat = a.flatten<0, 1>();
+			test::equal(flat[{7}], 7);
+			CompactTensor<2, int> part = a.narrow(1, 1, 2).clone();
+			test::equal(part[{2,1}], 10);
+			a += a.clone();
+			int sum = 0;
+			for(int& v: a){
+				sum += v;
+			}
+			test::equal(sum, 132);
+			// kernels take size_t-indexed tensors, the conversion is a view
+			Tensor<2, int> wide = a.withIndexType<std::size_t>();
+			test::equal(wide.data(), a.data());
+			test::equal(wide[{2,3}], 22);
+		};
+		THROW_TEST("index type overflow"){
+			Tensor<1, char, std::uint8_t> t{{300}};
+		};
+	}
+	SECTION("Initialization"){
+		TEST("constant and range fills"){
+			Tensor<2, int> z = zeros<int>({3,4});
+			Tensor<2, int> o = ones<int>({3,4});
+			Tensor<2, float> f = full<float>({2,2}, 2.5f);
+			test::equal(z[{2,3}], 0);
+			test::equal(o[{1,2}], 1);
+			test::equal(f[{1,1}], 2.5f);
+			Tensor<1, int> r = arange(0, 10, 3);
+			test::equal(r.dimensions[0], 4);
+			test::equal(r[{3}], 9);
+			test::equal(arange(1.0, 0.0, -0.25).dimensions[0], 4);
+			Tensor<1, double> l = linspace(0.0, 1.0, 5);
+			test::near(l[{1}], 0.25);
+			test::equal(l[{4}], 1.0);
+			Tensor<2, float> e = eye<float>(3);
+			test::equal(e[{1,1}], 1.0f);
+			test::equal(e[{1,2}], 0.0f);
+			// fills follow row-major order on strided views too
+			Tensor<2, int> t{{3,2}};
+			Tensor<2, int> v = t.swapaxes(0,1);
+			arange(v, 0);
+			test::equal(t[{2,0}], 2);
+			test::equal(t[{0,1}], 3);
+		};
+		TEST("philox random fills"){
+			// known answer of Philox4x32-10 for a zero counter and key
+			std::uint32_t w[4];
+			Philox::generate(0, 0, 0, w);
+			test::equal(w[0], 0x6627e8d5u);
+			test::equal(w[3], 0x9b00dbd8u);
+			const std::size_t R = 300, C = 257;
+			Tensor<2, float> a{{R,C}};
+			uniform(a, -1.0f, 1.0f, 42);
+			// the same values land on a transposed layout and match a direct evaluation of the generator
+			Tensor<2, float> b{{C,R}};
+			Tensor<2, float> bt = b.swapaxes(0,1);
+			uniform(bt, -1.0f, 1.0f, 42);
+			std::size_t mismatches = 0;
+			for(std::size_t i=0;i<R;i++){
+				for(std::size_t j=0;j<C;j++){
+					if(a[{i,j}] != b[{j,i}]) mismatches++;
+				}
+			}
+			test::equal(mismatches, 0);
+			const std::size_t k = 12345;
+			Philox::generate(42, 0, k / 4, w);
+			test::equal(a[{k / C, k % C}], -1.0f + 2.0f * (float(w[k % 4] >> 8) / 16777216.0f));
+			Tensor<2, float> c{{R,C}};
+			uniform(c, -1.0f, 1.0f, 42, 1);
+			test::notEqual(c[{0,0}], a[{0,0}]);
+			Tensor<1, double> n{{1 << 16}};
+			normal(n, 1.0, 2.0, 7);
+			double sum = 0, sq = 0;
+			for(double x: n){
+				sum += x;
+				sq += x * x;
+			}
+			const double mean = sum / n.elementCount();
+			const double var = sq / n.elementCount() - mean * mean;
+			test::equal(std::fabs(mean - 1.0) < 0.05, true);
+			test::equal(std::fabs(std::sqrt(var) - 2.0) < 0.05, true);
+		};
+	}
+	SECTION("Masks"){
+		TEST("comparisons and reductions"){
+			Tensor<2, float> a{{10,13}};
+			arange(a, -20.0f);
+			BitMask<2> pos = a > 0;
+			test::equal(count_nonzero(pos), 109);
+			test::equal(pos[{1,7}], false);
+			test::equal(pos[{1,8}], true);
+			BitMask<2> small = a <= 30.0f;
+			BitMask<2> band = pos & small;
+			test::equal(count_nonzero(band), 30);
+			BitMask<2> outside = ~band;
+			test::equal(count_nonzero(outside), 100);
+			test::equal(any(band), true);
+			test::equal(all(band | outside), true);
+			test::equal(all(pos), false);
+			// strided views compare in row-major element order
+			Tensor<2, float> t = a.swapaxes(0,1);
+			BitMask<2> tpos = t > 0;
+			test::equal(tpos[{8,1}], true);
+			test::equal(tpos[{7,1}], false);
+			Tensor<2, float> b = a.clone();
+			b[{3,3}] = 0;
+			test::equal(count_nonzero(not_equal(a, b)), 1);
+			test::equal(count_nonzero(a == b), 129);
+		};
+		TEST("where and masked_fill"){
+			Tensor<2, int> a{{3,70}}, b{{3,70}}, out{{3,70}};
+			arange(a, 0);
+			fill(b, -1);
+			BitMask<2> odd{{3,70}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<70;j++){
+					odd.set({i,j}, j % 2);
+				}
+			}
+			where(odd, a, b, out);
+			test::equal(out[{2,5}], 145);
+			test::equal(out[{2,6}], -1);
+			masked_fill(a, odd, 0);
+			test::equal(a[{1,3}], 0);
+			test::equal(a[{1,4}], 74);
+			Tensor<2, int> at = a.swapaxes(0,1);
+			BitMask<2> big = at >= 100;
+			masked_fill(at, big, 100);
+			test::equal(a[{2,68}], 100);
+			test::equal(a[{1,28}], 98);
+		};
+	}
+	SECTION("Sorting"){
+		TEST("topk along an axis"){
+			Tensor<2, float> scores{{3,200000}};
+			uniform(scores, 0.0f, 1.0f, 3);
+			scores[{1,777}] = 2.0f;
+			scores[{1,5}] = 1.5f;
+			scores[{1,150000}] = 1.5f;
+			TopK<2, float> best = topk(scores, 1, 3);
+			test::equal(best.values[{1,0}], 2.0f);
+			test::equal(best.indices[{1,0}], 777);
+			// ties keep the lower position first
+			test::equal(best.indices[{1,1}], 5);
+			test::equal(best.indices[{1,2}], 150000);
+			// compare another row against a full sort
+			std::vector<float> row(200000);
+			for(std::size_t j=0;j<200000;j++){
+				row[j] = scores[{2,j}];
+			}
+			std::sort(row.begin(), row.end(), [](float a, float b){ return a > b; });
+			for(std::size_t j=0;j<3;j++){
+				test::equal(best.values[{2,j}], row[j]);
+			}
+			// smallest along axis 0 of a strided view
+			Tensor<2, int> a{{4,3}};
+			for(std::size_t i=0;i<4;i++){
+				for(std::size_t j=0;j<3;j++){
+					a[{i,j}] = (i * 7 + j * 3) % 5;
+				}
+			}
+			Tensor<2, int> at = a.swapaxes(0,1);
+			TopK<2, int> low = topk(at, 1, 2, false);
+			test::equal(low.values[{0,0}], 0);
+			test::equal(low.indices[{0,0}], 0);
+			test::equal(low.values[{0,1}], 1);
+			test::equal(low.indices[{0,1}], 3);
+		};
+		TEST("sort and argsort"){
+			Tensor<2, float> x{{3,5}};
+			float init[3][5] = {{3,1,2,5,4},{0,NAN,-1,7,-1},{9,8,7,6,5}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<5;j++){
+					x[{i,j}] = init[i][j];
+				}
+			}
+			Tensor<2, std::int64_t> idx = argsort(x, 1);
+			test::equal(idx[{0,0}], 1);
+			test::equal(idx[{1,0}], 2);
+			test::equal(idx[{1,1}], 4);
+			test::equal(idx[{1,4}], 1);
+			Tensor<2, std::int64_t> down = argsort(x, 0, true);
+			test::equal(down[{0,0}], 2);
+			test::equal(down[{0,1}], 1);
+			sort(x, 1);
+			test::equal(x[{0,4}], 5.0f);
+			test::equal(std::isnan(x[{1,4}]), true);
+			test::equal(x[{2,0}], 5.0f);
+			Tensor<2, float> xt = x.swapaxes(0,1);
+			sort(xt, 0, true);
+			test::equal(x[{0,0}], 5.0f);
+			test::equal(x[{2,4}], 5.0f);
+			// a line long enough to be sorted in parallel pieces
+			Tensor<1, double> big{{300000}};
+			uniform(big, -1.0, 1.0, 11);
+			sort(big, 0);
+			bool ordered = true;
+			for(std::size_t j=1;j<300000;j++){
+				ordered = ordered && big[{j-1}] <= big[{j}];
+			}
+			test::equal(ordered, true);
+		};
+	}
+	SECTION("Linear algebra"){
+		TEST("Cholesky factor and solve"){
+			// n spans several panels, a = g g^T + n I is positive definite
+			const std::size_t n = 150;
+			Tensor<2, double> g{{n,n}};
+			uniform(g, -1.0, 1.0, 3);
+			Tensor<2, double> gt = g.swapaxes(0,1);
+			Tensor<2, double> a{{n,n}};
+			matmul(g, gt, a);
+			for(std::size_t i=0;i<n;i++){
+				a[{i,i}] += double(n);
+			}
+			Tensor<2, double> l = a.clone();
+			cholesky(l);
+			// the strictly upper triangle is left as it is
+			bool upperKept = true;
+			for(std::size_t i=0;i<n;i++){
+				for(std::size_t j=i+1;j<n;j++){
+					upperKept = upperKept && l[{i,j}] == a[{i,j}];
+					l[{i,j}] = 0.0;
+				}
+			}
+			test::equal(upperKept, true);
+			Tensor<2, double> lt = l.swapaxes(0,1);
+			Tensor<2, double> back{{n,n}};
+			matmul(l, lt, back);
+			double err = 0;
+			for(std::size_t i=0;i<n;i++){
+				for(std::size_t j=0;j<n;j++){
+					err = std::max(err, std::abs(back[{i,j}] - a[{i,j}]));
+				}
+			}
+			test::near(err, 0.0);
+			Tensor<2, double> x{{n,3}};
+			uniform(x, -1.0, 1.0, 4);
+			Tensor<2, double> b{{n,3}};
+			matmul(a, x, b);
+			cholesky_solve(l, b);
+			err = 0;
+			for(std::size_t i=0;i<n;i++){
+				for(std::size_t j=0;j<3;j++){
+					err = std::max(err, std::abs(b[{i,j}] - x[{i,j}]));
+				}
+			}
+			test::near(err, 0.0);
+		};
+		TEST("LU with partial pivoting"){
+			const std::size_t n = 130;
+			Tensor<2, double> a{{n,n}};
+			uniform(a, -1.0, 1.0, 5);
+			// a zero leading entry needs a row swap
+			a[{0,0}] = 0.0;
+			Tensor<2, double> f = a.clone();
+			Tensor<1, std::int64_t> piv{{n}};
+			lu(f, piv);
+			test::notEqual(piv[{0}], 0);
+			Tensor<2, double> x{{n,2}};
+			uniform(x, -1.0, 1.0, 6);
+			Tensor<2, double> b{{n,2}};
+			matmul(a, x, b);
+			lu_solve(f, piv, b);
+			double err = 0;
+			for(std::size_t i=0;i<n;i++){
+				for(std::size_t j=0;j<2;j++){
+					err = std::max(err, std::abs(b[{i,j}] - x[{i,j}]));
+				}
+			}
+			test::near(err, 0.0);
+		};
+		TEST("Triangular solves"){
+			Tensor<2, float> u{{3,3}};
+			float init[3][3] = {{2,1,-1},{7,4,3},{7,7,5}};
+			for(std::size_t i=0;i<3;i++){
+				for(std::size_t j=0;j<3;j++){
+					u[{i,j}] = init[i][j];
+				}
+			}
+			// only the upper triangle is read: u = [[2,1,-1],[0,4,3],[0,0,5]]
+			Tensor<2, float> b{{3,1}};
+			b[{0,0}] = 2; b[{1,0}] = 7; b[{2,0}] = 5;
+			trsm(u, b, Triangle::UPPER);
+			test::near(b[{2,0}], 1.0f);
+			test::near(b[{1,0}], 1.0f);
+			test::near(b[{0,0}], 1.0f);
+			// u^T x = c with a unit diagonal
+			Tensor<2, float> c{{3,1}};
+			c[{0,0}] = 1; c[{1,0}] = 2; c[{2,0}] = 3;
+			trsm(u, c, Triangle::UPPER, true, true);
+			test::near(c[{0,0}], 1.0f);
+			test::near(c[{1,0}], 1.0f);
+			test::near(c[{2,0}], 1.0f);
+		};
+		TEST("Batched solves"){
+			Tensor<3, double> a{{2,2,2}};
+			double init[2][2][2] = {{{4,2},{2,3}},{{9,3},{3,5}}};
+			for(std::size_t k=0;k<2;k++){
+				for(std::size_t i=0;i<2;i++){
+					for(std::size_t j=0;j<2;j++){
+						a[{k,i,j}] = init[k][i][j];
+					}
+				}
+			}
+			Tensor<3, double> f = a.clone();
+			Tensor<2, std::int64_t> piv{{2,2}};
+			lu(f, piv);
+			Tensor<3, double> l = a.clone();
+			cholesky(l);
+			test::near(l[{0,0,0}], 2.0);
+			test::near(l[{1,1,0}], 1.0);
+			Tensor<3, double> b{{2,2,1}};
+			b[{0,0,0}] = 6; b[{0,1,0}] = 5;
+			b[{1,0,0}] = 12; b[{1,1,0}] = 8;
+			Tensor<3, double> b2 = b.clone();
+			cholesky_solve(l, b);
+			lu_solve(f, piv, b2);
+			for(std::size_t k=0;k<2;k++){
+				for(std::size_t i=0;i<2;i++){
+					test::near(b[{k,i,0}], 1.0);
+					test::near(b2[{k,i,0}], 1.0);
+				}
+			}
+		};
+		THROW_TEST("Cholesky of an indefinite matrix"){
+			Tensor<2, double> a{{2,2}};
+			a[{0,0}] = 1; a[{0,1}] = 2;
+			a[{1,0}] = 2; a[{1,1}] = 1;
+			cholesky(a);
+		};
+	}
+	SECTION("NumPy files"){
+		TEST("npy round trips"){
+			const std::string path = "/tmp/tensor_test.npy";
+			Tensor<2, float> x{{3,4}};
+			arange(x, 0.0f);
+			save_npy(path, x);
+			Tensor<2, float> y = load_npy<2, float>(path);
+			test::equal(y.dimensions[0], 3);
+			test::equal(y[{2,3}], 11.0f);
+			// the transpose is written in Fortran order and read back as a transposed view, without reordering
+			Tensor<2, float> xt = x.swapaxes(0,1);
+			save_npy(path, xt);
+			NpyReader header{path};
+			test::equal(header.info().fortranOrder, true);
+			test::equal(header.dimension(0), 4);
+			Tensor<2, float> yt = load_npy<2, float>(path);
+			test::equal(yt.dimensionIncrementors[0], 1);
+			test::equal(yt[{3,1}], 7.0f);
+			test::equal(yt[{1,2}], 9.0f);
+			// other strided views are written row by row
+			Tensor<2, float> cols = x.narrow(1, 1, 2);
+			save_npy(path, cols);
+			Tensor<2, float> yc = load_npy<2, float>(path);
+			test::equal(yc[{2,1}], 10.0f);
+			Tensor<3, std::int16_t> z{{2,1,3}};
+			arange(z, std::int16_t(-3));
+			save_npy(path, z);
+			Tensor<3, std::int16_t> zl = load_npy<3, std::int16_t>(path);
+			test::equal(zl[{1,0,2}], 2);
+			std::remove(path.c_str());
+		};
+		TEST("Streaming reads"){
+			const std::string path = "/tmp/tensor_test_rows.npy";
+			Tensor<2, double> x{{5,2}};
+			arange(x, 1.0);
+			save_npy(path, x);
+			NpyReader reader{path};
+			Tensor<2, double> rows{{2,2}};
+			test::equal(reader.readRows(rows), 2);
+			test::equal(rows[{1,1}], 4.0);
+			test::equal(reader.readRows(rows), 2);
+			test::equal(rows[{0,0}], 5.0);
+			test::equal(reader.readRows(rows), 1);
+			test::equal(rows[{0,1}], 10.0);
+			test::equal(reader.readRows(rows), 0);
+			// a whole array into a preallocated strided view
+			NpyReader whole{path};
+			Tensor<2, double> target{{2,5}};
+			Tensor<2, double> targetT = target.swapaxes(0,1);
+			whole.read(targetT);
+			test::equal(target[{1,4}], 10.0);
+			std::remove(path.c_str());
+		};
+		TEST("npz archives"){
+			const std::string path = "/tmp/tensor_test.npz";
+			Tensor<2, float> a{{2,3}};
+			arange(a, 0.5f);
+			Tensor<1, std::int64_t> b{{4}};
+			arange(b, std::int64_t(10));
+			{
+				NpzWriter out{path};
+				out.add("a", a);
+				out.add("b", b);
+			}
+			NpzReader in{path};
+			test::equal(in.names().size(), 2);
+			test::equal(in.contains("b"), true);
+			Tensor<2, float> la = in.load<2, float>("a");
+			test::equal(la[{1,2}], 5.5f);
+			Tensor<1, std::int64_t> lb = in.load<1, std::int64_t>("b");
+			test::equal(lb[{3}], 13);
+			NpyReader rb = in.open("b");
+			test::equal(rb.remaining(), 4);
+			std::remove(path.c_str());
+		};
+		THROW_TEST("Type mismatch"){
+			const std::string path = "/tmp/tensor_test_type.npy";
+			Tensor<1, float> x{{3}};
+			save_npy(path, x);
+			load_npy<1, double>(path);
+		};
+	}
+	SECTION("Compiled graphs"){
+		TEST("Fused elementwise chain"){
+			Graph<float> g;
+			GraphTensor<2, float> a = g.input<2>({64,100});
+			GraphTensor<2, float> b = g.input<2>({64,100});
+			GraphTensor<2, float> t = mul(add(a, b), a);
+			t -= b;
+			GraphTensor<2, float> y = map(tanh(scale(t, 0.5f)), +[](float v){ return v + 1.0f; });
+			g.output(y);
+			g.compile();
+			// one kernel, only the output is stored
+			test::equal(g.stepCount(), 1);
+			test::equal(g.arenaElements(), 6400);
+			Tensor<2, float> x1{{64,100}}, x2{{64,100}};
+			uniform(x1, -1.0f, 1.0f, 1);
+			uniform(x2, -1.0f, 1.0f, 2);
+			g.bind(a, x1);
+			g.bind(b, x2);
+			g.run();
+			test::near(y.value()[{3,7}], std::tanh(0.5f * ((x1[{3,7}] + x2[{3,7}]) * x1[{3,7}] - x2[{3,7}])) + 1.0f);
+			test::near(y.value()[{63,99}], std::tanh(0.5f * ((x1[{63,99}] + x2[{63,99}]) * x1[{63,99}] - x2[{63,99}])) + 1.0f);
+			// replay with a strided input
+			Tensor<2, float> x3{{100,64}};
+			uniform(x3, -1.0f, 1.0f, 3);
+			Tensor<2, float> x3t = x3.swapaxes(0,1);
+			g.bind(b, x3t);
+			const std::size_t buffers = RefCounter::refCounter.size();
+			g.run();
+			test::equal(RefCounter::refCounter.size(), buffers);
+			test::near(y.value()[{5,90}], std::tanh(0.5f * ((x1[{5,90}] + x3[{90,5}]) * x1[{5,90}] - x3[{90,5}])) + 1.0f);
+		};
+		TEST("Matmul epilogues and arena reuse"){
+			Graph<double> g;
+			Tensor<2, double> w1{{8,16}}, w2{{16,16}}, w3{{16,16}};
+			Tensor<1, double> b1{{16}};
+			uniform(w1, -1.0, 1.0, 4);
+			uniform(w2, -1.0, 1.0, 5);
+			uniform(w3, -1.0, 1.0, 6);
+			uniform(b1, -1.0, 1.0, 7);
+			GraphTensor<2, double> x = g.input<2>({4,8});
+			GraphTensor<2, double> h = matmul(x, g.constant(w1));
+			h += g.constant(b1);
+			h = relu(h);
+			GraphTensor<2, double> h2 = matmul(h, g.constant(w2));
+			GraphTensor<2, double> h3 = matmul(h2, g.constant(w3));
+			GraphTensor<2, double> y = matmul(h3, g.constant(w3).swapaxes(0,1));
+			GraphTensor<1, double> row = y.slice(1);
+			g.output(row);
+			g.compile();
+			// bias and relu run in the first matmul's epilogue, h and h3 as well as h2 and y share memory
+			test::equal(g.arenaElements(), 2 * 64);
+			Tensor<2, double> xin{{4,8}};
+			uniform(xin, -1.0, 1.0, 8);
+			g.bind(x, xin);
+			g.run();
+			// eager reference
+			Tensor<2, double> e1{{4,16}}, e2{{4,16}}, e3{{4,16}}, e4{{4,16}};
+			const Epilogue<double> ep{1, 0, &b1, Activation::RELU};
+			matmul(xin, w1, e1, ep);
+			matmul(e1, w2, e2);
+			matmul(e2, w3, e3);
+			matmul(e3, w3.swapaxes(0,1), e4);
+			for(std::size_t j=0;j<16;j++){
+				test::near(row.value()[{j}], e4[{1,j}]);
+			}
+		};
+		TEST("Biases viewed after the matmul stay separate"){
+			Graph<double> g;
+			Tensor<2, double> w{{8,16}};
+			uniform(w, -1.0, 1.0, 9);
+			GraphTensor<2, double> x = g.input<2>({4,8});
+			GraphTensor<2, double> table = g.input<2>({3,16});
+			GraphTensor<2, double> y = matmul(x, g.constant(w));
+			y += table.slice(1);
+			g.output(y);
+			g.compile();
+			Tensor<2, double> xin{{4,8}}, t1{{3,16}}, t2{{3,16}};
+			uniform(xin, -1.0, 1.0, 10);
+			uniform(t1, -1.0, 1.0, 11);
+			uniform(t2, -1.0, 1.0, 12);
+			g.bind(x, xin);
+			for(Tensor<2, double>* t: {&t1, &t2}){
+				g.bind(table, *t);
+				g.run();
+				Tensor<2, double> e{{4,16}};
+				Tensor<1, double> b = t->slice(1);
+				matmul(xin, w, e, Epilogue<double>{1, 0, &b, Activation::NONE});
+				for(std::size_t j=0;j<16;j++){
+					test::near(y.value()[{2,j}], e[{2,j}]);
+				}
+			}
+		};
+		TEST("Warm runs don't allocate"){
+			Graph<float> g;
+			Tensor<2, float> w{{32,32}};
+			uniform(w, -1.0f, 1.0f, 13);
+			GraphTensor<2, float> x = g.input<2>({16,32});
+			GraphTensor<2, float> h = relu(matmul(x, g.constant(w)));
+			g.output(tanh(add(scale(h, 2.0f), h)));
+			g.compile();
+			Tensor<2, float> xin{{16,32}};
+			uniform(xin, -1.0f, 1.0f, 14);
+			g.bind(x, xin);
+			g.run();
+			const std::size_t allocations = heapAllocations.load();
+			for(int i=0;i<3;i++){
+				g.run();
+			}
+			test::equal(heapAllocations.load(), allocations);
+		};
+		THROW_TEST("Shapes are checked when recording"){
+			Graph<float> g;
+			GraphTensor<2, float> a = g.input<2>({3,4});
+			GraphTensor<2, float> b = g.input<2>({4,4});
+			add(a, b);
+		};
+		THROW_TEST("Unbound input"){
+			Graph<float> g;
+			GraphTensor<1, float> a = g.input<1>({3});
+			g.output(relu(a));
+			g.compile();
+			g.run();
+		};
+	}
+	SECTION("Memory accounting"){
+		TEST("Live bytes, types and peak"){
+			const std::size_t base = MemoryTracker::liveBytes();
+			const std::size_t floats = MemoryTracker::liveBytes(DType::FLOAT32);
+			const std::uint64_t count = MemoryTracker::allocationCount();
+			MemoryTracker::resetPeak();
+			{
+				Tensor<2, float> x{{100,10}};
+				Tensor<1, float> row = x.slice(3);
+				Tensor<2, float> copy{x};
+				test::equal(MemoryTracker::liveBytes(), base + 4000);
+				test::equal(MemoryTracker::liveBytes(DType::FLOAT32), floats + 4000);
+				// a view and a copy share the buffer, no new allocation is charged
+				const std::uint64_t allocations = MemoryTracker::allocationCount();
+				Tensor<1, float> again = copy.slice(4);
+				test::equal(MemoryTracker::allocationCount(), allocations);
+				test::equal(allocations > count, true);
+				Tensor<1, std::int64_t> idx{{10}};
+				test::equal(MemoryTracker::liveBytes(DType::INT64) >= 80, true);
+			}
+			test::equal(MemoryTracker::liveBytes(), base);
+			test::equal(MemoryTracker::peakBytes() >= base + 4080, true);
+		};
+		TEST("Tags"){
+			{
+				MemoryTag encoder("encoder");
+				Tensor<1, double> x{{50}};
+				{
+					MemoryTag decoder("decoder");
+					Tensor<1, double> y{{25}};
+					test::equal(MemoryTracker::liveBytes("decoder"), 200);
+				}
+				test::equal(MemoryTracker::liveBytes("encoder"), 400);
+				test::equal(MemoryTracker::liveBytes("decoder"), 0);
+			}
+			test::equal(MemoryTracker::liveBytes("encoder"), 0);
+		};
+		TEST("Soft limit"){
+			std::size_t calls = 0, reported = 0;
+			// the callback captures locals, take it out even when a check throws
+			struct Unset { ~Unset() { MemoryTracker::setSoftLimit(0); } } unset;
+			const std::size_t limit = MemoryTracker::liveBytes() + 1000;
+			MemoryTracker::setSoftLimit(limit, [&](std::size_t live, std::size_t){
+				calls++;
+				reported = live;
+			});
+			{
+				Tensor<1, float> small{{100}};
+				test::equal(calls, 0);
+				Tensor<1, float> big{{500}};
+				test::equal(calls, 1);
+				test::equal(reported > limit, true);
+				Tensor<1, float> more{{500}};
+				test::equal(calls, 1);
+			}
+			Tensor<1, float> again{{500}};
+			test::equal(calls, 2);
+		};
+		TEST("Stacks of large allocations"){
+			MemoryTracker::captureStacks(1 << 20);
+			{
+				Tensor<1, double> small{{100}};
+				Tensor<2, double> big{{512,512}};
+				std::vector<LargeAllocation> large = MemoryTracker::largeAllocations();
+				test::equal(large.size(), 1);
+				test::equal(large[0].bytes, 512*512*sizeof(double));
+				test::equal(large[0].dtype == DType::FLOAT64, true);
+				test::equal(large[0].frames.empty(), false);
+			}
+			test::equal(MemoryTracker::largeAllocations().size(), 0);
+			MemoryTracker::captureStacks(0);
+		};
+	}
     test::start();
 }
-